@@ -19,12 +19,36 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
 struct adaptive_model;
 struct static_model;
+struct context_hash_model;
+struct tree_model;
 struct arithmetic_codec;
 
+// Memory allocator of a codec or a model, all its allocations go through it until terminate
+// A NULL allocator passed to the *_with_allocator() functions selects the default one (AC_ALLOC/AC_FREE)
+struct ac_allocator
+{
+    void* (*alloc)(void* context, size_t size);
+    void (*free)(void* context, void* pointer);
+    void* context;
+};
+
+// A bit model is the probability of the bit being 0, stored on 12 bits. It can be embedded in any user structure
+typedef uint16_t ac_bit_model;
+
+// Initial state of a bit model (probability of 0.5)
+#define AC_BIT_MODEL_INIT (1 << 11)
+
+// Sum of normalized frequencies
+#define AC_FREQUENCY_TOTAL (1 << 15)
+
+// Number of symbols of the adaptive model used to code frequency tables
+#define AC_FREQUENCY_MODEL_SYMBOLS (18)
+
 //----------------------------------------------------------------------------------------------------------------------
 // Adaptive data model
 //----------------------------------------------------------------------------------------------------------------------
@@ -32,6 +56,9 @@ struct arithmetic_codec;
 // Initialize the adaptive data model, returns a pointer to the model
 struct adaptive_model* adaptive_model_init(uint32_t number_of_symbols);
 
+// Same as adaptive_model_init(), memory is allocated with the allocator
+struct adaptive_model* adaptive_model_init_with_allocator(uint32_t number_of_symbols, const struct ac_allocator* allocator);
+
 // Release memory
 void adaptive_model_terminate(struct adaptive_model* model);
 
@@ -41,9 +68,39 @@ void adaptive_model_reset(struct adaptive_model* model);
 // Change the number of symbols of the model. It will reset the model
 void adaptive_model_set_alphabet(struct adaptive_model* model, uint32_t number_of_symbols);
 
-// Return how many time the symbol has been encoded
+// Return how many time the symbol has been encoded (weighted by the decay if enabled)
 uint32_t adaptive_model_get_symbol_count(const struct adaptive_model* model, uint32_t symbol);
 
+// Enable exponential forgetting for non-stationary data. It will reset the model
+//      decay_shift     0 to disable (default), otherwise the weight of new symbols grows by 1/2^decay_shift at each
+//                      model update, so the statistics forget the past after about 2^decay_shift updates.
+//                      Counts are renormalized when their total exceeds the maximum. Valid range is [0;8]
+void adaptive_model_set_decay(struct adaptive_model* model, uint32_t decay_shift);
+
+// Change the precision of the probabilities in bits, [12;16] (default 15). It will reset the model
+// Lower precision gives smaller decoder tables, higher precision codes very skewed distributions better.
+// The number of symbols must not exceed 2^(precision-1)
+void adaptive_model_set_precision(struct adaptive_model* model, uint32_t precision);
+
+// Rebuild the distribution of a model used in quasi-static mode (see ac_encode_quasi_static()) from the statistics
+// gathered since the start of the block. Must be called at the same point by the encoder and the decoder
+void adaptive_model_end_block(struct adaptive_model* model);
+
+// Enable (non-zero) or disable the frequency-sorted remapping. It will reset the model
+// Symbols are reordered at each model update so the few most frequent ones come first and are decoded with a short
+// linear scan instead of a table look-up and bisection. Worth it for very skewed distributions, transparent otherwise
+void adaptive_model_set_sorted(struct adaptive_model* model, int enable);
+
+// Size in bytes of the state of the model (statistics and distribution), to persist it with an unfinished stream
+uint32_t adaptive_model_get_state_size(const struct adaptive_model* model);
+
+// Write the state of the model, returns the number of bytes written
+uint32_t adaptive_model_save_state(const struct adaptive_model* model, void* state);
+
+// Restore a state saved from a model with the same settings (alphabet, precision, decay, sorted), returns 0 if the
+// state doesn't match the model. The state is in the native byte order
+int adaptive_model_load_state(struct adaptive_model* model, const void* state, uint32_t size);
+
 //----------------------------------------------------------------------------------------------------------------------
 // Static data model
 //----------------------------------------------------------------------------------------------------------------------
@@ -54,6 +111,10 @@ uint32_t adaptive_model_get_symbol_count(const struct adaptive_model* model, uin
 //                          Each float must be [0;1]
 struct static_model* static_model_init(uint32_t number_of_symbols, const float *probability);
 
+// Same as static_model_init(), memory is allocated with the allocator
+struct static_model* static_model_init_with_allocator(uint32_t number_of_symbols, const float *probability,
+                                                      const struct ac_allocator* allocator);
+
 
 // Set up the distribution
 //      number_of_symbols   Number of symbols maximum
@@ -62,9 +123,111 @@ struct static_model* static_model_init(uint32_t number_of_symbols, const float *
 void static_model_set_distribution(struct static_model* model, uint32_t number_of_symbols, const float *probability);
 
 
+// Set up the distribution from normalized frequencies
+//      number_of_symbols   Number of symbols maximum
+//      frequency           Pointer to an array of number_of_symbols frequencies, at least 1 each and summing to
+//                          AC_FREQUENCY_TOTAL. They are rescaled if the model has a different precision
+void static_model_set_frequencies(struct static_model* model, uint32_t number_of_symbols, const uint32_t *frequency);
+
+// Change the precision of the probabilities in bits, [12;16] (default 15)
+// The distribution is reset to uniform, set it again with static_model_set_distribution() or
+// static_model_set_frequencies() (frequencies are rescaled to the model precision)
+void static_model_set_precision(struct static_model* model, uint32_t precision);
+
+// Enable (non-zero) or disable the full lookup decoder table: one 16-bit entry per probability slot
+// (2^precision entries, 64KB at the default precision), decoding becomes a single load without search.
+// The model is only read while decoding, so one model and its table can be shared by several threads
+// Worth it for alphabets larger than 16 symbols, small alphabets already decode without division
+void static_model_set_lookup(struct static_model* model, int enable);
+
+// Enable (non-zero) or disable the cutoff decoder table: at least two buckets per symbol (16KB for 2048 symbols),
+// each bucket stores its first symbol and where the next one starts, decoding is a load and a compare except in the
+// rare buckets holding several symbol boundaries. The table grows with the alphabet instead of 2^precision.
+// The lookup and cutoff tables are exclusive, enabling one disables the other
+void static_model_set_cutoff(struct static_model* model, int enable);
+
 // Release memory
 void static_model_terminate(struct static_model* model);
 
+//----------------------------------------------------------------------------------------------------------------------
+// Semi-static blocks
+//----------------------------------------------------------------------------------------------------------------------
+//
+// Each block carries its own frequency table, delta-coded against the table of the previous block, and its symbols
+// are coded with a static model. A typical block is encoded with its own codec:
+//      ac_histogram() -> ac_normalize_frequencies() -> ac_put_frequencies() -> static_model_set_frequencies()
+//      -> ac_encode_static() for each symbol
+// The decoder reads the tables of the blocks in order (ac_get_frequencies() only needs the previous table), then
+// each block's codec can decode its symbols on any thread.
+
+// Compute the histogram of symbols, histogram must be an array of number_of_symbols elements
+void ac_histogram(const uint32_t* symbols, uint32_t count, uint32_t number_of_symbols, uint32_t* histogram);
+
+// Scale a histogram to frequencies that sum to AC_FREQUENCY_TOTAL, every symbol gets a frequency of at least 1
+void ac_normalize_frequencies(uint32_t number_of_symbols, const uint32_t* histogram, uint32_t* frequency);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Hashed context model
+//----------------------------------------------------------------------------------------------------------------------
+
+// Initialize a hashed context model for byte symbols, returns a pointer to the model
+//      memory_size         Memory budget in bytes (at least 64), rounded down to a power of two
+//
+// Contexts (for example the two previous bytes for an order-2 model) are hashed into buckets of two slots,
+// each slot holds a 8 bits checksum and the bit models of one nibble. On collision the least used slot is replaced.
+struct context_hash_model* context_hash_model_init(uint32_t memory_size);
+
+// Same as context_hash_model_init(), memory is allocated with the allocator
+struct context_hash_model* context_hash_model_init_with_allocator(uint32_t memory_size, const struct ac_allocator* allocator);
+
+// Reset all contexts to the uniform distribution
+void context_hash_model_reset(struct context_hash_model* model);
+
+// Size in bytes of the state of the model
+uint32_t context_hash_model_get_state_size(const struct context_hash_model* model);
+
+// Write the state of the model, returns the number of bytes written
+uint32_t context_hash_model_save_state(const struct context_hash_model* model, void* state);
+
+// Restore a state saved from a model with the same memory size, returns 0 if the state doesn't match the model
+int context_hash_model_load_state(struct context_hash_model* model, const void* state, uint32_t size);
+
+// Release memory
+void context_hash_model_terminate(struct context_hash_model* model);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Binary tree model
+//----------------------------------------------------------------------------------------------------------------------
+
+// Initialize a binary tree model for symbols up to 32 bits, returns a pointer to the model
+//      number_of_bits      Size of the symbols in bits [1;32]
+//      max_nodes           Maximum number of nodes of the tree
+//
+// A symbol is coded bit by bit from the most significant one, each prefix seen has its own adaptive bit model.
+// Nodes are allocated on first use from a pool that grows up to max_nodes (12 bytes per node), once the pool is full
+// the remaining bits of new prefixes share one bit model per level.
+struct tree_model* tree_model_init(uint32_t number_of_bits, uint32_t max_nodes);
+
+// Same as tree_model_init(), memory is allocated with the allocator
+struct tree_model* tree_model_init_with_allocator(uint32_t number_of_bits, uint32_t max_nodes,
+                                                  const struct ac_allocator* allocator);
+
+// Reset the model, all nodes are released to the pool
+void tree_model_reset(struct tree_model* model);
+
+// Size in bytes of the state of the model, grows with the number of nodes used
+uint32_t tree_model_get_state_size(const struct tree_model* model);
+
+// Write the state of the model, returns the number of bytes written
+uint32_t tree_model_save_state(const struct tree_model* model, void* state);
+
+// Restore a state saved from a model with the same number of bits and max nodes, returns 0 if the state doesn't
+// match the model
+int tree_model_load_state(struct tree_model* model, const void* state, uint32_t size);
+
+// Release memory
+void tree_model_terminate(struct tree_model* model);
+
 //----------------------------------------------------------------------------------------------------------------------
 // Arithmetic Codec
 //----------------------------------------------------------------------------------------------------------------------
@@ -73,10 +236,13 @@ void static_model_terminate(struct static_model* model);
 // You need to call ac_set_buffer() before starting encode/decode
 struct arithmetic_codec* ac_init(void);
 
+// Same as ac_init(), memory (including the buffer allocated by ac_set_buffer()) is allocated with the allocator
+struct arithmetic_codec* ac_init_with_allocator(const struct ac_allocator* allocator);
+
 
 // Set the buffer for compressed data
 //      max_code_bytes  Maximum size of the buffer in bytes
-//      user_buffer     If the pointer to the buffer is NULL, memory will be allocated internally using malloc()
+//      user_buffer     If the pointer to the buffer is NULL, memory will be allocated internally with the codec allocator
 void ac_set_buffer(struct arithmetic_codec* codec, uint32_t max_code_bytes, uint8_t *user_buffer);
 
 // Set the codec to encoding mode
@@ -103,18 +269,327 @@ void ac_encode_adaptive(struct arithmetic_codec* codec, uint32_t data, struct ad
 // Decode the next data from the buffer using an adaptative model
 uint32_t ac_decode_adaptive(struct arithmetic_codec* codec, struct adaptive_model* model);
 
+// Encode data using an adaptive model in quasi-static mode: the statistics are gathered but the distribution only
+// changes when adaptive_model_end_block() is called, so decoding costs the same as with a static model
+void ac_encode_quasi_static(struct arithmetic_codec* codec, uint32_t data, struct adaptive_model* model);
+
+// Decode the next data from the buffer using an adaptive model in quasi-static mode
+uint32_t ac_decode_quasi_static(struct arithmetic_codec* codec, struct adaptive_model* model);
+
 // Encode data using an static model, the model should be initialized
 void ac_encode_static(struct arithmetic_codec* codec, uint32_t data, struct static_model* model);
 
 // Decode the next data from the buffer using an static model
 uint32_t ac_decode_static(struct arithmetic_codec* codec, struct static_model* model);
 
+// Encode a bit using an adaptive bit model, the model is updated
+void ac_encode_bit(struct arithmetic_codec* codec, uint32_t bit, ac_bit_model* model);
+
+// Decode a bit using an adaptive bit model, the model is updated
+uint32_t ac_decode_bit(struct arithmetic_codec* codec, ac_bit_model* model);
+
+// Encode a byte (data must be < 256) in the given context using a hashed context model
+void ac_encode_context_hash(struct arithmetic_codec* codec, uint32_t data, uint32_t context, struct context_hash_model* model);
+
+// Decode a byte in the given context using a hashed context model
+uint32_t ac_decode_context_hash(struct arithmetic_codec* codec, uint32_t context, struct context_hash_model* model);
+
+// Encode data using a binary tree model
+void ac_encode_tree(struct arithmetic_codec* codec, uint32_t data, struct tree_model* model);
+
+// Decode the next data from the buffer using a binary tree model
+uint32_t ac_decode_tree(struct arithmetic_codec* codec, struct tree_model* model);
+
+// Encode a normalized frequency table, delta-coded against the previous table
+//      model       Adaptive model of AC_FREQUENCY_MODEL_SYMBOLS symbols, used for the size of the deltas
+//      previous    Table of the previous block, NULL for the first block
+void ac_put_frequencies(struct arithmetic_codec* codec, struct adaptive_model* model, uint32_t number_of_symbols,
+                        const uint32_t* frequency, const uint32_t* previous);
+
+// Decode a normalized frequency table, see ac_put_frequencies()
+void ac_get_frequencies(struct arithmetic_codec* codec, struct adaptive_model* model, uint32_t number_of_symbols,
+                        uint32_t* frequency, const uint32_t* previous);
+
 // Return a pointer to the compressed buffer
 uint8_t* ac_get_buffer(struct arithmetic_codec* codec);
 
-// Return a pointer to the compressed buffer
+// Release memory
 void ac_terminate(struct arithmetic_codec* codec);
 
+//----------------------------------------------------------------------------------------------------------------------
+// Checkpoints
+//----------------------------------------------------------------------------------------------------------------------
+//
+// A checkpoint is a snapshot of the encoder state between two symbols. Stored next to the stream, checkpoints let
+// several decoders start in the middle of the same stream, so the number of decoding threads can be chosen at decode
+// time without re-encoding: with T threads, thread t decodes from checkpoint[t*count/T] to the next selected one.
+// Only the codec state is saved, models must be the same at that point for the encoder and the decoder (static
+// models, bits, or adaptive models reset at each checkpoint).
+
+struct ac_checkpoint
+{
+    uint32_t symbol_index;      // number of symbols coded before the checkpoint, set by the user
+    uint32_t byte_offset;       // position of the encoder in the compressed buffer
+    uint32_t base, length;      // encoder interval
+};
+
+// Take a checkpoint of the encoder, symbol_index is stored as is
+void ac_get_checkpoint(struct arithmetic_codec* codec, uint32_t symbol_index, struct ac_checkpoint* checkpoint);
+
+// Set the codec to decoding mode, starting at a checkpoint of the stream set with ac_set_buffer(). Bytes past the
+// buffer size are read as zeros
+void ac_start_decoder_at(struct arithmetic_codec* codec, const struct ac_checkpoint* checkpoint);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Encoder resume
+//----------------------------------------------------------------------------------------------------------------------
+//
+// An encoder can be suspended and resumed later (in another process) to append to the same stream, the result is
+// the same as if it had never stopped. Save the state of the adaptive models with it (see *_save_state()).
+// A carry can still change the last bytes written, these pending bytes are kept in the state and written again at
+// the start of the buffer by ac_resume_encoder(): the final stream is the settled bytes of each session followed by
+// the output of the last one.
+
+struct ac_encoder_state
+{
+    uint32_t base, length;      // encoder interval
+    uint32_t num_pending;       // bytes at the end of the output not settled yet
+    uint32_t pending_byte;      // first pending byte, the others are 0xFF
+};
+
+// Stop the encoder without flushing, returns the number of settled bytes at the start of the buffer
+uint32_t ac_suspend_encoder(struct arithmetic_codec* codec, struct ac_encoder_state* state);
+
+// Set the codec to encoding mode, continuing a suspended stream in the buffer set with ac_set_buffer()
+void ac_resume_encoder(struct arithmetic_codec* codec, const struct ac_encoder_state* state);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Small messages
+//----------------------------------------------------------------------------------------------------------------------
+//
+// A message is encoded in a user buffer (on the stack for example) without ac_set_buffer(), the internal buffer of
+// the codec is kept for later use. The flush writes the fewest bytes that still decode correctly and trailing zero
+// bytes are removed, as the message decoder reads zeros past the end. A short message can be empty.
+// After a message, the codec buffer is the message buffer until the next ac_set_buffer().
+
+// Set the codec to encoding mode in the buffer
+void ac_start_message_encoder(struct arithmetic_codec* codec, uint8_t* buffer, uint32_t buffer_size);
+
+// Stop encoding, return the size of the message
+uint32_t ac_stop_message_encoder(struct arithmetic_codec* codec);
+
+// Set the codec to decoding mode on a message, stop it with ac_stop_decoder()
+void ac_start_message_decoder(struct arithmetic_codec* codec, const uint8_t* message, uint32_t size);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Batch of messages
+//----------------------------------------------------------------------------------------------------------------------
+//
+// Code AC_BATCH_LANES independent messages at once with the same static model, one message per lane. The coding
+// steps of the lanes are interleaved so their dependency chains overlap instead of running one after the other.
+// Each lane is a small message (see above) and can also be decoded alone with ac_start_message_decoder().
+
+#ifndef AC_BATCH_LANES
+#define AC_BATCH_LANES (8)
+#endif
+
+// Encode one message per lane with a static model, sizes receive the size of each message
+//      buffers     Output buffer of each lane, buffer_size bytes each
+//      data        Symbols of each lane, count[lane] symbols (can be 0)
+void ac_encode_static_batch(uint8_t* const buffers[AC_BATCH_LANES], uint32_t buffer_size,
+                            const uint32_t* const data[AC_BATCH_LANES], const uint32_t count[AC_BATCH_LANES],
+                            const struct static_model* model, uint32_t sizes[AC_BATCH_LANES]);
+
+// Decode one message per lane with a static model, count[lane] symbols are written in data[lane]
+void ac_decode_static_batch(const uint8_t* const messages[AC_BATCH_LANES], const uint32_t sizes[AC_BATCH_LANES],
+                            uint32_t* const data[AC_BATCH_LANES], const uint32_t count[AC_BATCH_LANES],
+                            const struct static_model* model);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Codec pool
+//----------------------------------------------------------------------------------------------------------------------
+//
+// A thread-safe pool of codecs whose internal buffers are allocated and touched once at init, so a codec can be
+// acquired per message without malloc/free or page faults. Acquire and release only take a spinlock.
+
+struct ac_codec_pool;
+
+struct ac_codec_pool_stats
+{
+    uint32_t num_codecs;        // codecs owned by the pool
+    uint32_t in_use;            // codecs currently acquired
+    uint32_t max_in_use;        // high-water mark of in_use
+    uint32_t max_buffer_size;   // high-water mark of the internal buffer size of the released codecs
+    uint32_t num_failures;      // acquire calls that returned NULL
+};
+
+// Initialize a pool of codecs, returns a pointer to the pool
+//      number_of_codecs    Number of codecs, all created at init
+//      buffer_size         Size of the internal buffer of each codec (see ac_set_buffer())
+//      allocator           Allocator of the pool and its codecs, NULL for the default one
+struct ac_codec_pool* ac_codec_pool_init(uint32_t number_of_codecs, uint32_t buffer_size, const struct ac_allocator* allocator);
+
+// Return a codec ready to start encoding or decoding in its internal buffer, NULL if all codecs are in use
+struct arithmetic_codec* ac_codec_pool_acquire(struct ac_codec_pool* pool);
+
+// Give back a codec to the pool, the codec must be stopped. A buffer grown by ac_set_buffer() is kept, a user buffer
+// is replaced by a new internal buffer
+void ac_codec_pool_release(struct ac_codec_pool* pool, struct arithmetic_codec* codec);
+
+// Get the usage of the pool
+void ac_codec_pool_get_stats(struct ac_codec_pool* pool, struct ac_codec_pool_stats* stats);
+
+// Release memory, all codecs must have been released
+void ac_codec_pool_terminate(struct ac_codec_pool* pool);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Chunked output
+//----------------------------------------------------------------------------------------------------------------------
+//
+// When the size of the output is unknown, the encoder can write into fixed-size chunks taken from a pool as needed.
+// The chunks are returned as an array with the layout of struct iovec, ready for writev() or sendmsg() without
+// copying them into a contiguous buffer. Carries are propagated across chunk boundaries.
+
+struct ac_chunk
+{
+    void* data;
+    size_t size;
+};
+
+struct ac_chunk_pool;
+
+#define AC_MAX_SYMBOL_BYTES (4)
+
+// Initialize a thread-safe pool of chunks, returns a pointer to the pool
+//      chunk_size          Size of each chunk in bytes (at least 16)
+//      allocator           Allocator of the pool and its chunks, NULL for the default one
+struct ac_chunk_pool* ac_chunk_pool_init(uint32_t chunk_size, const struct ac_allocator* allocator);
+
+// Release memory, all chunks must have been released
+void ac_chunk_pool_terminate(struct ac_chunk_pool* pool);
+
+// Set the codec to encoding mode, the output goes to chunks of the pool
+void ac_start_chunk_encoder(struct arithmetic_codec* codec, struct ac_chunk_pool* pool);
+
+// Stop encoding, returns the number of chunks and sets *chunks to the array of chunks. The last chunk is partially
+// filled, the others are full. The chunks belong to the codec until ac_release_chunks(), which must be called before
+// the codec starts encoding or decoding again
+uint32_t ac_stop_chunk_encoder(struct arithmetic_codec* codec, const struct ac_chunk** chunks);
+
+// Give the chunks of the last chunked encoding back to their pool
+void ac_release_chunks(struct arithmetic_codec* codec);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Segmented input
+//----------------------------------------------------------------------------------------------------------------------
+//
+// The decoder can read a stream split into non-contiguous segments (e.g. a chain of receive buffers) without
+// coalescing them. Segments can have any size, including 0.
+
+// Set the codec to decoding mode on a list of segments, stop it with ac_stop_decoder()
+//      segments            Array of segments, with the layout of struct iovec. Must stay valid until decoding stops
+//      num_segments        Number of segments
+void ac_start_segment_decoder(struct arithmetic_codec* codec, const struct ac_chunk* segments, uint32_t num_segments);
+
+// Append segments received while decoding. The descriptors are copied, the data must stay valid until it is read.
+// Input must be appended before the decoder reads past the end of its segments, see ac_get_segment_bytes_left()
+void ac_append_segments(struct arithmetic_codec* codec, const struct ac_chunk* segments, uint32_t num_segments);
+
+// Returns the number of bytes a segment decoder has not read yet. Decoding a symbol reads at most
+// AC_MAX_SYMBOL_BYTES bytes (a single bit, adaptive or static symbol, or ac_get_bits())
+size_t ac_get_segment_bytes_left(const struct arithmetic_codec* codec);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Trace
+//----------------------------------------------------------------------------------------------------------------------
+
+// Operations recorded in a trace log. The log starts with the 4 bytes "ACT2", then each record is the operation
+// byte followed by its fields, encoded as LEB128 varints:
+//      START_ENCODER ... RESUME_ENCODER                    no field
+//      PUT_BITS, GET_BITS                                  number_of_bits, data
+//      ENCODE_BIT, DECODE_BIT                              probability of a zero before coding, bit
+//      ENCODE/DECODE_ADAPTIVE, QUASI_STATIC, STATIC, TREE  model id, symbol
+//      ENCODE_CONTEXT_HASH, DECODE_CONTEXT_HASH            model id, context, symbol
+//      ADAPTIVE_MODEL      model id, number_of_symbols, precision, decay, sorted, state size, state
+//      STATIC_MODEL        model id, number_of_symbols, precision, lookup, cutoff, distribution[number_of_symbols]
+//      CONTEXT_HASH_MODEL  model id, memory_size, state size, state
+//      TREE_MODEL          model id, number_of_bits, max_nodes, state size, state
+//
+// A model record is written before a symbol when the traced codec did not see the model yet, or when the model
+// changed since its last symbol in the log (settings, reset, loaded state, or coding by another codec). The state is
+// the raw bytes of the *_save_state() functions, its size is 0 when the model was just reset. The distribution of a
+// static model is its cumulative distribution scaled to 1<<precision. Model ids are unique in the process.
+//
+// Every coding function taking a codec is traced. The sessions started with ac_start_decoder_at(),
+// ac_suspend_encoder() or ac_resume_encoder() are recorded but cannot be replayed (the state of the coder is not
+// logged), neither are the batch functions which do not use a codec.
+enum ac_trace_op
+{
+    AC_TRACE_START_ENCODER,
+    AC_TRACE_STOP_ENCODER,
+    AC_TRACE_START_DECODER,
+    AC_TRACE_STOP_DECODER,
+    AC_TRACE_STOP_MESSAGE_ENCODER,
+    AC_TRACE_START_MESSAGE_DECODER,
+    AC_TRACE_START_DECODER_AT,
+    AC_TRACE_SUSPEND_ENCODER,
+    AC_TRACE_RESUME_ENCODER,
+    AC_TRACE_PUT_BITS,
+    AC_TRACE_GET_BITS,
+    AC_TRACE_ENCODE_BIT,
+    AC_TRACE_DECODE_BIT,
+    AC_TRACE_ENCODE_ADAPTIVE,
+    AC_TRACE_DECODE_ADAPTIVE,
+    AC_TRACE_ENCODE_QUASI_STATIC,
+    AC_TRACE_DECODE_QUASI_STATIC,
+    AC_TRACE_ENCODE_STATIC,
+    AC_TRACE_DECODE_STATIC,
+    AC_TRACE_ENCODE_TREE,
+    AC_TRACE_DECODE_TREE,
+    AC_TRACE_ENCODE_CONTEXT_HASH,
+    AC_TRACE_DECODE_CONTEXT_HASH,
+    AC_TRACE_ADAPTIVE_MODEL,
+    AC_TRACE_STATIC_MODEL,
+    AC_TRACE_CONTEXT_HASH_MODEL,
+    AC_TRACE_TREE_MODEL
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// CPU dispatch
+//----------------------------------------------------------------------------------------------------------------------
+//
+// The model rebuilds (count halving, cumulative distribution) and ac_histogram() have scalar, SSE4.2, AVX2 and AVX-512
+// variants. The best one supported by the CPU is selected the first time a kernel runs, on any thread, so the library
+// does not need any instruction set flag and one binary runs on any x86 CPU. Other architectures use the scalar
+// variants.
+
+enum ac_isa
+{
+    AC_ISA_SCALAR,
+    AC_ISA_SSE42,
+    AC_ISA_AVX2,
+    AC_ISA_AVX512
+};
+
+// Return the instruction set of the kernels in use
+enum ac_isa ac_get_isa(void);
+
+// Force the instruction set of the kernels (tests, benchmarks), returns 0 if the CPU does not support it
+// Not thread-safe: the kernels change under the models in use, call it while no other thread uses the library
+int ac_set_isa(enum ac_isa isa);
+
+#ifdef AC_TRACE
+
+// Receives the trace log by chunks
+typedef void (*ac_trace_callback)(void* user_data, const void* data, uint32_t size);
+
+// Record every call of the codec in a binary log, only available when the library is compiled with AC_TRACE
+// The log is flushed to the callback when the encoder/decoder is stopped and when the codec is terminated
+//      callback    NULL to stop tracing
+void ac_set_trace(struct arithmetic_codec* codec, ac_trace_callback callback, void* user_data);
+
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -129,6 +604,7 @@ void ac_terminate(struct arithmetic_codec* codec);
 #ifdef __ARITHMETIC_CODEC__IMPLEMENTATION__
 
 #include <assert.h>
+#include <string.h>
 
 #if !defined(AC_FREE) && !defined(AC_ALLOC)
 #include <stdlib.h>
@@ -136,662 +612,3347 @@ void ac_terminate(struct arithmetic_codec* codec);
 #define AC_ALLOC(a) malloc(a)
 #endif
 
+//----------------------------------------------------------------------------------------------------------------------
+static void* ac__default_alloc(void* context, size_t size)
+{
+    (void) context;
+    return AC_ALLOC(size);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void ac__default_free(void* context, void* pointer)
+{
+    (void) context;
+    AC_FREE(pointer);
+}
+
+static const struct ac_allocator ac__default_allocator = {ac__default_alloc, ac__default_free, NULL};
+
+//----------------------------------------------------------------------------------------------------------------------
+static inline void* ac__alloc(const struct ac_allocator* allocator, size_t size)
+{
+    return allocator->alloc(allocator->context, size);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static inline void ac__free(const struct ac_allocator* allocator, void* pointer)
+{
+    if (pointer != NULL)
+        allocator->free(allocator->context, pointer);
+}
+
 //-- constants --------------------------------------------------------------------------------------------------------------------
 #define AC__MinLength (0x01000000U)         // threshold for renormalization
 #define AC__MaxLength (0xFFFFFFFFU)        // maximum AC interval length
 
 // Maximum values for general models
-#define DM__LengthShift (15)                    // length bits discarded before mult.
-#define DM__MaxCount    (1 << DM__LengthShift)  // for adaptive models
-
+#define DM__LengthShift (15)                    // default length bits discarded before mult.
+#define DM__MinLengthShift (12)                 // precision range of the models
+#define DM__MaxLengthShift (16)
+#define DM__SortedScan (4)                      // ranks tried by linear scan before the search of sorted models
+
+// Bit models
+#define BM__LengthShift (12)                    // length bits discarded before mult.
+#define BM__MaxProbability (1 << BM__LengthShift)
+#define BM__AdaptShift  (5)                     // adaptation speed of bit models
+
+#if defined(AC_TRACE) && !defined(AC_TRACE_BUFFER_SIZE)
+#define AC_TRACE_BUFFER_SIZE (4096)             // bytes of trace log kept before calling the callback
+#endif
 
-//----------------------------------------------------------------------------------------------------------------------
-// Adaptive data model
-//----------------------------------------------------------------------------------------------------------------------
+#ifdef AC_TRACE
 
-struct adaptive_model
+// Every model carries a stamp for the trace logs: an id unique in the process, and a revision incremented by each
+// change of the model (settings, reset, load, coding) so a traced codec knows when to record its state again
+struct ac__trace_stamp
 {
-    uint32_t *distribution, *symbol_count, *decoder_table;
-    uint32_t total_count, update_cycle, symbols_until_update;
-    uint32_t data_symbols, last_symbol, table_size, table_shift;
+    uint32_t id, revision;
+    uint32_t reset;             // revision of the last reset
 };
 
-void adaptive_model_update(struct adaptive_model* model, int from_encoder);
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
 
 //----------------------------------------------------------------------------------------------------------------------
-struct adaptive_model* adaptive_model_init(uint32_t number_of_symbols)
+// Models can be created on several threads
+static uint32_t ac__trace_new_id(void)
 {
-    struct adaptive_model* model = (struct adaptive_model*) AC_ALLOC(sizeof(struct adaptive_model));
+#if defined(_MSC_VER) && !defined(__clang__)
+    static volatile long next_id;
+    return (uint32_t) _InterlockedIncrement(&next_id);
+#else
+    static uint32_t next_id;
+    return __atomic_add_fetch(&next_id, 1, __ATOMIC_RELAXED);
+#endif
+}
 
-    model->data_symbols = 0;
-    model->distribution = NULL;
+#define AC__TRACE_INIT(model) \
+    ((model)->trace.id = ac__trace_new_id(), (model)->trace.revision = (model)->trace.reset = 0)
+#define AC__TRACE_CHANGE(model) (++(model)->trace.revision)
+#define AC__TRACE_RESET(model) ((model)->trace.reset = ++(model)->trace.revision)
 
-    adaptive_model_set_alphabet(model, number_of_symbols);
-    
-    return model;
-}
+#else
+
+#define AC__TRACE_INIT(model)
+#define AC__TRACE_CHANGE(model)
+#define AC__TRACE_RESET(model)
+
+#endif
 
 //----------------------------------------------------------------------------------------------------------------------
-void adaptive_model_terminate(struct adaptive_model* model)
+// CPU dispatch
+//----------------------------------------------------------------------------------------------------------------------
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define AC__X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define AC__TARGET(isa)                     // MSVC accepts any intrinsic without flags
+#else
+#include <cpuid.h>
+#define AC__TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+#define AC__HistogramMinCount (4)           // symbols per histogram entry below which sub-histograms are not worth it
+
+struct ac__kernels
 {
-    AC_FREE(model->distribution);
-    AC_FREE(model);
-}
+    // halve the counts (rounding up), returns the new total
+    uint32_t (*halve_counts)(uint32_t* count, uint32_t n);
+
+    // distribution[k] = (scale * sum of count[0..k-1]) >> shift
+    void (*distribution)(const uint32_t* count, uint32_t* distribution, uint32_t n, uint32_t scale, uint32_t shift);
+
+    // same as ac_histogram()
+    void (*histogram)(const uint32_t* symbols, uint32_t count, uint32_t n, uint32_t* histogram);
+};
 
 //----------------------------------------------------------------------------------------------------------------------
-void adaptive_model_reset(struct adaptive_model* model)
+static uint32_t ac__halve_counts_scalar(uint32_t* count, uint32_t n)
 {
-    if (model->data_symbols == 0) 
-        return;
-
-    // restore probability estimates to uniform distribution
-    model->total_count = 0;
-    model->update_cycle = model->data_symbols;
+    uint32_t total = 0;
+    for (uint32_t k = 0; k < n; k++)
+        total += (count[k] = (count[k] + 1) >> 1);
+    return total;
+}
 
-    for (uint32_t k = 0; k < model->data_symbols; k++) 
-        model->symbol_count[k] = 1;
+//----------------------------------------------------------------------------------------------------------------------
+static inline void ac__distribution_tail(const uint32_t* count, uint32_t* distribution, uint32_t k, uint32_t n,
+                                         uint32_t scale, uint32_t shift, uint32_t sum)
+{
+    for (; k < n; k++)
+    {
+        distribution[k] = (scale * sum) >> shift;
+        sum += count[k];
+    }
+}
 
-    adaptive_model_update(model, 0);
-    model->symbols_until_update = model->update_cycle = (model->data_symbols + 6) >> 1;
+//----------------------------------------------------------------------------------------------------------------------
+static void ac__distribution_scalar(const uint32_t* count, uint32_t* distribution, uint32_t n, uint32_t scale,
+                                    uint32_t shift)
+{
+    ac__distribution_tail(count, distribution, 0, n, scale, shift, 0);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-void adaptive_model_set_alphabet(struct adaptive_model* model, uint32_t number_of_symbols)
+static void ac__histogram_scalar(const uint32_t* symbols, uint32_t count, uint32_t n, uint32_t* histogram)
 {
-    assert(number_of_symbols>1 && (number_of_symbols <= (1 << 11))); // invalid number of data symbols
+    for (uint32_t k = 0; k < n; k++)
+        histogram[k] = 0;
 
-    if (model->data_symbols != number_of_symbols) 
+    for (uint32_t i = 0; i < count; i++)
     {
-        // assign memory for data model
-        model->data_symbols = number_of_symbols;
-        model->last_symbol = model->data_symbols - 1;
-        AC_FREE(model->distribution);
-
-        // define size of table for fast decoding
-        if (model->data_symbols > 16) 
-        {
-            uint32_t table_bits = 3;
-            while (model->data_symbols > (1U << (table_bits + 2))) ++table_bits;
-            model->table_size  = 1 << table_bits;
-            model->table_shift = DM__LengthShift - table_bits;
-            model->distribution = (uint32_t*) AC_ALLOC(sizeof(uint32_t) * (2 * model->data_symbols+model->table_size+2));
-            model->decoder_table = model->distribution + 2 * model->data_symbols;
-            assert(model->distribution != NULL);
-        }
-        else 
-        {
-            // small alphabet: no table needed
-            model->decoder_table = 0;
-            model->table_size = model->table_shift = 0;
-            model->distribution = (uint32_t*) AC_ALLOC( sizeof(uint32_t) * 2 * model->data_symbols);
-        }
-        model->symbol_count = model->distribution + model->data_symbols;
-        assert(model->distribution != NULL); // cannot assign model memory
+        assert(symbols[i] < n); // invalid data symbol
+        histogram[symbols[i]]++;
     }
-
-    // initialize model
-    adaptive_model_reset(model);
 }
 
+#ifdef AC__X86
+
 //----------------------------------------------------------------------------------------------------------------------
-void adaptive_model_update(struct adaptive_model* model, int from_encoder)
+// Count in 4 sub-histograms so consecutive equal symbols do not wait on each other's increment, the vector variants
+// only differ by the merge. Returns the 3 extra sub-histograms to merge, NULL if not worth it (histogram is done)
+static uint32_t* ac__histogram_split(const uint32_t* symbols, uint32_t count, uint32_t n, uint32_t* histogram)
 {
-    if ((model->total_count += model->update_cycle) > DM__MaxCount) 
+    uint32_t* extra = (count >= n * AC__HistogramMinCount) ? (uint32_t*) AC_ALLOC(sizeof(uint32_t) * 3 * n) : NULL;
+    if (extra == NULL)
     {
-        model->total_count = 0;
-        for (uint32_t n = 0; n < model->data_symbols; n++)
-            model->total_count += (model->symbol_count[n] = (model->symbol_count[n] + 1) >> 1);
+        ac__histogram_scalar(symbols, count, n, histogram);
+        return NULL;
     }
 
-    // compute cumulative distribution, decoder table
-    uint32_t k, sum = 0, s = 0;
-    uint32_t scale = 0x80000000U / model->total_count;
+    for (uint32_t k = 0; k < n; k++)
+        histogram[k] = extra[k] = extra[n+k] = extra[2*n+k] = 0;
 
-    if (from_encoder || (model->table_size == 0))
+    uint32_t i = 0;
+    for (; i + 4 <= count; i += 4)
     {
-        for (k = 0; k < model->data_symbols; k++) 
-        {
-            model->distribution[k] = (scale * sum) >> (31 - DM__LengthShift);
-            sum += model->symbol_count[k];
-        }
+        assert(symbols[i] < n && symbols[i+1] < n && symbols[i+2] < n && symbols[i+3] < n); // invalid data symbol
+        histogram[symbols[i]]++;
+        extra[symbols[i+1]]++;
+        extra[n + symbols[i+2]]++;
+        extra[2*n + symbols[i+3]]++;
     }
-    else 
+    for (; i < count; i++)
     {
-        for (k = 0; k < model->data_symbols; k++) 
-        {
-            model->distribution[k] = (scale * sum) >> (31 - DM__LengthShift);
-            sum += model->symbol_count[k];
-            uint32_t w = model->distribution[k] >> model->table_shift;
-            while (s < w) model->decoder_table[++s] = k - 1;
-        }
-        model->decoder_table[0] = 0;
-        while (s <= model->table_size) model->decoder_table[++s] = model->data_symbols - 1;
+        assert(symbols[i] < n); // invalid data symbol
+        histogram[symbols[i]]++;
     }
-
-    // set frequency of model updates
-    model->update_cycle = (5 * model->update_cycle) >> 2;
-    uint32_t max_cycle = (model->data_symbols + 6) << 3;
-    if (model->update_cycle > max_cycle) 
-        model->update_cycle = max_cycle;
-    model->symbols_until_update = model->update_cycle;
+    return extra;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-uint32_t adaptive_model_get_symbol_count(const struct adaptive_model* model, uint32_t symbol)
+// SSE4.2
+//----------------------------------------------------------------------------------------------------------------------
+
+static AC__TARGET("sse4.2") uint32_t ac__halve_counts_sse42(uint32_t* count, uint32_t n)
 {
-    assert(symbol < model->data_symbols); // invalid data symbols
-    assert(model->distribution != NULL); // adaptive model should be initialized
-
-    return model->symbol_count[symbol];
-}
-
-//----------------------------------------------------------------------------------------------------------------------
-// Static data model
-//----------------------------------------------------------------------------------------------------------------------
-
-struct static_model
-{
-    uint32_t *distribution, *decoder_table;
-    uint32_t data_symbols, last_symbol, table_size, table_shift;
-};
+    __m128i one = _mm_set1_epi32(1), total = _mm_setzero_si128();
+    uint32_t k = 0;
+    for (; k + 4 <= n; k += 4)
+    {
+        __m128i c = _mm_srli_epi32(_mm_add_epi32(_mm_loadu_si128((const __m128i*)(count + k)), one), 1);
+        _mm_storeu_si128((__m128i*)(count + k), c);
+        total = _mm_add_epi32(total, c);
+    }
+    total = _mm_add_epi32(total, _mm_shuffle_epi32(total, _MM_SHUFFLE(1, 0, 3, 2)));
+    total = _mm_add_epi32(total, _mm_shuffle_epi32(total, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (uint32_t)_mm_cvtsi128_si32(total) + ac__halve_counts_scalar(count + k, n - k);
+}
 
 //----------------------------------------------------------------------------------------------------------------------
-struct static_model* static_model_init(uint32_t number_of_symbols, const float *probability)
+static AC__TARGET("sse4.2") void ac__distribution_sse42(const uint32_t* count, uint32_t* distribution, uint32_t n,
+                                                        uint32_t scale, uint32_t shift)
 {
-    struct static_model* model = (struct static_model*) AC_ALLOC(sizeof(struct static_model));
-
-    model->data_symbols = 0;
-    model->distribution = NULL;
-
-    static_model_set_distribution(model, number_of_symbols, probability);
-
-    return model;
+    __m128i vscale = _mm_set1_epi32((int)scale), vshift = _mm_cvtsi32_si128((int)shift), sum = _mm_setzero_si128();
+    uint32_t k = 0;
+    for (; k + 4 <= n; k += 4)
+    {
+        // exclusive prefix sum of the 4 counts
+        __m128i c = _mm_loadu_si128((const __m128i*)(count + k));
+        __m128i x = _mm_slli_si128(c, 4);
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi32(x, sum);
+
+        _mm_storeu_si128((__m128i*)(distribution + k), _mm_srl_epi32(_mm_mullo_epi32(x, vscale), vshift));
+        sum = _mm_shuffle_epi32(_mm_add_epi32(x, c), _MM_SHUFFLE(3, 3, 3, 3));
+    }
+    ac__distribution_tail(count, distribution, k, n, scale, shift, (uint32_t)_mm_cvtsi128_si32(sum));
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-void static_model_set_distribution(struct static_model* model, uint32_t number_of_symbols, const float *probability)
+static AC__TARGET("sse4.2") void ac__histogram_sse42(const uint32_t* symbols, uint32_t count, uint32_t n,
+                                                     uint32_t* histogram)
 {
-    assert(number_of_symbols>1 && (number_of_symbols <= (1 << 11))); // invalid number of data symbols
-
-    if (model->data_symbols != number_of_symbols) 
-    {
-        // assign memory for data model
-        model->data_symbols = number_of_symbols;
-        model->last_symbol = model->data_symbols - 1;
-        AC_FREE(model->distribution);
-
-        // define size of table for fast decoding
-        if (model->data_symbols > 16) 
-        {
-            uint32_t table_bits = 3;
-            while (model->data_symbols > (1U << (table_bits + 2))) 
-                ++table_bits;
-            model->table_size  = 1 << table_bits;
-            model->table_shift = DM__LengthShift - table_bits;
-            model->distribution = (uint32_t*) AC_ALLOC(sizeof(uint32_t) * (model->data_symbols+model->table_size+2));
-            model->decoder_table = model->distribution + model->data_symbols;
-        }
-        else 
-        {                                  // small alphabet: no table needed
-            model->decoder_table = 0;
-            model->table_size = model->table_shift = 0;
-            model->distribution = (uint32_t*) AC_ALLOC(sizeof(uint32_t) * model->data_symbols);
-        }
-        assert(model->distribution != NULL);
-    }
-                                // compute cumulative distribution, decoder table
-    uint32_t s = 0;
-    float sum = 0.0f, p = 1.0f / (float)(model->data_symbols);
-
-    for (unsigned k = 0; k < model->data_symbols; k++) 
-    {
-        if (probability) 
-            p = probability[k];
-
-        assert(p>=0.f && p<= 1.f);
-        
-        model->distribution[k] = (uint32_t)(sum * (1 << DM__LengthShift));
-        sum += p;
-
-        if (model->table_size == 0) 
-            continue;
-
-        uint32_t w = model->distribution[k] >> model->table_shift;
-        while (s < w) model->decoder_table[++s] = k - 1;
-    }
+    uint32_t* extra = ac__histogram_split(symbols, count, n, histogram);
+    if (extra == NULL)
+        return;
 
-    if (model->table_size != 0) 
+    uint32_t k = 0;
+    for (; k + 4 <= n; k += 4)
     {
-        model->decoder_table[0] = 0;
-        while (s <= model->table_size) 
-            model->decoder_table[++s] = model->data_symbols - 1;
+        __m128i h = _mm_add_epi32(_mm_loadu_si128((const __m128i*)(histogram + k)),
+                                  _mm_loadu_si128((const __m128i*)(extra + k)));
+        h = _mm_add_epi32(h, _mm_add_epi32(_mm_loadu_si128((const __m128i*)(extra + n + k)),
+                                           _mm_loadu_si128((const __m128i*)(extra + 2*n + k))));
+        _mm_storeu_si128((__m128i*)(histogram + k), h);
     }
+    for (; k < n; k++)
+        histogram[k] += extra[k] + extra[n+k] + extra[2*n+k];
 
-    assert(sum >= 0.9999f && sum <= 1.001f);
-}
-
-//----------------------------------------------------------------------------------------------------------------------
-void static_model_terminate(struct static_model* model)
-{
-    AC_FREE(model->distribution);
-    AC_FREE(model);
+    AC_FREE(extra);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-// Arithmetic Codec
+// AVX2
 //----------------------------------------------------------------------------------------------------------------------
 
-struct arithmetic_codec
+static AC__TARGET("avx2") uint32_t ac__halve_counts_avx2(uint32_t* count, uint32_t n)
 {
-    uint8_t *code_buffer, *new_buffer, *ac_pointer;
-    uint32_t base, value, length;                     // arithmetic coding state
-    uint32_t buffer_size;
-    uint32_t mode;     // mode: 0 = undef, 1 = encoder, 2 = decoder
-};
+    __m256i one = _mm256_set1_epi32(1), total = _mm256_setzero_si256();
+    uint32_t k = 0;
+    for (; k + 8 <= n; k += 8)
+    {
+        __m256i c = _mm256_srli_epi32(_mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(count + k)), one), 1);
+        _mm256_storeu_si256((__m256i*)(count + k), c);
+        total = _mm256_add_epi32(total, c);
+    }
+    __m128i t = _mm_add_epi32(_mm256_castsi256_si128(total), _mm256_extracti128_si256(total, 1));
+    t = _mm_add_epi32(t, _mm_shuffle_epi32(t, _MM_SHUFFLE(1, 0, 3, 2)));
+    t = _mm_add_epi32(t, _mm_shuffle_epi32(t, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (uint32_t)_mm_cvtsi128_si32(t) + ac__halve_counts_scalar(count + k, n - k);
+}
 
 //----------------------------------------------------------------------------------------------------------------------
-inline static void ac_propagate_carry(struct arithmetic_codec* codec)
+static AC__TARGET("avx2") void ac__distribution_avx2(const uint32_t* count, uint32_t* distribution, uint32_t n,
+                                                     uint32_t scale, uint32_t shift)
 {
-    uint8_t * p;            
-    // carry propagation on compressed data buffer
-    for (p = codec->ac_pointer - 1; *p == 0xFFU; p--) 
-        *p = 0;
-    ++*p;
+    __m256i vscale = _mm256_set1_epi32((int)scale), sum = _mm256_setzero_si256();
+    __m256i lane3 = _mm256_set1_epi32(3), lane7 = _mm256_set1_epi32(7);
+    __m128i vshift = _mm_cvtsi32_si128((int)shift);
+    uint32_t k = 0;
+    for (; k + 8 <= n; k += 8)
+    {
+        // inclusive prefix sum in each 128-bit lane, then the low lane total carries into the high lane
+        __m256i c = _mm256_loadu_si256((const __m256i*)(count + k));
+        __m256i x = _mm256_add_epi32(c, _mm256_slli_si256(c, 4));
+        x = _mm256_add_epi32(x, _mm256_slli_si256(x, 8));
+        x = _mm256_add_epi32(x, _mm256_blend_epi32(_mm256_setzero_si256(), _mm256_permutevar8x32_epi32(x, lane3), 0xF0));
+        x = _mm256_add_epi32(x, sum);
+
+        __m256i exclusive = _mm256_sub_epi32(x, c);
+        _mm256_storeu_si256((__m256i*)(distribution + k), _mm256_srl_epi32(_mm256_mullo_epi32(exclusive, vscale), vshift));
+        sum = _mm256_permutevar8x32_epi32(x, lane7);
+    }
+    ac__distribution_tail(count, distribution, k, n, scale, shift, (uint32_t)_mm256_cvtsi256_si32(sum));
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-inline static void ac_renorm_enc_interval(struct arithmetic_codec* codec)
+static AC__TARGET("avx2") void ac__histogram_avx2(const uint32_t* symbols, uint32_t count, uint32_t n,
+                                                  uint32_t* histogram)
 {
-    do  // output and discard top byte
+    uint32_t* extra = ac__histogram_split(symbols, count, n, histogram);
+    if (extra == NULL)
+        return;
+
+    uint32_t k = 0;
+    for (; k + 8 <= n; k += 8)
     {
-        *codec->ac_pointer++ = (uint8_t)(codec->base >> 24);
-        codec->base <<= 8;
-    } while ((codec->length <<= 8) < AC__MinLength);        // length multiplied by 256
+        __m256i h = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(histogram + k)),
+                                     _mm256_loadu_si256((const __m256i*)(extra + k)));
+        h = _mm256_add_epi32(h, _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(extra + n + k)),
+                                                 _mm256_loadu_si256((const __m256i*)(extra + 2*n + k))));
+        _mm256_storeu_si256((__m256i*)(histogram + k), h);
+    }
+    for (; k < n; k++)
+        histogram[k] += extra[k] + extra[n+k] + extra[2*n+k];
+
+    AC_FREE(extra);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-inline static void ac_renorm_dec_interval(struct arithmetic_codec* codec)
+// AVX-512
+//----------------------------------------------------------------------------------------------------------------------
+
+static AC__TARGET("avx512f") uint32_t ac__halve_counts_avx512(uint32_t* count, uint32_t n)
 {
-    do // read least-significant byte
+    __m512i one = _mm512_set1_epi32(1), total = _mm512_setzero_si512();
+    uint32_t k = 0;
+    for (; k + 16 <= n; k += 16)
     {
-        codec->value = (codec->value << 8) | (uint32_t)(*++codec->ac_pointer);
-    } while ((codec->length <<= 8) < AC__MinLength);        // length multiplied by 256
+        __m512i c = _mm512_srli_epi32(_mm512_add_epi32(_mm512_loadu_si512(count + k), one), 1);
+        _mm512_storeu_si512(count + k, c);
+        total = _mm512_add_epi32(total, c);
+    }
+    return (uint32_t)_mm512_reduce_add_epi32(total) + ac__halve_counts_scalar(count + k, n - k);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-struct arithmetic_codec* ac_init(void)
+static AC__TARGET("avx512f") void ac__distribution_avx512(const uint32_t* count, uint32_t* distribution, uint32_t n,
+                                                          uint32_t scale, uint32_t shift)
 {
-    struct arithmetic_codec* codec = (struct arithmetic_codec*) AC_ALLOC(sizeof(struct arithmetic_codec));
-
-    codec->mode = codec->buffer_size = 0;
-    codec->new_buffer = codec->code_buffer = NULL;
-
-    return codec;
+    __m512i vscale = _mm512_set1_epi32((int)scale), sum = _mm512_setzero_si512(), zero = _mm512_setzero_si512();
+    __m512i lane15 = _mm512_set1_epi32(15);
+    __m128i vshift = _mm_cvtsi32_si128((int)shift);
+    uint32_t k = 0;
+    for (; k + 16 <= n; k += 16)
+    {
+        // inclusive prefix sum: add the vector shifted by 1, 2, 4 and 8 lanes
+        __m512i c = _mm512_loadu_si512(count + k);
+        __m512i x = _mm512_add_epi32(c, _mm512_alignr_epi32(c, zero, 15));
+        x = _mm512_add_epi32(x, _mm512_alignr_epi32(x, zero, 14));
+        x = _mm512_add_epi32(x, _mm512_alignr_epi32(x, zero, 12));
+        x = _mm512_add_epi32(x, _mm512_alignr_epi32(x, zero, 8));
+        x = _mm512_add_epi32(x, sum);
+
+        __m512i exclusive = _mm512_sub_epi32(x, c);
+        _mm512_storeu_si512(distribution + k, _mm512_srl_epi32(_mm512_mullo_epi32(exclusive, vscale), vshift));
+        sum = _mm512_permutexvar_epi32(lane15, x);
+    }
+    ac__distribution_tail(count, distribution, k, n, scale, shift, (uint32_t)_mm512_cvtsi512_si32(sum));
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-void ac_set_buffer(struct arithmetic_codec* codec, uint32_t max_code_bytes, uint8_t *user_buffer)
+static AC__TARGET("avx512f") void ac__histogram_avx512(const uint32_t* symbols, uint32_t count, uint32_t n,
+                                                       uint32_t* histogram)
 {
-    assert(codec->mode == 0); // cannot set buffer while encoding or decoding
+    uint32_t* extra = ac__histogram_split(symbols, count, n, histogram);
+    if (extra == NULL)
+        return;
 
-    if (user_buffer != NULL) 
+    uint32_t k = 0;
+    for (; k + 16 <= n; k += 16)
     {
-        // user provides memory buffer
-        codec->buffer_size = max_code_bytes;
-        codec->code_buffer = user_buffer; // set buffer for compressed data
-        AC_FREE(codec->new_buffer); // free anything previously assigned              
-        codec->new_buffer = NULL;
-        return;
+        __m512i h = _mm512_add_epi32(_mm512_loadu_si512(histogram + k), _mm512_loadu_si512(extra + k));
+        h = _mm512_add_epi32(h, _mm512_add_epi32(_mm512_loadu_si512(extra + n + k), _mm512_loadu_si512(extra + 2*n + k)));
+        _mm512_storeu_si512(histogram + k, h);
     }
+    for (; k < n; k++)
+        histogram[k] += extra[k] + extra[n+k] + extra[2*n+k];
 
-    // enough space available in the current buffer
-    if (max_code_bytes <= codec->buffer_size) 
-        return;
-
-    codec->buffer_size = max_code_bytes; // assign new memory
-    AC_FREE(codec->new_buffer);    // free anything previously assigned
-    codec->new_buffer = (uint8_t*) AC_ALLOC(codec->buffer_size + 16); // 16 extra bytes
-    assert(codec->new_buffer != NULL);
-    codec->code_buffer = codec->new_buffer; // set buffer for compressed data
+    AC_FREE(extra);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-void ac_start_encoder(struct arithmetic_codec* codec)
+static void ac__cpuid(uint32_t leaf, uint32_t* regs)
 {
-    assert(codec->mode == 0); // cannot start encoder
-    assert(codec->buffer_size != 0); // no buffer set
-    codec->mode = 1;
-    codec->base = 0;
-    codec->length = AC__MaxLength;
-    codec->ac_pointer = codec->code_buffer;
+#if defined(_MSC_VER) && !defined(__clang__)
+    __cpuidex((int*)regs, (int)leaf, 0);
+#else
+    __cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-void ac_start_decoder(struct arithmetic_codec* codec)
+// Registers state enabled by the OS
+static uint64_t ac__xgetbv(void)
 {
-    assert(codec->mode == 0); // cannot start encoder
-    assert(codec->buffer_size != 0); // no buffer set
-    codec->mode = 2;
-    codec->length = AC__MaxLength;
-    codec->ac_pointer = codec->code_buffer + 3;
-    codec->value = ((uint32_t)(codec->code_buffer[0]) << 24) |
-                   ((uint32_t)(codec->code_buffer[1]) << 16) |
-                   ((uint32_t)(codec->code_buffer[2]) <<  8) |
-                    (uint32_t)(codec->code_buffer[3]);
+#if defined(_MSC_VER) && !defined(__clang__)
+    return _xgetbv(0);
+#else
+    uint32_t eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+#endif
 }
 
+#endif // AC__X86
+
 //----------------------------------------------------------------------------------------------------------------------
-uint32_t ac_stop_encoder(struct arithmetic_codec* codec)
+static enum ac_isa ac__detect_isa(void)
 {
-    assert(codec->mode == 1); // invalid to stop encoder
-    codec->mode = 0;
+#ifdef AC__X86
+    uint32_t regs[4];   // eax, ebx, ecx, edx
+    ac__cpuid(0, regs);
+    uint32_t max_leaf = regs[0];
 
-    uint32_t init_base = codec->base;            // done encoding: set final data bytes
+    ac__cpuid(1, regs);
+    int sse42 = (regs[2] >> 20) & 1, osxsave = (regs[2] >> 27) & 1;
+    uint64_t xcr0 = osxsave ? ac__xgetbv() : 0;
 
-    if (codec->length > 2 * AC__MinLength) 
-    {
-        codec->base  += AC__MinLength;                                     // base offset
-        codec->length = AC__MinLength >> 1;             // set new length for 1 more byte
-    }
-    else 
+    int avx2 = 0, avx512 = 0;
+    if (max_leaf >= 7)
     {
-        codec->base  += AC__MinLength >> 1;                                // base offset
-        codec->length = AC__MinLength >> 9;            // set new length for 2 more bytes
+        ac__cpuid(7, regs);
+        avx2 = (regs[1] >> 5) & 1;
+        avx512 = (regs[1] >> 16) & 1;
     }
 
-    if (init_base > codec->base) 
-        ac_propagate_carry(codec);                 // overflow = carry
+    // the OS must save the vector registers: xmm/ymm (bits 1-2), opmask and zmm (bits 5-7)
+    if (avx512 && (xcr0 & 0xE6) == 0xE6)
+        return AC_ISA_AVX512;
+    if (avx2 && (xcr0 & 0x6) == 0x6)
+        return AC_ISA_AVX2;
+    if (sse42)
+        return AC_ISA_SSE42;
+#endif
+    return AC_ISA_SCALAR;
+}
 
-    ac_renorm_enc_interval(codec);                // renormalization = output last bytes
+static const struct ac__kernels ac__kernels_table[] =
+{
+    {ac__halve_counts_scalar, ac__distribution_scalar, ac__histogram_scalar},
+#ifdef AC__X86
+    {ac__halve_counts_sse42, ac__distribution_sse42, ac__histogram_sse42},
+    {ac__halve_counts_avx2, ac__distribution_avx2, ac__histogram_avx2},
+    {ac__halve_counts_avx512, ac__distribution_avx512, ac__histogram_avx512},
+#endif
+};
 
-    uint32_t code_bytes = (uint32_t)(codec->ac_pointer - codec->code_buffer);
-    assert(code_bytes <= codec->buffer_size); // code buffer overflow
+// Models are initialized on any thread: the kernels are published with an atomic pointer, concurrent first calls
+// all store the same entry of the table. The instruction set in use is the index of the entry
+static void* volatile ac__kernels = NULL;
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define AC__LOAD_ACQUIRE(pointer) _InterlockedCompareExchangePointer(pointer, NULL, NULL)
+#define AC__STORE_RELEASE(pointer, value) _InterlockedExchangePointer(pointer, value)
+#else
+#define AC__LOAD_ACQUIRE(pointer) __atomic_load_n(pointer, __ATOMIC_ACQUIRE)
+#define AC__STORE_RELEASE(pointer, value) __atomic_store_n(pointer, value, __ATOMIC_RELEASE)
+#endif
 
-    return code_bytes;                                   // number of bytes used
+//----------------------------------------------------------------------------------------------------------------------
+static inline const struct ac__kernels* ac__get_kernels(void)
+{
+    const struct ac__kernels* kernels = (const struct ac__kernels*) AC__LOAD_ACQUIRE(&ac__kernels);
+    if (kernels == NULL)
+    {
+        kernels = &ac__kernels_table[ac__detect_isa()];
+        AC__STORE_RELEASE(&ac__kernels, (void*) kernels);
+    }
+    return kernels;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-void ac_stop_decoder(struct arithmetic_codec* codec)
+enum ac_isa ac_get_isa(void)
 {
-    assert(codec->mode == 2);  // invalid to stop decoder
-    codec->mode = 0;
+    return (enum ac_isa)(ac__get_kernels() - ac__kernels_table);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-void ac_put_bit(struct arithmetic_codec* codec, uint32_t bit)
+int ac_set_isa(enum ac_isa isa)
 {
-    assert(codec->mode == 1);  // encoder not initialized
-
-    codec->length >>= 1;    // halve interval
-    if (bit) 
-    {
-        uint32_t init_base = codec->base;
-        codec->base += codec->length;   // move base
-        if (init_base > codec->base) 
-            ac_propagate_carry(codec);  // overflow = carry
-    }
+    if (isa > ac__detect_isa())
+        return 0;
 
-    if (codec->length < AC__MinLength) 
-        ac_renorm_enc_interval(codec); // renormalization
+    AC__STORE_RELEASE(&ac__kernels, (void*) &ac__kernels_table[isa]);
+    return 1;
 }
 
+
+//----------------------------------------------------------------------------------------------------------------------
+// Adaptive data model
 //----------------------------------------------------------------------------------------------------------------------
-uint32_t ac_get_bit(struct arithmetic_codec* codec)
-{
-    assert(codec->mode == 2); //  decoder not initialized   
 
-    codec->length >>= 1;  // halve interval
-    uint32_t bit = (codec->value >= codec->length);  // decode bit
-    if (bit) 
-        codec->value -= codec->length; // move base
+struct adaptive_model
+{
+    uint32_t *distribution, *symbol_count, *decoder_table;
+    uint32_t total_count, update_cycle, symbols_until_update;
+    uint32_t data_symbols, last_symbol, table_size, table_shift;
+    uint32_t increment, decay_shift;    // weight of a new symbol, grows with the decay
+    uint32_t length_shift;              // precision of the distribution, the max count is 1 << length_shift
+    uint16_t *rank_to_symbol, *symbol_to_rank;  // frequency-sorted remapping, NULL if disabled
+    struct ac_allocator allocator;
+#ifdef AC_TRACE
+    struct ac__trace_stamp trace;
+#endif
+};
 
-    if (codec->length < AC__MinLength) 
-        ac_renorm_dec_interval(codec);  // renormalization
+void adaptive_model_update(struct adaptive_model* model, int from_encoder);
 
-    return bit;
+//----------------------------------------------------------------------------------------------------------------------
+struct adaptive_model* adaptive_model_init(uint32_t number_of_symbols)
+{
+    return adaptive_model_init_with_allocator(number_of_symbols, NULL);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-void ac_put_bits(struct arithmetic_codec* codec, uint32_t data, uint32_t number_of_bits)
+struct adaptive_model* adaptive_model_init_with_allocator(uint32_t number_of_symbols, const struct ac_allocator* allocator)
 {
-    assert(codec->mode == 1);  // encoder not initialized
-    assert((number_of_bits > 0) && (number_of_bits < 21));  // invalid number of bits
-    assert(data < (1U << number_of_bits)); // invalid data
+    if (allocator == NULL)
+        allocator = &ac__default_allocator;
 
-    uint32_t init_base = codec->base;
-    codec->base += data * (codec->length >>= number_of_bits);            // new interval base and length
+    struct adaptive_model* model = (struct adaptive_model*) ac__alloc(allocator, sizeof(struct adaptive_model));
+    model->allocator = *allocator;
 
-    if (init_base > codec->base) 
-        ac_propagate_carry(codec);                 // overflow = carry
+    model->data_symbols = 0;
+    model->distribution = NULL;
+    model->rank_to_symbol = model->symbol_to_rank = NULL;
+    model->decay_shift = 0;
+    model->length_shift = DM__LengthShift;
+    AC__TRACE_INIT(model);
 
-    if (codec->length < AC__MinLength) 
-        ac_renorm_enc_interval(codec);        // renormalization
+    adaptive_model_set_alphabet(model, number_of_symbols);
+    
+    return model;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-uint32_t ac_get_bits(struct arithmetic_codec* codec, uint32_t number_of_bits)
+void adaptive_model_terminate(struct adaptive_model* model)
 {
-    assert(codec->mode == 2);  // decoder not initialized
-    assert((number_of_bits > 0) && (number_of_bits < 21));  // invalid number of bits
+    ac__free(&model->allocator, model->rank_to_symbol);
+    ac__free(&model->allocator, model->distribution);
+    struct ac_allocator allocator = model->allocator;
+    ac__free(&allocator, model);
+}
 
-    // decode symbol, change length
-    unsigned s = codec->value / (codec->length >>= number_of_bits);      
+//----------------------------------------------------------------------------------------------------------------------
+void adaptive_model_reset(struct adaptive_model* model)
+{
+    if (model->data_symbols == 0) 
+        return;
 
-    codec->value -= codec->length * s; // update interval
-    if (codec->length < AC__MinLength) 
-        ac_renorm_dec_interval(codec); // renormalization
+    // restore probability estimates to uniform distribution
+    model->total_count = 0;
+    model->update_cycle = model->data_symbols;
+    model->increment = 1;
 
-    return s;
+    for (uint32_t k = 0; k < model->data_symbols; k++) 
+        model->symbol_count[k] = 1;
+
+    if (model->rank_to_symbol != NULL)
+        for (uint32_t k = 0; k < model->data_symbols; k++)
+            model->rank_to_symbol[k] = model->symbol_to_rank[k] = (uint16_t) k;
+
+    adaptive_model_update(model, 0);
+    model->symbols_until_update = model->update_cycle = (model->data_symbols + 6) >> 1;
+    model->increment = 1 << model->decay_shift;
+    AC__TRACE_RESET(model);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-void ac_encode_adaptive(struct arithmetic_codec* codec, uint32_t data, struct adaptive_model* model)
+void adaptive_model_set_alphabet(struct adaptive_model* model, uint32_t number_of_symbols)
 {
-    assert(codec->mode == 1);  // encoder not initialized
-    assert(data < model->data_symbols); // invalid data symbols
+    assert(number_of_symbols>1 && (number_of_symbols <= (1 << 11))); // invalid number of data symbols
+    assert(number_of_symbols <= (1U << (model->length_shift - 1))); // not enough precision for the alphabet
+
+    if (model->data_symbols != number_of_symbols) 
+    {
+        // assign memory for data model
+        model->data_symbols = number_of_symbols;
+        model->last_symbol = model->data_symbols - 1;
+        ac__free(&model->allocator, model->distribution);
+
+        // define size of table for fast decoding
+        if (model->data_symbols > 16) 
+        {
+            uint32_t table_bits = 3;
+            while (model->data_symbols > (1U << (table_bits + 2))) ++table_bits;
+            model->table_size  = 1 << table_bits;
+            model->table_shift = model->length_shift - table_bits;
+            model->distribution = (uint32_t*) ac__alloc(&model->allocator, sizeof(uint32_t) * (2 * model->data_symbols+model->table_size+2));
+            model->decoder_table = model->distribution + 2 * model->data_symbols;
+            assert(model->distribution != NULL);
+        }
+        else 
+        {
+            // small alphabet: no table needed
+            model->decoder_table = 0;
+            model->table_size = model->table_shift = 0;
+            model->distribution = (uint32_t*) ac__alloc(&model->allocator, sizeof(uint32_t) * 2 * model->data_symbols);
+        }
+        model->symbol_count = model->distribution + model->data_symbols;
+        assert(model->distribution != NULL); // cannot assign model memory
+
+        if (model->rank_to_symbol != NULL)
+        {
+            ac__free(&model->allocator, model->rank_to_symbol);
+            model->rank_to_symbol = (uint16_t*) ac__alloc(&model->allocator, sizeof(uint16_t) * 2 * model->data_symbols);
+            model->symbol_to_rank = model->rank_to_symbol + model->data_symbols;
+            assert(model->rank_to_symbol != NULL);
+        }
+    }
+
+    // initialize model
+    adaptive_model_reset(model);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static inline void adaptive_model_swap_ranks(struct adaptive_model* model, uint32_t a, uint32_t b)
+{
+    uint32_t count = model->symbol_count[a];
+    model->symbol_count[a] = model->symbol_count[b];
+    model->symbol_count[b] = count;
+
+    uint16_t symbol = model->rank_to_symbol[a];
+    model->rank_to_symbol[a] = model->rank_to_symbol[b];
+    model->rank_to_symbol[b] = symbol;
+
+    model->symbol_to_rank[model->rank_to_symbol[a]] = (uint16_t) a;
+    model->symbol_to_rank[model->rank_to_symbol[b]] = (uint16_t) b;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Keep the most frequent symbols sorted in the ranks reached by the linear scan of the decoder. The order of the other
+// ranks does not matter for the search, so a full sort of noisy tail counts would be wasted work
+static void adaptive_model_sort(struct adaptive_model* model)
+{
+    uint32_t top = (model->data_symbols < DM__SortedScan) ? model->data_symbols : DM__SortedScan;
+
+    for (uint32_t i = 1; i < model->data_symbols; i++)
+    {
+        uint32_t j = i;
+        if (i >= top)
+        {
+            // promote a symbol of the tail only if it beats the last of the top
+            if (model->symbol_count[i] <= model->symbol_count[top-1])
+                continue;
+            adaptive_model_swap_ranks(model, i, top-1);
+            j = top-1;
+        }
+
+        for (; j > 0 && model->symbol_count[j-1] < model->symbol_count[j]; j--)
+            adaptive_model_swap_ranks(model, j-1, j);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void adaptive_model_build_decoder_table(struct adaptive_model* model)
+{
+    if (model->table_size == 0)
+        return;
+
+    uint32_t s = 0;
+    for (uint32_t k = 0; k < model->data_symbols; k++) 
+    {
+        uint32_t w = model->distribution[k] >> model->table_shift;
+        while (s < w) model->decoder_table[++s] = k - 1;
+    }
+    model->decoder_table[0] = 0;
+    while (s <= model->table_size) model->decoder_table[++s] = model->data_symbols - 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void adaptive_model_compute_distribution(struct adaptive_model* model, int from_encoder)
+{
+    const struct ac__kernels* kernels = ac__get_kernels();
+
+    while (model->total_count > (1U << model->length_shift))
+    {
+        model->total_count = kernels->halve_counts(model->symbol_count, model->data_symbols);
+        model->increment = (model->increment + 1) >> 1;
+    }
+
+    // exponential forgetting: next symbols weight more
+    if (model->decay_shift != 0)
+    {
+        uint32_t growth = model->increment >> model->decay_shift;
+        model->increment += (growth != 0) ? growth : 1;
+    }
+
+    if (model->rank_to_symbol != NULL)
+        adaptive_model_sort(model);
+
+    // compute cumulative distribution, decoder table
+    uint32_t scale = 0x80000000U / model->total_count;
+    kernels->distribution(model->symbol_count, model->distribution, model->data_symbols, scale, 31 - model->length_shift);
+
+    if (!from_encoder)
+        adaptive_model_build_decoder_table(model);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void adaptive_model_update(struct adaptive_model* model, int from_encoder)
+{
+    model->total_count += model->update_cycle * model->increment;
+    adaptive_model_compute_distribution(model, from_encoder);
+
+    // set frequency of model updates
+    model->update_cycle = (5 * model->update_cycle) >> 2;
+    uint32_t max_cycle = (model->data_symbols + 6) << 3;
+    if (model->update_cycle > max_cycle) 
+        model->update_cycle = max_cycle;
+    model->symbols_until_update = model->update_cycle;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void adaptive_model_end_block(struct adaptive_model* model)
+{
+    model->total_count = 0;
+    for (uint32_t n = 0; n < model->data_symbols; n++)
+        model->total_count += model->symbol_count[n];
+
+    adaptive_model_compute_distribution(model, 0);
+    AC__TRACE_CHANGE(model);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void adaptive_model_set_precision(struct adaptive_model* model, uint32_t precision)
+{
+    assert(precision >= DM__MinLengthShift && precision <= DM__MaxLengthShift); // invalid precision
+
+    uint32_t number_of_symbols = model->data_symbols;
+
+    // force the decoder table to be sized again
+    model->length_shift = precision;
+    model->data_symbols = 0;
+    adaptive_model_set_alphabet(model, number_of_symbols);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void adaptive_model_set_sorted(struct adaptive_model* model, int enable)
+{
+    if (enable && model->rank_to_symbol == NULL)
+    {
+        model->rank_to_symbol = (uint16_t*) ac__alloc(&model->allocator, sizeof(uint16_t) * 2 * model->data_symbols);
+        model->symbol_to_rank = model->rank_to_symbol + model->data_symbols;
+        assert(model->rank_to_symbol != NULL);
+    }
+    else if (!enable && model->rank_to_symbol != NULL)
+    {
+        ac__free(&model->allocator, model->rank_to_symbol);
+        model->rank_to_symbol = model->symbol_to_rank = NULL;
+    }
+
+    adaptive_model_reset(model);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void adaptive_model_set_decay(struct adaptive_model* model, uint32_t decay_shift)
+{
+    assert(decay_shift <= 8); // invalid decay
+
+    model->decay_shift = decay_shift;
+    adaptive_model_reset(model);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t adaptive_model_get_symbol_count(const struct adaptive_model* model, uint32_t symbol)
+{
+    assert(symbol < model->data_symbols); // invalid data symbols
     assert(model->distribution != NULL); // adaptive model should be initialized
-    
-    uint32_t x;
-    uint32_t init_base = codec->base;
 
-    // compute products
-    if (data == model->last_symbol) 
+    if (model->symbol_to_rank != NULL)
+        symbol = model->symbol_to_rank[symbol];
+
+    return model->symbol_count[symbol];
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Model states are a header used to check the settings, followed by the raw content of the model
+static inline uint8_t* ac__write_state(uint8_t* state, const void* data, size_t size)
+{
+    memcpy(state, data, size);
+    return state + size;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static inline const uint8_t* ac__read_state(const uint8_t* state, void* data, size_t size)
+{
+    memcpy(data, state, size);
+    return state + size;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static inline uint32_t ac__state_word(const uint8_t* state, uint32_t index)
+{
+    uint32_t word;
+    memcpy(&word, state + index * sizeof(uint32_t), sizeof(uint32_t));
+    return word;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// A bit model at 0 or 1 would give an empty interval
+static inline int ac__valid_bit_model(ac_bit_model probability)
+{
+    return probability != 0 && probability < BM__MaxProbability;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static inline uint32_t adaptive_model_distribution_words(const struct adaptive_model* model)
+{
+    return 2 * model->data_symbols + (model->table_size ? model->table_size + 2 : 0);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t adaptive_model_get_state_size(const struct adaptive_model* model)
+{
+    uint32_t size = 8 * sizeof(uint32_t) + adaptive_model_distribution_words(model) * sizeof(uint32_t);
+    if (model->rank_to_symbol != NULL)
+        size += 2 * model->data_symbols * sizeof(uint16_t);
+    return size;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t adaptive_model_save_state(const struct adaptive_model* model, void* state)
+{
+    const uint32_t header[8] = {model->data_symbols, model->length_shift, model->decay_shift,
+                                model->rank_to_symbol != NULL, model->total_count, model->update_cycle,
+                                model->symbols_until_update, model->increment};
+
+    uint8_t* p = ac__write_state((uint8_t*) state, header, sizeof(header));
+    p = ac__write_state(p, model->distribution, adaptive_model_distribution_words(model) * sizeof(uint32_t));
+    if (model->rank_to_symbol != NULL)
+        p = ac__write_state(p, model->rank_to_symbol, 2 * model->data_symbols * sizeof(uint16_t));
+
+    return (uint32_t)(p - (uint8_t*) state);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+int adaptive_model_load_state(struct adaptive_model* model, const void* state, uint32_t size)
+{
+    uint32_t header[8];
+    if (size != adaptive_model_get_state_size(model))
+        return 0;
+
+    const uint8_t* p = ac__read_state((const uint8_t*) state, header, sizeof(header));
+    if (header[0] != model->data_symbols || header[1] != model->length_shift || header[2] != model->decay_shift ||
+        header[3] != (model->rank_to_symbol != NULL))
+        return 0;
+
+    // the content is checked before the model is changed: every symbol has an interval in the range of the
+    // precision and a count, the ranks are a permutation
+    if (header[4] == 0 || header[5] == 0 || header[6] == 0 || header[7] == 0 || ac__state_word(p, 0) != 0)
+        return 0;
+    for (uint32_t k = 0; k < model->data_symbols; k++)
+    {
+        uint32_t next = (k + 1 < model->data_symbols) ? ac__state_word(p, k + 1) : (1U << model->length_shift);
+        if (ac__state_word(p, k) >= next || ac__state_word(p, model->data_symbols + k) == 0)
+            return 0;
+    }
+
+    if (model->rank_to_symbol != NULL)
+    {
+        const uint8_t* ranks = p + adaptive_model_distribution_words(model) * sizeof(uint32_t);
+        for (uint32_t k = 0; k < model->data_symbols; k++)
+        {
+            uint16_t symbol, rank;
+            memcpy(&symbol, ranks + k * sizeof(uint16_t), sizeof(uint16_t));
+            if (symbol >= model->data_symbols)
+                return 0;
+            memcpy(&rank, ranks + (model->data_symbols + symbol) * sizeof(uint16_t), sizeof(uint16_t));
+            if (rank != k)
+                return 0;
+        }
+    }
+
+    model->total_count = header[4];
+    model->update_cycle = header[5];
+    model->symbols_until_update = header[6];
+    model->increment = header[7];
+    p = ac__read_state(p, model->distribution, adaptive_model_distribution_words(model) * sizeof(uint32_t));
+    if (model->rank_to_symbol != NULL)
+        ac__read_state(p, model->rank_to_symbol, 2 * model->data_symbols * sizeof(uint16_t));
+
+    // the encoder does not maintain the decoder table, the state may come from either
+    adaptive_model_build_decoder_table(model);
+    AC__TRACE_CHANGE(model);
+    return 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Static data model
+//----------------------------------------------------------------------------------------------------------------------
+
+struct static_model
+{
+    uint32_t *distribution, *decoder_table;
+    uint32_t data_symbols, last_symbol, table_size, table_shift;
+    uint32_t length_shift;      // precision of the distribution
+    uint16_t *lookup_table;     // symbol of each slot of the distribution, NULL if disabled
+    uint32_t *cutoff_table;     // first symbol and cutoff of each bucket, NULL if disabled
+    uint32_t cutoff_bits, cutoff_shift;
+    struct ac_allocator allocator;
+#ifdef AC_TRACE
+    struct ac__trace_stamp trace;
+#endif
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+struct static_model* static_model_init(uint32_t number_of_symbols, const float *probability)
+{
+    return static_model_init_with_allocator(number_of_symbols, probability, NULL);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+struct static_model* static_model_init_with_allocator(uint32_t number_of_symbols, const float *probability,
+                                                      const struct ac_allocator* allocator)
+{
+    if (allocator == NULL)
+        allocator = &ac__default_allocator;
+
+    struct static_model* model = (struct static_model*) ac__alloc(allocator, sizeof(struct static_model));
+    model->allocator = *allocator;
+
+    model->data_symbols = 0;
+    model->distribution = NULL;
+    model->lookup_table = NULL;
+    model->cutoff_table = NULL;
+    model->length_shift = DM__LengthShift;
+    AC__TRACE_INIT(model);
+
+    static_model_set_distribution(model, number_of_symbols, probability);
+
+    return model;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void static_model_set_alphabet(struct static_model* model, uint32_t number_of_symbols)
+{
+    assert(number_of_symbols>1 && (number_of_symbols <= (1 << 11))); // invalid number of data symbols
+    assert(number_of_symbols <= (1U << (model->length_shift - 1))); // not enough precision for the alphabet
+
+    if (model->data_symbols != number_of_symbols) 
+    {
+        // assign memory for data model
+        model->data_symbols = number_of_symbols;
+        model->last_symbol = model->data_symbols - 1;
+        ac__free(&model->allocator, model->distribution);
+
+        // define size of table for fast decoding
+        if (model->data_symbols > 16) 
+        {
+            uint32_t table_bits = 3;
+            while (model->data_symbols > (1U << (table_bits + 2))) 
+                ++table_bits;
+            model->table_size  = 1 << table_bits;
+            model->table_shift = model->length_shift - table_bits;
+            model->distribution = (uint32_t*) ac__alloc(&model->allocator, sizeof(uint32_t) * (model->data_symbols+model->table_size+2));
+            model->decoder_table = model->distribution + model->data_symbols;
+        }
+        else 
+        {                                  // small alphabet: no table needed
+            model->decoder_table = 0;
+            model->table_size = model->table_shift = 0;
+            model->distribution = (uint32_t*) ac__alloc(&model->allocator, sizeof(uint32_t) * model->data_symbols);
+        }
+        assert(model->distribution != NULL);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Size the cutoff table for the alphabet: the smallest power of two with at least 2 buckets per symbol
+static void static_model_alloc_cutoff_table(struct static_model* model)
+{
+    uint32_t bits = 2;
+    while ((1U << bits) < 2 * model->data_symbols)
+        ++bits;
+
+    if (model->cutoff_table == NULL || model->cutoff_bits != bits)
+    {
+        ac__free(&model->allocator, model->cutoff_table);
+        model->cutoff_bits = bits;
+        model->cutoff_table = (uint32_t*) ac__alloc(&model->allocator, sizeof(uint32_t) * ((1U << bits) + 1));
+        assert(model->cutoff_table != NULL);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Each entry packs the first symbol of the bucket (bits 16-30) and the offset in the bucket where the next symbol
+// starts (bits 0-15, bucket size if none). Bit 31 flags buckets with more than one boundary, decoded by bisection.
+static void static_model_build_cutoff_table(struct static_model* model)
+{
+    static_model_alloc_cutoff_table(model);
+    model->cutoff_shift = model->length_shift - model->cutoff_bits;
+
+    uint32_t first = 0, bucket_size = 1U << model->cutoff_shift;
+    for (uint32_t b = 0; b < (1U << model->cutoff_bits); b++)
+    {
+        uint32_t start = b << model->cutoff_shift, end = start + bucket_size - 1;
+
+        // symbols owning the first and the last slot of the bucket
+        while (first < model->last_symbol && model->distribution[first+1] <= start) ++first;
+        uint32_t last = first;
+        while (last < model->last_symbol && model->distribution[last+1] <= end) ++last;
+
+        if (last == first)
+            model->cutoff_table[b] = (first << 16) | bucket_size;
+        else if (last == first + 1)
+            model->cutoff_table[b] = (first << 16) | (model->distribution[last] - start);
+        else
+            model->cutoff_table[b] = (first << 16) | 0x80000000U;
+    }
+
+    // sentinel, ends the bisection of the last bucket
+    model->cutoff_table[1U << model->cutoff_bits] = model->last_symbol << 16;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void static_model_build_decoder_table(struct static_model* model)
+{
+    if (model->cutoff_table != NULL)
+        static_model_build_cutoff_table(model);
+
+    if (model->lookup_table != NULL)
+    {
+        uint32_t slot = 0, total = 1U << model->length_shift;
+        for (uint32_t k = 0; k < model->data_symbols; k++)
+        {
+            uint32_t end = (k == model->last_symbol) ? total : model->distribution[k+1];
+            while (slot < end) model->lookup_table[slot++] = (uint16_t) k;
+        }
+    }
+
+    if (model->table_size == 0) 
+        return;
+
+    uint32_t s = 0;
+    for (uint32_t k = 0; k < model->data_symbols; k++) 
+    {
+        uint32_t w = model->distribution[k] >> model->table_shift;
+        while (s < w) model->decoder_table[++s] = k - 1;
+    }
+
+    model->decoder_table[0] = 0;
+    while (s <= model->table_size) 
+        model->decoder_table[++s] = model->data_symbols - 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void static_model_set_distribution(struct static_model* model, uint32_t number_of_symbols, const float *probability)
+{
+    static_model_set_alphabet(model, number_of_symbols);
+
+    // compute cumulative distribution, decoder table
+    float sum = 0.0f, p = 1.0f / (float)(model->data_symbols);
+
+    for (unsigned k = 0; k < model->data_symbols; k++) 
+    {
+        if (probability) 
+            p = probability[k];
+
+        assert(p>=0.f && p<= 1.f);
+        
+        model->distribution[k] = (uint32_t)(sum * (float)(1 << model->length_shift));
+        sum += p;
+    }
+
+    static_model_build_decoder_table(model);
+    AC__TRACE_CHANGE(model);
+
+    assert(sum >= 0.9999f && sum <= 1.001f);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_histogram(const uint32_t* symbols, uint32_t count, uint32_t number_of_symbols, uint32_t* histogram)
+{
+    ac__get_kernels()->histogram(symbols, count, number_of_symbols, histogram);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void ac_normalize(uint32_t number_of_symbols, const uint32_t* histogram, uint32_t* frequency, uint32_t target)
+{
+    uint64_t total = 0;
+    uint32_t k, sum = 0, most_frequent = 0;
+
+    for (k = 0; k < number_of_symbols; k++)
+        total += histogram[k];
+
+    // every symbol gets at least 1, the rest is shared proportionally
+    uint64_t remaining = target - number_of_symbols;
+    for (k = 0; k < number_of_symbols; k++)
+    {
+        frequency[k] = 1 + (total ? (uint32_t)((histogram[k] * remaining) / total) : 0);
+        sum += frequency[k];
+        if (histogram[k] > histogram[most_frequent])
+            most_frequent = k;
+    }
+
+    // rounding error goes to the most frequent symbol
+    frequency[most_frequent] += target - sum;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_normalize_frequencies(uint32_t number_of_symbols, const uint32_t* histogram, uint32_t* frequency)
+{
+    assert(number_of_symbols>1 && (number_of_symbols <= (1 << 11))); // invalid number of data symbols
+
+    ac_normalize(number_of_symbols, histogram, frequency, AC_FREQUENCY_TOTAL);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void static_model_set_frequencies(struct static_model* model, uint32_t number_of_symbols, const uint32_t *frequency)
+{
+    static_model_set_alphabet(model, number_of_symbols);
+
+    uint32_t k, sum = 0;
+    for (k = 0; k < model->data_symbols; k++) 
+    {
+        assert(frequency[k] != 0); // every symbol needs a non-empty interval
+        sum += frequency[k];
+    }
+    assert(sum == AC_FREQUENCY_TOTAL); // frequencies are not normalized
+    (void) sum;
+
+    // frequencies are rescaled to the precision of the model
+    if (model->length_shift < DM__LengthShift)
+        ac_normalize(model->data_symbols, frequency, model->distribution, 1U << model->length_shift);
+    else
+        for (k = 0; k < model->data_symbols; k++)
+            model->distribution[k] = frequency[k] << (model->length_shift - DM__LengthShift);
+
+    // cumulative distribution
+    for (sum = 0, k = 0; k < model->data_symbols; k++) 
+    {
+        uint32_t f = model->distribution[k];
+        model->distribution[k] = sum;
+        sum += f;
+    }
+
+    static_model_build_decoder_table(model);
+    AC__TRACE_CHANGE(model);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void static_model_set_precision(struct static_model* model, uint32_t precision)
+{
+    assert(precision >= DM__MinLengthShift && precision <= DM__MaxLengthShift); // invalid precision
+
+    uint32_t number_of_symbols = model->data_symbols;
+
+    // force the decoder table to be sized again
+    model->length_shift = precision;
+    model->data_symbols = 0;
+
+    if (model->lookup_table != NULL)
+    {
+        ac__free(&model->allocator, model->lookup_table);
+        model->lookup_table = (uint16_t*) ac__alloc(&model->allocator, sizeof(uint16_t) << precision);
+        assert(model->lookup_table != NULL);
+    }
+
+    static_model_set_distribution(model, number_of_symbols, NULL);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void static_model_set_lookup(struct static_model* model, int enable)
+{
+    if (enable && model->lookup_table == NULL)
+    {
+        static_model_set_cutoff(model, 0);
+        model->lookup_table = (uint16_t*) ac__alloc(&model->allocator, sizeof(uint16_t) << model->length_shift);
+        assert(model->lookup_table != NULL);
+        static_model_build_decoder_table(model);
+    }
+    else if (!enable && model->lookup_table != NULL)
+    {
+        ac__free(&model->allocator, model->lookup_table);
+        model->lookup_table = NULL;
+    }
+    AC__TRACE_CHANGE(model);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void static_model_set_cutoff(struct static_model* model, int enable)
+{
+    if (enable && model->cutoff_table == NULL)
+    {
+        static_model_set_lookup(model, 0);
+        static_model_build_cutoff_table(model);
+    }
+    else if (!enable && model->cutoff_table != NULL)
+    {
+        ac__free(&model->allocator, model->cutoff_table);
+        model->cutoff_table = NULL;
+    }
+    AC__TRACE_CHANGE(model);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void static_model_terminate(struct static_model* model)
+{
+    ac__free(&model->allocator, model->cutoff_table);
+    ac__free(&model->allocator, model->lookup_table);
+    ac__free(&model->allocator, model->distribution);
+    struct ac_allocator allocator = model->allocator;
+    ac__free(&allocator, model);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Arithmetic Codec
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifdef AC_TRACE
+struct ac__trace_entry
+{
+    uint32_t id, revision;      // revision of the model after its last record
+};
+#endif
+
+struct arithmetic_codec
+{
+    uint8_t *code_buffer, *new_buffer, *ac_pointer;
+    uint8_t *code_end;                                // the decoder reads zeros from there, the encoder takes a new chunk
+    uint32_t base, value, length;                     // arithmetic coding state
+    uint32_t buffer_size, new_buffer_size;
+    uint32_t mode;     // mode: 0 = undef, 1 = encoder, 2 = decoder
+    struct ac_allocator allocator;
+    struct ac_chunk_pool* chunk_pool;                 // chunked output, NULL if disabled
+    struct ac_chunk* chunks;
+    uint32_t num_chunks, chunks_capacity;
+    const struct ac_chunk* segments;                  // segmented input, NULL if disabled or all read
+    uint32_t num_segments, segment_index;
+#ifdef AC_TRACE
+    ac_trace_callback trace_callback;
+    void* trace_user_data;
+    struct ac__trace_entry* trace_models;             // models used by the codec since the trace started
+    uint32_t trace_num_models, trace_models_capacity, trace_model, trace_size;
+    uint8_t trace_buffer[AC_TRACE_BUFFER_SIZE];
+#endif
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// Trace
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifdef AC_TRACE
+
+#define AC__TRACE(codec, op, a, b) ac_trace_record(codec, op, a, b)
+#define AC__TRACE_MODEL(codec, kind, model) ac_trace_##kind##_model(codec, model)
+#define AC__TRACE_SYMBOL(codec, op, model, a, b) ac_trace_symbol(codec, op, &(model)->trace, a, b)
+
+//----------------------------------------------------------------------------------------------------------------------
+static void ac_trace_flush(struct arithmetic_codec* codec)
+{
+    if (codec->trace_size != 0)
+        codec->trace_callback(codec->trace_user_data, codec->trace_buffer, codec->trace_size);
+    codec->trace_size = 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void ac_trace_varint(struct arithmetic_codec* codec, uint32_t value)
+{
+    do
+    {
+        if (codec->trace_size == AC_TRACE_BUFFER_SIZE)
+            ac_trace_flush(codec);
+
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        codec->trace_buffer[codec->trace_size++] = byte | (value ? 0x80 : 0);
+    } while (value);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void ac_trace_record(struct arithmetic_codec* codec, enum ac_trace_op op, uint32_t a, uint32_t b)
+{
+    if (codec->trace_callback == NULL)
+        return;
+
+    ac_trace_varint(codec, op);
+    if (op >= AC_TRACE_PUT_BITS)
+    {
+        ac_trace_varint(codec, a);
+        ac_trace_varint(codec, b);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Size then bytes of a model state, a size of 0 stands for the state right after a reset
+static void ac_trace_state(struct arithmetic_codec* codec, const uint8_t* state, uint32_t size)
+{
+    ac_trace_varint(codec, size);
+    for (uint32_t i = 0; i < size; ++i)
+    {
+        if (codec->trace_size == AC_TRACE_BUFFER_SIZE)
+            ac_trace_flush(codec);
+        codec->trace_buffer[codec->trace_size++] = state[i];
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Returns 1 if the model must be recorded: first use by the codec, or changed since its last record. The entry of the
+// model becomes the current one, updated by ac_trace_symbol()
+static int ac_trace_model_changed(struct arithmetic_codec* codec, const struct ac__trace_stamp* stamp)
+{
+    if (codec->trace_callback == NULL)
+        return 0;
+
+    for (uint32_t i = codec->trace_num_models; i-- > 0; )
+    {
+        if (codec->trace_models[i].id == stamp->id)
+        {
+            codec->trace_model = i;
+            return codec->trace_models[i].revision != stamp->revision;
+        }
+    }
+
+    if (codec->trace_num_models == codec->trace_models_capacity)
+    {
+        uint32_t capacity = codec->trace_models_capacity ? codec->trace_models_capacity * 2 : 16;
+        struct ac__trace_entry* models =
+            (struct ac__trace_entry*) ac__alloc(&codec->allocator, capacity * sizeof(struct ac__trace_entry));
+        assert(models != NULL);
+        for (uint32_t i = 0; i < codec->trace_num_models; ++i)
+            models[i] = codec->trace_models[i];
+        ac__free(&codec->allocator, codec->trace_models);
+        codec->trace_models = models;
+        codec->trace_models_capacity = capacity;
+    }
+
+    codec->trace_model = codec->trace_num_models++;
+    codec->trace_models[codec->trace_model].id = stamp->id;
+    return 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Record of a symbol coded with the current model, after the coding: the model is up to date with the log
+static void ac_trace_symbol(struct arithmetic_codec* codec, enum ac_trace_op op, const struct ac__trace_stamp* stamp,
+                            uint32_t symbol, uint32_t context)
+{
+    if (codec->trace_callback == NULL)
+        return;
+
+    ac_trace_varint(codec, op);
+    ac_trace_varint(codec, stamp->id);
+    if (op == AC_TRACE_ENCODE_CONTEXT_HASH || op == AC_TRACE_DECODE_CONTEXT_HASH)
+        ac_trace_varint(codec, context);
+    ac_trace_varint(codec, symbol);
+    codec->trace_models[codec->trace_model].revision = stamp->revision;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void ac_trace_adaptive_model(struct arithmetic_codec* codec, const struct adaptive_model* model)
+{
+    if (!ac_trace_model_changed(codec, &model->trace))
+        return;
+
+    ac_trace_record(codec, AC_TRACE_ADAPTIVE_MODEL, model->trace.id, model->data_symbols);
+    ac_trace_varint(codec, model->length_shift);
+    ac_trace_varint(codec, model->decay_shift);
+    ac_trace_varint(codec, model->rank_to_symbol != NULL);
+    if (model->trace.reset == model->trace.revision)
+    {
+        ac_trace_state(codec, NULL, 0);
+        return;
+    }
+
+    uint32_t size = adaptive_model_get_state_size(model);
+    uint8_t* state = (uint8_t*) ac__alloc(&codec->allocator, size);
+    assert(state != NULL);
+    adaptive_model_save_state(model, state);
+    ac_trace_state(codec, state, size);
+    ac__free(&codec->allocator, state);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void ac_trace_static_model(struct arithmetic_codec* codec, const struct static_model* model)
+{
+    if (!ac_trace_model_changed(codec, &model->trace))
+        return;
+
+    ac_trace_record(codec, AC_TRACE_STATIC_MODEL, model->trace.id, model->data_symbols);
+    ac_trace_varint(codec, model->length_shift);
+    ac_trace_varint(codec, model->lookup_table != NULL);
+    ac_trace_varint(codec, model->cutoff_table != NULL);
+    for (uint32_t k = 0; k < model->data_symbols; ++k)
+        ac_trace_varint(codec, model->distribution[k]);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_set_trace(struct arithmetic_codec* codec, ac_trace_callback callback, void* user_data)
+{
+    if (codec->trace_callback != NULL)
+        ac_trace_flush(codec);
+
+    codec->trace_callback = callback;
+    codec->trace_user_data = user_data;
+    codec->trace_num_models = 0;
+    codec->trace_size = 0;
+
+    if (callback != NULL)
+    {
+        static const uint8_t magic[4] = {'A', 'C', 'T', '2'};
+        callback(user_data, magic, sizeof(magic));
+    }
+}
+
+#else
+
+#define AC__TRACE(codec, op, a, b)
+#define AC__TRACE_MODEL(codec, kind, model)
+#define AC__TRACE_SYMBOL(codec, op, model, a, b)
+
+#endif
+
+static void ac_next_chunk(struct arithmetic_codec* codec);
+static void ac_propagate_carry_chunks(struct arithmetic_codec* codec);
+static uint32_t ac_next_segment(struct arithmetic_codec* codec);
+
+//----------------------------------------------------------------------------------------------------------------------
+inline static void ac_propagate_carry(struct arithmetic_codec* codec)
+{
+    if (codec->chunk_pool != NULL)
+    {
+        ac_propagate_carry_chunks(codec);
+        return;
+    }
+
+    uint8_t * p;            
+    // carry propagation on compressed data buffer
+    for (p = codec->ac_pointer - 1; *p == 0xFFU; p--) 
+        *p = 0;
+    ++*p;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+inline static void ac_renorm_enc_interval(struct arithmetic_codec* codec)
+{
+    do  // output and discard top byte
+    {
+        if (codec->ac_pointer == codec->code_end)
+            ac_next_chunk(codec);
+        *codec->ac_pointer++ = (uint8_t)(codec->base >> 24);
+        codec->base <<= 8;
+    } while ((codec->length <<= 8) < AC__MinLength);        // length multiplied by 256
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+inline static void ac_renorm_dec_interval(struct arithmetic_codec* codec)
+{
+    do // read least-significant byte
+    {
+        codec->value <<= 8;
+        if (++codec->ac_pointer < codec->code_end)
+            codec->value |= (uint32_t)(*codec->ac_pointer);
+        else if (codec->segments != NULL)
+            codec->value |= ac_next_segment(codec);
+    } while ((codec->length <<= 8) < AC__MinLength);        // length multiplied by 256
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+struct arithmetic_codec* ac_init(void)
+{
+    return ac_init_with_allocator(NULL);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+struct arithmetic_codec* ac_init_with_allocator(const struct ac_allocator* allocator)
+{
+    if (allocator == NULL)
+        allocator = &ac__default_allocator;
+
+    struct arithmetic_codec* codec = (struct arithmetic_codec*) ac__alloc(allocator, sizeof(struct arithmetic_codec));
+    codec->allocator = *allocator;
+
+    codec->mode = codec->buffer_size = codec->new_buffer_size = 0;
+    codec->new_buffer = codec->code_buffer = NULL;
+    codec->ac_pointer = codec->code_end = NULL;
+    codec->chunk_pool = NULL;
+    codec->chunks = NULL;
+    codec->num_chunks = codec->chunks_capacity = 0;
+    codec->segments = NULL;
+    codec->num_segments = codec->segment_index = 0;
+#ifdef AC_TRACE
+    codec->trace_callback = NULL;
+    codec->trace_models = NULL;
+    codec->trace_num_models = codec->trace_models_capacity = codec->trace_size = 0;
+#endif
+
+    return codec;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_set_buffer(struct arithmetic_codec* codec, uint32_t max_code_bytes, uint8_t *user_buffer)
+{
+    assert(codec->mode == 0); // cannot set buffer while encoding or decoding
+
+    if (user_buffer != NULL) 
+    {
+        // user provides memory buffer
+        codec->buffer_size = max_code_bytes;
+        codec->code_buffer = user_buffer; // set buffer for compressed data
+        ac__free(&codec->allocator, codec->new_buffer); // free anything previously assigned              
+        codec->new_buffer = NULL;
+        codec->new_buffer_size = 0;
+        return;
+    }
+
+    // enough space available in the current buffer
+    if (max_code_bytes <= codec->new_buffer_size) 
+    {
+        codec->buffer_size = codec->new_buffer_size;
+        codec->code_buffer = codec->new_buffer;
+        return;
+    }
+
+    codec->buffer_size = codec->new_buffer_size = max_code_bytes; // assign new memory
+    ac__free(&codec->allocator, codec->new_buffer);    // free anything previously assigned
+    codec->new_buffer = (uint8_t*) ac__alloc(&codec->allocator, codec->buffer_size + 16); // 16 extra bytes
+    assert(codec->new_buffer != NULL);
+    codec->code_buffer = codec->new_buffer; // set buffer for compressed data
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_start_encoder(struct arithmetic_codec* codec)
+{
+    assert(codec->mode == 0); // cannot start encoder
+    assert(codec->num_chunks == 0); // chunks of the previous encoding not released
+    assert(codec->buffer_size != 0); // no buffer set
+    codec->mode = 1;
+    codec->base = 0;
+    codec->length = AC__MaxLength;
+    codec->ac_pointer = codec->code_buffer;
+    codec->code_end = NULL;
+    codec->chunk_pool = NULL;
+    AC__TRACE(codec, AC_TRACE_START_ENCODER, 0, 0);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_start_decoder(struct arithmetic_codec* codec)
+{
+    assert(codec->mode == 0); // cannot start encoder
+    assert(codec->num_chunks == 0); // chunks of the previous encoding not released
+    assert(codec->buffer_size != 0); // no buffer set
+    codec->mode = 2;
+    codec->length = AC__MaxLength;
+    AC__TRACE(codec, AC_TRACE_START_DECODER, 0, 0);
+    codec->code_end = codec->code_buffer + codec->buffer_size;
+    codec->ac_pointer = codec->code_buffer + 3;
+    codec->value = ((uint32_t)(codec->code_buffer[0]) << 24) |
+                   ((uint32_t)(codec->code_buffer[1]) << 16) |
+                   ((uint32_t)(codec->code_buffer[2]) <<  8) |
+                    (uint32_t)(codec->code_buffer[3]);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_get_checkpoint(struct arithmetic_codec* codec, uint32_t symbol_index, struct ac_checkpoint* checkpoint)
+{
+    assert(codec->mode == 1); // encoder not initialized
+    assert(codec->chunk_pool == NULL); // not available with chunked output
+
+    checkpoint->symbol_index = symbol_index;
+    checkpoint->byte_offset = (uint32_t)(codec->ac_pointer - codec->code_buffer);
+    checkpoint->base = codec->base;
+    checkpoint->length = codec->length;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_start_decoder_at(struct arithmetic_codec* codec, const struct ac_checkpoint* checkpoint)
+{
+    assert(codec->mode == 0); // cannot start decoder
+    assert(codec->num_chunks == 0); // chunks of the previous encoding not released
+    assert(codec->buffer_size != 0); // no buffer set
+    assert(checkpoint->length >= AC__MinLength); // invalid checkpoint
+
+    codec->mode = 2;
+    codec->length = checkpoint->length;
+    AC__TRACE(codec, AC_TRACE_START_DECODER_AT, 0, 0);
+
+    // the decoder reads 4 bytes ahead of the encoder, its value is the code minus the base of the encoder.
+    // The value is smaller than the length, so the bytes before the checkpoint (and later carries into them) cancel
+    // out in the 32-bit difference
+    uint32_t code = 0;
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        uint32_t offset = checkpoint->byte_offset + i;
+        code = (code << 8) | ((offset < codec->buffer_size) ? codec->code_buffer[offset] : 0);
+    }
+
+    codec->value = code - checkpoint->base;
+    codec->code_end = codec->code_buffer + codec->buffer_size;
+    codec->ac_pointer = codec->code_buffer + checkpoint->byte_offset + 3;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_start_message_encoder(struct arithmetic_codec* codec, uint8_t* buffer, uint32_t buffer_size)
+{
+    assert(codec->mode == 0); // cannot start encoder
+    assert(buffer != NULL && buffer_size != 0);
+    codec->code_buffer = buffer;
+    codec->buffer_size = buffer_size;
+    ac_start_encoder(codec);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Write the last bytes of a message, returns its size
+static uint32_t ac_message_flush(uint8_t* code_buffer, uint8_t* pointer, uint32_t interval_base, uint32_t length)
+{
+    // the decoder reads zeros past the end: pick the code in [base, base+length) with the most trailing zero bytes
+    uint64_t base = interval_base, end = base + length, code = base;
+    uint32_t num_bytes = 4;
+    for (uint32_t n = 0; n < 4; ++n)
+    {
+        uint64_t step = 1ULL << (32 - 8 * n);
+        uint64_t candidate = (base + step - 1) & ~(step - 1);
+        if (candidate < end)
+        {
+            code = candidate;
+            num_bytes = n;
+            break;
+        }
+    }
+
+    if (code >> 32)
+    {
+        uint8_t* p;
+        for (p = pointer - 1; *p == 0xFFU; p--)     // overflow = carry
+            *p = 0;
+        ++*p;
+    }
+
+    for (uint32_t n = 0; n < num_bytes; ++n)
+        *pointer++ = (uint8_t)(code >> (24 - 8 * n));
+
+    // bytes set to zero by a carry and zeros written before are implicit too
+    while (pointer > code_buffer && pointer[-1] == 0)
+        pointer--;
+
+    return (uint32_t)(pointer - code_buffer);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t ac_stop_message_encoder(struct arithmetic_codec* codec)
+{
+    assert(codec->mode == 1); // invalid to stop encoder
+    assert(codec->chunk_pool == NULL); // not available with chunked output
+    codec->mode = 0;
+
+    uint32_t code_bytes = ac_message_flush(codec->code_buffer, codec->ac_pointer, codec->base, codec->length);
+    assert(code_bytes <= codec->buffer_size); // code buffer overflow
+
+#ifdef AC_TRACE
+    ac_trace_record(codec, AC_TRACE_STOP_MESSAGE_ENCODER, 0, 0);
+    if (codec->trace_callback != NULL)
+        ac_trace_flush(codec);
+#endif
+
+    return code_bytes;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_start_message_decoder(struct arithmetic_codec* codec, const uint8_t* message, uint32_t size)
+{
+    assert(codec->mode == 0); // cannot start decoder
+    assert(codec->num_chunks == 0); // chunks of the previous encoding not released
+
+    codec->code_buffer = (uint8_t*) message;       // only read
+    codec->buffer_size = size;
+    codec->mode = 2;
+    codec->length = AC__MaxLength;
+    AC__TRACE(codec, AC_TRACE_START_MESSAGE_DECODER, 0, 0);
+
+    codec->value = 0;
+    for (uint32_t i = 0; i < 4; i++)
+        codec->value = (codec->value << 8) | ((i < size) ? message[i] : 0);
+
+    codec->code_end = codec->code_buffer + size;
+    codec->ac_pointer = codec->code_buffer + 3;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t ac_suspend_encoder(struct arithmetic_codec* codec, struct ac_encoder_state* state)
+{
+    assert(codec->mode == 1); // encoder not initialized
+    assert(codec->chunk_pool == NULL); // not available with chunked output
+    codec->mode = 0;
+
+    uint32_t code_bytes = (uint32_t)(codec->ac_pointer - codec->code_buffer);
+    assert(code_bytes <= codec->buffer_size); // code buffer overflow
+
+#ifdef AC_TRACE
+    ac_trace_record(codec, AC_TRACE_SUSPEND_ENCODER, 0, 0);
+    if (codec->trace_callback != NULL)
+        ac_trace_flush(codec);
+#endif
+
+    state->base = codec->base;
+    state->length = codec->length;
+    state->num_pending = state->pending_byte = 0;
+
+    // a carry is possible only if the interval crosses 2^32, it stops at the last byte that is not 0xFF
+    if ((uint64_t)codec->base + codec->length > (1ULL << 32))
+    {
+        uint32_t settled = code_bytes;
+        while (settled > 0 && codec->code_buffer[settled-1] == 0xFF)
+            settled--;
+        assert(settled > 0); // a carry cannot go past the first byte
+
+        state->num_pending = code_bytes - settled + 1;
+        state->pending_byte = codec->code_buffer[settled-1];
+        return settled - 1;
+    }
+
+    return code_bytes;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_resume_encoder(struct arithmetic_codec* codec, const struct ac_encoder_state* state)
+{
+    assert(codec->mode == 0); // cannot start encoder
+    assert(codec->num_chunks == 0); // chunks of the previous encoding not released
+    assert(codec->buffer_size > state->num_pending); // buffer too small
+    assert(state->length >= AC__MinLength); // invalid state
+
+    codec->mode = 1;
+    codec->base = state->base;
+    codec->length = state->length;
+    codec->ac_pointer = codec->code_buffer;
+    codec->code_end = NULL;
+    codec->chunk_pool = NULL;
+    AC__TRACE(codec, AC_TRACE_RESUME_ENCODER, 0, 0);
+
+    for (uint32_t i = 0; i < state->num_pending; i++)
+        *codec->ac_pointer++ = (i == 0) ? (uint8_t) state->pending_byte : 0xFF;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Write the last bytes of the stream
+static void ac_flush_encoder(struct arithmetic_codec* codec)
+{
+    assert(codec->mode == 1); // invalid to stop encoder
+    codec->mode = 0;
+
+    uint32_t init_base = codec->base;            // done encoding: set final data bytes
+
+    if (codec->length > 2 * AC__MinLength) 
+    {
+        codec->base  += AC__MinLength;                                     // base offset
+        codec->length = AC__MinLength >> 1;             // set new length for 1 more byte
+    }
+    else 
+    {
+        codec->base  += AC__MinLength >> 1;                                // base offset
+        codec->length = AC__MinLength >> 9;            // set new length for 2 more bytes
+    }
+
+    if (init_base > codec->base) 
+        ac_propagate_carry(codec);                 // overflow = carry
+
+    ac_renorm_enc_interval(codec);                // renormalization = output last bytes
+
+#ifdef AC_TRACE
+    ac_trace_record(codec, AC_TRACE_STOP_ENCODER, 0, 0);
+    if (codec->trace_callback != NULL)
+        ac_trace_flush(codec);
+#endif
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t ac_stop_encoder(struct arithmetic_codec* codec)
+{
+    assert(codec->chunk_pool == NULL); // use ac_stop_chunk_encoder()
+    ac_flush_encoder(codec);
+
+    uint32_t code_bytes = (uint32_t)(codec->ac_pointer - codec->code_buffer);
+    assert(code_bytes <= codec->buffer_size); // code buffer overflow
+    return code_bytes;                                   // number of bytes used
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_stop_decoder(struct arithmetic_codec* codec)
+{
+    assert(codec->mode == 2);  // invalid to stop decoder
+    codec->mode = 0;
+    codec->segments = NULL;
+
+#ifdef AC_TRACE
+    ac_trace_record(codec, AC_TRACE_STOP_DECODER, 0, 0);
+    if (codec->trace_callback != NULL)
+        ac_trace_flush(codec);
+#endif
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_put_bit(struct arithmetic_codec* codec, uint32_t bit)
+{
+    assert(codec->mode == 1);  // encoder not initialized
+
+    codec->length >>= 1;    // halve interval
+    if (bit) 
+    {
+        uint32_t init_base = codec->base;
+        codec->base += codec->length;   // move base
+        if (init_base > codec->base) 
+            ac_propagate_carry(codec);  // overflow = carry
+    }
+
+    if (codec->length < AC__MinLength) 
+        ac_renorm_enc_interval(codec); // renormalization
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t ac_get_bit(struct arithmetic_codec* codec)
+{
+    assert(codec->mode == 2); //  decoder not initialized   
+
+    codec->length >>= 1;  // halve interval
+    uint32_t bit = (codec->value >= codec->length);  // decode bit
+    if (bit) 
+        codec->value -= codec->length; // move base
+
+    if (codec->length < AC__MinLength) 
+        ac_renorm_dec_interval(codec);  // renormalization
+
+    return bit;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_put_bits(struct arithmetic_codec* codec, uint32_t data, uint32_t number_of_bits)
+{
+    assert(codec->mode == 1);  // encoder not initialized
+    assert((number_of_bits > 0) && (number_of_bits < 21));  // invalid number of bits
+    assert(data < (1U << number_of_bits)); // invalid data
+    AC__TRACE(codec, AC_TRACE_PUT_BITS, number_of_bits, data);
+
+    uint32_t init_base = codec->base;
+    codec->base += data * (codec->length >>= number_of_bits);            // new interval base and length
+
+    if (init_base > codec->base) 
+        ac_propagate_carry(codec);                 // overflow = carry
+
+    if (codec->length < AC__MinLength) 
+        ac_renorm_enc_interval(codec);        // renormalization
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t ac_get_bits(struct arithmetic_codec* codec, uint32_t number_of_bits)
+{
+    assert(codec->mode == 2);  // decoder not initialized
+    assert((number_of_bits > 0) && (number_of_bits < 21));  // invalid number of bits
+
+    // decode symbol, change length
+    unsigned s = codec->value / (codec->length >>= number_of_bits);      
+
+    codec->value -= codec->length * s; // update interval
+    if (codec->length < AC__MinLength) 
+        ac_renorm_dec_interval(codec); // renormalization
+
+    AC__TRACE(codec, AC_TRACE_GET_BITS, number_of_bits, s);
+    return s;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Encode a symbol of a cumulative distribution (shared by all multi-symbols models)
+static inline void ac_encode_distribution(struct arithmetic_codec* codec, uint32_t data, const uint32_t* distribution,
+                                          uint32_t last_symbol, uint32_t length_shift)
+{
+    uint32_t x, init_base = codec->base;
+
+    // compute products
+    if (data == last_symbol) 
+    {
+        x = distribution[data] * (codec->length >> length_shift);
+        codec->base   += x;  // update interval
+        codec->length -= x;  // no product needed
+    }
+    else 
+    {
+        x = distribution[data] * (codec->length >>= length_shift);
+        codec->base   += x;                                            // update interval
+        codec->length  = distribution[data+1] * codec->length - x;
+    }
+                
+    if (init_base > codec->base) 
+        ac_propagate_carry(codec); // overflow = carry
+
+    if (codec->length < AC__MinLength)
+        ac_renorm_enc_interval(codec);        // renormalization
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Decode a symbol of a cumulative distribution (shared by all multi-symbols models)
+static inline uint32_t ac_decode_distribution(struct arithmetic_codec* codec, const uint32_t* distribution,
+                                              const uint32_t* decoder_table, uint32_t table_shift, uint32_t data_symbols,
+                                              uint32_t length_shift)
+{
+    uint32_t n, s, x, y = codec->length;
+
+    if (decoder_table) 
+    {
+        // use table look-up for faster decoding
+        uint32_t dv = codec->value / (codec->length >>= length_shift);
+
+        // the truncated length can push the last symbol's slots past the end of the table
+        uint32_t last_slot = (1U << length_shift) - 1;
+        if (dv > last_slot)
+            dv = last_slot;
+        uint32_t t = dv >> table_shift;
+
+        // initial decision based on table look-up
+        s = decoder_table[t];
+        n = decoder_table[t+1] + 1;
+
+        while (n > s + 1) 
+        {
+            // finish with bisection search
+            uint32_t m = (s + n) >> 1;
+            if (distribution[m] > dv) 
+                n = m; 
+            else 
+                s = m;
+        }
+
+        // compute products
+        x = distribution[s] * codec->length;
+        if (s != data_symbols - 1) y = distribution[s+1] * codec->length;
+    }
+    else 
+    {
+        // decode using only multiplications
+        x = s = 0;
+        codec->length >>= length_shift;
+        uint32_t m = (n = data_symbols) >> 1;
+
+        // decode via bisection search
+        do 
+        {
+            uint32_t z = codec->length * distribution[m];
+            if (z > codec->value) 
+            {
+                n = m;
+                y = z;  // value is smaller
+            }
+            else 
+            {
+                s = m;
+                x = z; // value is larger or equal
+            }
+        } while ((m = (s + n) >> 1) != s);
+    }
+
+    // update interval
+    codec->value -= x;
+    codec->length = y - x;
+
+    if (codec->length < AC__MinLength) 
+        ac_renorm_dec_interval(codec);        // renormalization
+
+    return s;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Decode the rank of a symbol of a frequency-sorted model: linear scan of the most frequent ranks then search
+static inline uint32_t ac_decode_sorted(struct arithmetic_codec* codec, const struct adaptive_model* model)
+{
+    const uint32_t* distribution = model->distribution;
+    uint32_t x, y = codec->length;
+    uint32_t dv = codec->value / (codec->length >>= model->length_shift);
+    uint32_t s = 0, last = (model->last_symbol < DM__SortedScan) ? model->last_symbol : DM__SortedScan;
+
+    // the truncated length can push the last rank's slots past the end of the table
+    uint32_t last_slot = (1U << model->length_shift) - 1;
+    if (dv > last_slot)
+        dv = last_slot;
+
+    while (s < last && distribution[s+1] <= dv) 
+        ++s;
+
+    if (s == DM__SortedScan && s < model->last_symbol)
+    {
+        // not in the top ranks: table look-up (if any) and bisection search
+        uint32_t n = model->data_symbols;
+        if (model->decoder_table)
+        {
+            uint32_t t = dv >> model->table_shift;
+            if (model->decoder_table[t] > s) 
+                s = model->decoder_table[t];
+            n = model->decoder_table[t+1] + 1;
+        }
+
+        while (n > s + 1) 
+        {
+            uint32_t m = (s + n) >> 1;
+            if (distribution[m] > dv) 
+                n = m; 
+            else 
+                s = m;
+        }
+    }
+
+    // compute products
+    x = distribution[s] * codec->length;
+    if (s != model->last_symbol) y = distribution[s+1] * codec->length;
+
+    // update interval
+    codec->value -= x;
+    codec->length = y - x;
+
+    if (codec->length < AC__MinLength) 
+        ac_renorm_dec_interval(codec);        // renormalization
+
+    return s;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_encode_adaptive(struct arithmetic_codec* codec, uint32_t data, struct adaptive_model* model)
+{
+    assert(codec->mode == 1);  // encoder not initialized
+    assert(data < model->data_symbols); // invalid data symbols
+    assert(model->distribution != NULL); // adaptive model should be initialized
+    AC__TRACE_MODEL(codec, adaptive, model);
+    AC__TRACE_CHANGE(model);
+    AC__TRACE_SYMBOL(codec, AC_TRACE_ENCODE_ADAPTIVE, model, data, 0);
+
+    if (model->symbol_to_rank != NULL)
+        data = model->symbol_to_rank[data];
+
+    ac_encode_distribution(codec, data, model->distribution, model->last_symbol, model->length_shift);
+
+    model->symbol_count[data] += model->increment;
+    if (--model->symbols_until_update == 0)
+        adaptive_model_update(model, 1);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t ac_decode_adaptive(struct arithmetic_codec* codec, struct adaptive_model* model)
+{
+    assert(codec->mode == 2); // decoder not initialized
+    assert(model->distribution != NULL); // adaptive model should be initialized
+    AC__TRACE_MODEL(codec, adaptive, model);
+
+    uint32_t s;
+    if (model->rank_to_symbol != NULL)
+    {
+        uint32_t rank = ac_decode_sorted(codec, model);
+        model->symbol_count[rank] += model->increment;
+        s = model->rank_to_symbol[rank];
+    }
+    else
+    {
+        s = ac_decode_distribution(codec, model->distribution, model->decoder_table, model->table_shift,
+                                   model->data_symbols, model->length_shift);
+        model->symbol_count[s] += model->increment;
+    }
+
+    if (--model->symbols_until_update == 0) 
+        adaptive_model_update(model, 0);
+
+    AC__TRACE_CHANGE(model);
+    AC__TRACE_SYMBOL(codec, AC_TRACE_DECODE_ADAPTIVE, model, s, 0);
+    return s;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_encode_quasi_static(struct arithmetic_codec* codec, uint32_t data, struct adaptive_model* model)
+{
+    assert(codec->mode == 1);  // encoder not initialized
+    assert(data < model->data_symbols); // invalid data symbols
+    AC__TRACE_MODEL(codec, adaptive, model);
+    AC__TRACE_CHANGE(model);
+    AC__TRACE_SYMBOL(codec, AC_TRACE_ENCODE_QUASI_STATIC, model, data, 0);
+
+    if (model->symbol_to_rank != NULL)
+        data = model->symbol_to_rank[data];
+
+    ac_encode_distribution(codec, data, model->distribution, model->last_symbol, model->length_shift);
+    model->symbol_count[data] += model->increment;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t ac_decode_quasi_static(struct arithmetic_codec* codec, struct adaptive_model* model)
+{
+    assert(codec->mode == 2); // decoder not initialized
+    AC__TRACE_MODEL(codec, adaptive, model);
+
+    uint32_t s;
+    if (model->rank_to_symbol != NULL)
+    {
+        uint32_t rank = ac_decode_sorted(codec, model);
+        model->symbol_count[rank] += model->increment;
+        s = model->rank_to_symbol[rank];
+    }
+    else
+    {
+        s = ac_decode_distribution(codec, model->distribution, model->decoder_table, model->table_shift,
+                                   model->data_symbols, model->length_shift);
+        model->symbol_count[s] += model->increment;
+    }
+
+    AC__TRACE_CHANGE(model);
+    AC__TRACE_SYMBOL(codec, AC_TRACE_DECODE_QUASI_STATIC, model, s, 0);
+    return s;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_encode_static(struct arithmetic_codec* codec, uint32_t data, struct static_model* model)
+{
+    assert(codec->mode == 1);   // encoder not initialized
+    assert(data < model->data_symbols); // invalid data symbol
+    AC__TRACE_MODEL(codec, static, model);
+    AC__TRACE_SYMBOL(codec, AC_TRACE_ENCODE_STATIC, model, data, 0);
+
+    ac_encode_distribution(codec, data, model->distribution, model->last_symbol, model->length_shift);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Returns the symbol of a static model whose interval contains dv, the value divided by the truncated length
+static inline uint32_t static_model_find_symbol(const struct static_model* model, uint32_t dv)
+{
+    // the truncated length can push the last symbol's slots past the end of the table
+    uint32_t last_slot = (1U << model->length_shift) - 1;
+    if (dv > last_slot)
+        dv = last_slot;
+
+    if (model->lookup_table != NULL)
+        return model->lookup_table[dv];
+
+    uint32_t s, n;
+    if (model->cutoff_table != NULL)
+    {
+        uint32_t bucket = dv >> model->cutoff_shift;
+        uint32_t entry = model->cutoff_table[bucket];
+        s = (entry >> 16) & 0x7fff;
+
+        if ((entry & 0x80000000U) == 0)
+            return s + ((dv & ((1U << model->cutoff_shift) - 1)) >= (entry & 0xffff));
+
+        // several boundaries in the bucket, finish with bisection search
+        n = ((model->cutoff_table[bucket+1] >> 16) & 0x7fff) + 1;
+    }
+    else if (model->decoder_table != NULL)
+    {
+        uint32_t t = dv >> model->table_shift;
+        s = model->decoder_table[t];
+        n = model->decoder_table[t+1] + 1;
+    }
+    else
+    {
+        s = 0;
+        n = model->data_symbols;
+    }
+
+    // branchless bisection, the number of steps only depends on the range
+    for (uint32_t size = n - s; size > 1; )
+    {
+        uint32_t half = size >> 1;
+        s = (model->distribution[s + half] <= dv) ? s + half : s;
+        size -= half;
+    }
+    return s;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t ac_decode_static(struct arithmetic_codec* codec, struct static_model* model)
+{
+    assert(codec->mode == 2);  // decoder not initialized
+
+    uint32_t s;
+    if (model->lookup_table != NULL || model->cutoff_table != NULL)
+    {
+        uint32_t x, y = codec->length;
+        uint32_t dv = codec->value / (codec->length >>= model->length_shift);
+        s = static_model_find_symbol(model, dv);
+
+        // compute products
+        x = model->distribution[s] * codec->length;
+        if (s != model->last_symbol) y = model->distribution[s+1] * codec->length;
+
+        // update interval
+        codec->value -= x;
+        codec->length = y - x;
+
+        if (codec->length < AC__MinLength) 
+            ac_renorm_dec_interval(codec);        // renormalization
+    }
+    else
+        s = ac_decode_distribution(codec, model->distribution, model->decoder_table, model->table_shift,
+                                   model->data_symbols, model->length_shift);
+
+    AC__TRACE_MODEL(codec, static, model);
+    AC__TRACE_SYMBOL(codec, AC_TRACE_DECODE_STATIC, model, s, 0);
+    return s;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Batch of messages
+//----------------------------------------------------------------------------------------------------------------------
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_encode_static_batch(uint8_t* const buffers[AC_BATCH_LANES], uint32_t buffer_size,
+                            const uint32_t* const data[AC_BATCH_LANES], const uint32_t count[AC_BATCH_LANES],
+                            const struct static_model* model, uint32_t sizes[AC_BATCH_LANES])
+{
+    // state of the lanes kept in local arrays, stores to the buffers cannot alias them
+    uint32_t base[AC_BATCH_LANES], length[AC_BATCH_LANES];
+    uint8_t* pointer[AC_BATCH_LANES];
+    uint32_t common = count[0], max_count = count[0];
+
+    for(uint32_t lane=0; lane<AC_BATCH_LANES; ++lane)
+    {
+        base[lane] = 0;
+        length[lane] = AC__MaxLength;
+        pointer[lane] = buffers[lane];
+        common = (count[lane] < common) ? count[lane] : common;
+        max_count = (count[lane] > max_count) ? count[lane] : max_count;
+    }
+
+    const uint32_t* distribution = model->distribution;
+    const uint32_t shift = model->length_shift, last_symbol = model->last_symbol;
+
+    for(uint32_t i=0; i<max_count; ++i)
+    {
+        for(uint32_t lane=0; lane<AC_BATCH_LANES; ++lane)
+        {
+            // all lanes are active for the length of the shortest message
+            if (i >= common && i >= count[lane])
+                continue;
+
+            uint32_t symbol = data[lane][i];
+            assert(symbol < model->data_symbols); // invalid data symbol
+
+            // same steps as ac_encode_distribution() with selects instead of branches, the lanes interleave better
+            uint32_t l = length[lane] >> shift, init_base = base[lane];
+            uint32_t x = distribution[symbol] * l;
+            uint32_t y = distribution[symbol + (symbol != last_symbol)] * l;
+            length[lane] = ((symbol == last_symbol) ? length[lane] : y) - x;
+            base[lane] += x;
+
+            if (init_base > base[lane])
+            {
+                uint8_t* p;
+                for (p = pointer[lane] - 1; *p == 0xFFU; p--)     // overflow = carry
+                    *p = 0;
+                ++*p;
+            }
+
+            // the top byte is always stored and kept only if the interval is renormalized
+            for (uint32_t k = 0; k < 2; ++k)
+            {
+                uint32_t renorm = length[lane] < AC__MinLength;
+                *pointer[lane] = (uint8_t)(base[lane] >> 24);
+                pointer[lane] += renorm;
+                base[lane] <<= renorm * 8;
+                length[lane] <<= renorm * 8;
+            }
+
+            while (length[lane] < AC__MinLength)
+            {
+                *pointer[lane]++ = (uint8_t)(base[lane] >> 24);
+                base[lane] <<= 8;
+                length[lane] <<= 8;
+            }
+        }
+    }
+
+    for(uint32_t lane=0; lane<AC_BATCH_LANES; ++lane)
+    {
+        sizes[lane] = ac_message_flush(buffers[lane], pointer[lane], base[lane], length[lane]);
+        assert(sizes[lane] <= buffer_size); // code buffer overflow
+    }
+    (void) buffer_size;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_decode_static_batch(const uint8_t* const messages[AC_BATCH_LANES], const uint32_t sizes[AC_BATCH_LANES],
+                            uint32_t* const data[AC_BATCH_LANES], const uint32_t count[AC_BATCH_LANES],
+                            const struct static_model* model)
+{
+    uint32_t value[AC_BATCH_LANES], length[AC_BATCH_LANES];
+    const uint8_t *pointer[AC_BATCH_LANES], *end[AC_BATCH_LANES];
+    uint32_t common = count[0], max_count = count[0];
+
+    for(uint32_t lane=0; lane<AC_BATCH_LANES; ++lane)
+    {
+        value[lane] = 0;
+        for (uint32_t i = 0; i < 4; i++)
+            value[lane] = (value[lane] << 8) | ((i < sizes[lane]) ? messages[lane][i] : 0);
+
+        length[lane] = AC__MaxLength;
+        pointer[lane] = messages[lane] + 3;
+        end[lane] = messages[lane] + sizes[lane];
+        common = (count[lane] < common) ? count[lane] : common;
+        max_count = (count[lane] > max_count) ? count[lane] : max_count;
+    }
+
+    const uint32_t* distribution = model->distribution;
+    const uint32_t shift = model->length_shift, last_symbol = model->last_symbol;
+
+    for(uint32_t i=0; i<max_count; ++i)
+    {
+        for(uint32_t lane=0; lane<AC_BATCH_LANES; ++lane)
+        {
+            if (i >= common && i >= count[lane])
+                continue;
+
+            // the divisions of the lanes are independent and overlap in the pipeline
+            uint32_t l = length[lane] >> shift;
+            uint32_t s = static_model_find_symbol(model, value[lane] / l);
+
+            uint32_t x = distribution[s] * l;
+            uint32_t y = distribution[s + (s != last_symbol)] * l;
+            length[lane] = ((s == last_symbol) ? length[lane] : y) - x;
+            value[lane] -= x;
+            data[lane][i] = s;
+
+            for (uint32_t k = 0; k < 2; ++k)
+            {
+                uint32_t renorm = length[lane] < AC__MinLength;
+                pointer[lane] += renorm;
+                uint32_t byte = (pointer[lane] < end[lane]) ? *pointer[lane] : 0;
+                value[lane] = (value[lane] << (renorm * 8)) | (byte & (0U - renorm));
+                length[lane] <<= renorm * 8;
+            }
+
+            while (length[lane] < AC__MinLength)
+            {
+                value[lane] <<= 8;
+                if (++pointer[lane] < end[lane])
+                    value[lane] |= (uint32_t)(*pointer[lane]);
+                length[lane] <<= 8;
+            }
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_put_frequencies(struct arithmetic_codec* codec, struct adaptive_model* model, uint32_t number_of_symbols,
+                        const uint32_t* frequency, const uint32_t* previous)
+{
+    assert(model->data_symbols == AC_FREQUENCY_MODEL_SYMBOLS); // invalid model
+
+    // the last frequency is implied by the total
+    for (uint32_t k = 0; k < number_of_symbols - 1; k++)
+    {
+        int32_t delta = (int32_t)frequency[k] - (int32_t)(previous ? previous[k] : 0);
+        uint32_t zigzag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+        uint32_t bits = 0;
+        while ((zigzag >> bits) != 0)
+            ++bits;
+
+        // bit length followed by the bits under the leading one
+        ac_encode_adaptive(codec, bits, model);
+        if (bits > 1)
+            ac_put_bits(codec, zigzag - (1U << (bits - 1)), bits - 1);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_get_frequencies(struct arithmetic_codec* codec, struct adaptive_model* model, uint32_t number_of_symbols,
+                        uint32_t* frequency, const uint32_t* previous)
+{
+    assert(model->data_symbols == AC_FREQUENCY_MODEL_SYMBOLS); // invalid model
+
+    uint32_t sum = 0;
+    for (uint32_t k = 0; k < number_of_symbols - 1; k++)
+    {
+        uint32_t bits = ac_decode_adaptive(codec, model);
+        uint32_t zigzag = bits;
+        if (bits > 1)
+            zigzag = (1U << (bits - 1)) + ac_get_bits(codec, bits - 1);
+
+        int32_t delta = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+        frequency[k] = (uint32_t)((int32_t)(previous ? previous[k] : 0) + delta);
+        sum += frequency[k];
+    }
+
+    frequency[number_of_symbols - 1] = AC_FREQUENCY_TOTAL - sum;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint8_t* ac_get_buffer(struct arithmetic_codec* codec)
+{
+    return codec->code_buffer;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_terminate(struct arithmetic_codec* codec)
+{
+#ifdef AC_TRACE
+    if (codec->trace_callback != NULL)
+        ac_trace_flush(codec);
+    ac__free(&codec->allocator, codec->trace_models);
+#endif
+    ac__free(&codec->allocator, codec->new_buffer);
+    ac_release_chunks(codec);
+    ac__free(&codec->allocator, codec->chunks);
+
+    struct ac_allocator allocator = codec->allocator;
+    ac__free(&allocator, codec);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Codec pool
+//----------------------------------------------------------------------------------------------------------------------
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+
+static inline void ac__spin_lock(volatile long* lock)
+{
+    while (_InterlockedCompareExchange(lock, 1, 0) != 0)
+        while (*lock != 0);
+}
+
+static inline void ac__spin_unlock(volatile long* lock)
+{
+    _InterlockedExchange(lock, 0);
+}
+#else
+static inline void ac__spin_lock(volatile long* lock)
+{
+    while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE) != 0)
+        while (__atomic_load_n(lock, __ATOMIC_RELAXED) != 0);
+}
+
+static inline void ac__spin_unlock(volatile long* lock)
+{
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+#endif
+
+struct ac_codec_pool
+{
+    struct arithmetic_codec** free_codecs;      // stack of available codecs
+    uint32_t num_free, buffer_size;
+    struct ac_codec_pool_stats stats;
+    volatile long lock;
+    struct ac_allocator allocator;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+static void ac_codec_pool_warm_buffer(struct arithmetic_codec* codec, uint32_t buffer_size)
+{
+    ac_set_buffer(codec, buffer_size, NULL);
+
+    // fault the pages in now rather than on the first message
+    for(uint32_t i=0; i<codec->new_buffer_size + 16; ++i)
+        codec->new_buffer[i] = 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+struct ac_codec_pool* ac_codec_pool_init(uint32_t number_of_codecs, uint32_t buffer_size, const struct ac_allocator* allocator)
+{
+    assert(number_of_codecs > 0 && buffer_size > 0);
+
+    if (allocator == NULL)
+        allocator = &ac__default_allocator;
+
+    struct ac_codec_pool* pool = (struct ac_codec_pool*) ac__alloc(allocator, sizeof(struct ac_codec_pool));
+    pool->allocator = *allocator;
+    pool->free_codecs = (struct arithmetic_codec**) ac__alloc(allocator, number_of_codecs * sizeof(struct arithmetic_codec*));
+    pool->num_free = number_of_codecs;
+    pool->buffer_size = buffer_size;
+    pool->lock = 0;
+    pool->stats.num_codecs = number_of_codecs;
+    pool->stats.in_use = pool->stats.max_in_use = pool->stats.num_failures = 0;
+    pool->stats.max_buffer_size = buffer_size;
+
+    for(uint32_t i=0; i<number_of_codecs; ++i)
+    {
+        pool->free_codecs[i] = ac_init_with_allocator(allocator);
+        ac_codec_pool_warm_buffer(pool->free_codecs[i], buffer_size);
+    }
+
+    return pool;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+struct arithmetic_codec* ac_codec_pool_acquire(struct ac_codec_pool* pool)
+{
+    struct arithmetic_codec* codec = NULL;
+
+    ac__spin_lock(&pool->lock);
+    if (pool->num_free > 0)
+    {
+        codec = pool->free_codecs[--pool->num_free];
+        if (++pool->stats.in_use > pool->stats.max_in_use)
+            pool->stats.max_in_use = pool->stats.in_use;
+    }
+    else
+        pool->stats.num_failures++;
+    ac__spin_unlock(&pool->lock);
+
+    return codec;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_codec_pool_release(struct ac_codec_pool* pool, struct arithmetic_codec* codec)
+{
+    assert(codec->mode == 0); // codec still encoding or decoding
+
+    // the codec is not shared yet, restore its internal buffer outside of the lock
+    if (codec->new_buffer == NULL)
+        ac_codec_pool_warm_buffer(codec, pool->buffer_size);
+    else
+        ac_set_buffer(codec, codec->new_buffer_size, NULL);
+
+    ac__spin_lock(&pool->lock);
+    assert(pool->num_free < pool->stats.num_codecs); // codec released twice or from another pool
+    pool->free_codecs[pool->num_free++] = codec;
+    pool->stats.in_use--;
+    if (codec->new_buffer_size > pool->stats.max_buffer_size)
+        pool->stats.max_buffer_size = codec->new_buffer_size;
+    ac__spin_unlock(&pool->lock);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_codec_pool_get_stats(struct ac_codec_pool* pool, struct ac_codec_pool_stats* stats)
+{
+    ac__spin_lock(&pool->lock);
+    *stats = pool->stats;
+    ac__spin_unlock(&pool->lock);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_codec_pool_terminate(struct ac_codec_pool* pool)
+{
+    assert(pool->num_free == pool->stats.num_codecs); // codecs still in use
+
+    for(uint32_t i=0; i<pool->num_free; ++i)
+        ac_terminate(pool->free_codecs[i]);
+
+    struct ac_allocator allocator = pool->allocator;
+    ac__free(&allocator, pool->free_codecs);
+    ac__free(&allocator, pool);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Chunked output
+//----------------------------------------------------------------------------------------------------------------------
+
+struct ac_chunk_pool
+{
+    void* free_chunks;          // linked list, the first bytes of a free chunk point to the next one
+    uint32_t chunk_size, num_chunks;
+    volatile long lock;
+    struct ac_allocator allocator;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+struct ac_chunk_pool* ac_chunk_pool_init(uint32_t chunk_size, const struct ac_allocator* allocator)
+{
+    assert(chunk_size >= 16);
+
+    if (allocator == NULL)
+        allocator = &ac__default_allocator;
+
+    struct ac_chunk_pool* pool = (struct ac_chunk_pool*) ac__alloc(allocator, sizeof(struct ac_chunk_pool));
+    pool->allocator = *allocator;
+    pool->free_chunks = NULL;
+    pool->chunk_size = chunk_size;
+    pool->num_chunks = 0;
+    pool->lock = 0;
+    return pool;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_chunk_pool_terminate(struct ac_chunk_pool* pool)
+{
+    uint32_t num_free = 0;
+    struct ac_allocator allocator = pool->allocator;
+    while (pool->free_chunks != NULL)
+    {
+        void* chunk = pool->free_chunks;
+        memcpy(&pool->free_chunks, chunk, sizeof(void*));
+        ac__free(&allocator, chunk);
+        num_free++;
+    }
+    assert(num_free == pool->num_chunks); // chunks still in use
+    (void) num_free;
+
+    ac__free(&allocator, pool);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Append a chunk to the output of the codec, the previous one is full
+static void ac_next_chunk(struct arithmetic_codec* codec)
+{
+    struct ac_chunk_pool* pool = codec->chunk_pool;
+    assert(pool != NULL); // code buffer overflow
+
+    if (codec->num_chunks == codec->chunks_capacity)
+    {
+        uint32_t capacity = codec->chunks_capacity ? codec->chunks_capacity * 2 : 16;
+        struct ac_chunk* chunks = (struct ac_chunk*) ac__alloc(&codec->allocator, capacity * sizeof(struct ac_chunk));
+        assert(chunks != NULL);
+        for (uint32_t i = 0; i < codec->num_chunks; ++i)
+            chunks[i] = codec->chunks[i];
+        ac__free(&codec->allocator, codec->chunks);
+        codec->chunks = chunks;
+        codec->chunks_capacity = capacity;
+    }
+
+    ac__spin_lock(&pool->lock);
+    void* data = pool->free_chunks;
+    if (data != NULL)
+        memcpy(&pool->free_chunks, data, sizeof(void*));
+    else
+        pool->num_chunks++;
+    ac__spin_unlock(&pool->lock);
+
+    if (data == NULL)
+        data = ac__alloc(&pool->allocator, pool->chunk_size);
+    assert(data != NULL); // cannot assign chunk memory
+
+    struct ac_chunk* chunk = &codec->chunks[codec->num_chunks++];
+    chunk->data = data;
+    chunk->size = pool->chunk_size;
+    codec->ac_pointer = (uint8_t*) data;
+    codec->code_end = codec->ac_pointer + pool->chunk_size;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Carry propagation going back through the previous chunks
+static void ac_propagate_carry_chunks(struct arithmetic_codec* codec)
+{
+    uint32_t c = codec->num_chunks - 1;
+    uint8_t* p = codec->ac_pointer;
+    for (;;)
+    {
+        uint8_t* start = (uint8_t*) codec->chunks[c].data;
+        while (p > start)
+        {
+            if (*--p != 0xFFU)
+            {
+                ++*p;
+                return;
+            }
+            *p = 0;
+        }
+
+        assert(c > 0); // a carry cannot go past the first byte
+        c--;
+        p = (uint8_t*) codec->chunks[c].data + codec->chunks[c].size;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_start_chunk_encoder(struct arithmetic_codec* codec, struct ac_chunk_pool* pool)
+{
+    assert(codec->mode == 0); // cannot start encoder
+    assert(codec->num_chunks == 0); // chunks of the previous encoding not released
+
+    codec->mode = 1;
+    codec->base = 0;
+    codec->length = AC__MaxLength;
+    codec->chunk_pool = pool;
+    ac_next_chunk(codec);
+    AC__TRACE(codec, AC_TRACE_START_ENCODER, 0, 0);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t ac_stop_chunk_encoder(struct arithmetic_codec* codec, const struct ac_chunk** chunks)
+{
+    assert(codec->chunk_pool != NULL); // use ac_stop_encoder()
+    ac_flush_encoder(codec);
+
+    struct ac_chunk* last = &codec->chunks[codec->num_chunks - 1];
+    last->size = (size_t)(codec->ac_pointer - (uint8_t*) last->data);
+    *chunks = codec->chunks;
+    return codec->num_chunks;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_release_chunks(struct arithmetic_codec* codec)
+{
+    assert(codec->mode == 0); // cannot release chunks while encoding
+    if (codec->num_chunks == 0)
+        return;
+
+    struct ac_chunk_pool* pool = codec->chunk_pool;
+    ac__spin_lock(&pool->lock);
+    for (uint32_t i = 0; i < codec->num_chunks; ++i)
+    {
+        memcpy(codec->chunks[i].data, &pool->free_chunks, sizeof(void*));
+        pool->free_chunks = codec->chunks[i].data;
+    }
+    ac__spin_unlock(&pool->lock);
+
+    codec->num_chunks = 0;
+    codec->chunk_pool = NULL;
+    codec->code_end = NULL;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Segmented input
+//----------------------------------------------------------------------------------------------------------------------
+
+// Move to the next non-empty segment, returns its first byte or 0 when all segments have been read
+static uint32_t ac_next_segment(struct arithmetic_codec* codec)
+{
+    while (codec->segment_index < codec->num_segments)
+    {
+        const struct ac_chunk* segment = &codec->segments[codec->segment_index++];
+        if (segment->size != 0)
+        {
+            codec->ac_pointer = (uint8_t*) segment->data;
+            codec->code_end = codec->ac_pointer + segment->size;
+            return *codec->ac_pointer;
+        }
+    }
+
+    // from now on, the decoder reads zeros, not the bytes of a previous input
+    codec->segments = NULL;
+    codec->ac_pointer = codec->code_end = NULL;
+    return 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_start_segment_decoder(struct arithmetic_codec* codec, const struct ac_chunk* segments, uint32_t num_segments)
+{
+    assert(codec->mode == 0); // cannot start decoder
+    assert(codec->num_chunks == 0); // chunks of the previous encoding not released
+    assert(segments != NULL || num_segments == 0);
+
+    codec->mode = 2;
+    codec->length = AC__MaxLength;
+    AC__TRACE(codec, AC_TRACE_START_DECODER, 0, 0);
+
+    codec->segments = segments;
+    codec->num_segments = num_segments;
+    codec->segment_index = 0;
+    codec->value = ac_next_segment(codec);
+    for (uint32_t i = 1; i < 4; i++)
+    {
+        codec->value <<= 8;
+        if (codec->segments != NULL)
+            codec->value |= (++codec->ac_pointer < codec->code_end) ? *codec->ac_pointer : ac_next_segment(codec);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_append_segments(struct arithmetic_codec* codec, const struct ac_chunk* segments, uint32_t num_segments)
+{
+    assert(codec->mode == 2 && codec->segments != NULL); // not a segment decoder or already read past the end
+    assert(codec->num_chunks == 0); // chunks of an encoding not released
+
+    // the segments not read yet are moved in front of the storage of the codec, followed by the new ones
+    uint32_t num_left = codec->num_segments - codec->segment_index;
+    uint32_t count = num_left + num_segments;
+    if (count > codec->chunks_capacity)
+    {
+        uint32_t capacity = codec->chunks_capacity ? codec->chunks_capacity : 16;
+        while (capacity < count)
+            capacity *= 2;
+
+        struct ac_chunk* chunks = (struct ac_chunk*) ac__alloc(&codec->allocator, capacity * sizeof(struct ac_chunk));
+        assert(chunks != NULL);
+        for (uint32_t i = 0; i < num_left; ++i)
+            chunks[i] = codec->segments[codec->segment_index + i];
+        ac__free(&codec->allocator, codec->chunks);
+        codec->chunks = chunks;
+        codec->chunks_capacity = capacity;
+    }
+    else
+    {
+        for (uint32_t i = 0; i < num_left; ++i)
+            codec->chunks[i] = codec->segments[codec->segment_index + i];
+    }
+
+    for (uint32_t i = 0; i < num_segments; ++i)
+        codec->chunks[num_left + i] = segments[i];
+
+    codec->segments = codec->chunks;
+    codec->num_segments = count;
+    codec->segment_index = 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+size_t ac_get_segment_bytes_left(const struct arithmetic_codec* codec)
+{
+    assert(codec->mode == 2); // decoder not initialized
+    if (codec->segments == NULL)
+        return 0;
+
+    size_t bytes_left = (size_t)(codec->code_end - codec->ac_pointer) - 1;
+    for (uint32_t i = codec->segment_index; i < codec->num_segments; ++i)
+        bytes_left += codec->segments[i].size;
+    return bytes_left;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Adaptive bit model
+//----------------------------------------------------------------------------------------------------------------------
+
+// Untraced versions, also used by the context hash and tree models which record their own symbols
+static inline void ac__encode_bit(struct arithmetic_codec* codec, uint32_t bit, ac_bit_model* model)
+{
+    assert(codec->mode == 1);  // encoder not initialized
+
+    uint32_t x = (uint32_t)(*model) * (codec->length >> BM__LengthShift);
+
+    if (bit == 0)
+    {
+        codec->length = x;
+        *model += (BM__MaxProbability - *model) >> BM__AdaptShift;
+    }
+    else
+    {
+        uint32_t init_base = codec->base;
+        codec->base   += x; // move base
+        codec->length -= x;
+        *model -= *model >> BM__AdaptShift;
+
+        if (init_base > codec->base)
+            ac_propagate_carry(codec);  // overflow = carry
+    }
+
+    if (codec->length < AC__MinLength)
+        ac_renorm_enc_interval(codec); // renormalization
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static inline uint32_t ac__decode_bit(struct arithmetic_codec* codec, ac_bit_model* model)
+{
+    assert(codec->mode == 2); // decoder not initialized
+
+    uint32_t x = (uint32_t)(*model) * (codec->length >> BM__LengthShift);
+    uint32_t bit = (codec->value >= x);
+
+    if (bit == 0)
     {
-        x = model->distribution[data] * (codec->length >> DM__LengthShift);
-        codec->base   += x; // update interval
-        codec->length -= x; // no product needed
+        codec->length = x;
+        *model += (BM__MaxProbability - *model) >> BM__AdaptShift;
     }
-    else 
+    else
     {
-        x = model->distribution[data] * (codec->length >>= DM__LengthShift);
-        codec->base   += x; // update interval
-        codec->length  = model->distribution[data+1] * codec->length - x;
+        codec->value  -= x; // move base
+        codec->length -= x;
+        *model -= *model >> BM__AdaptShift;
     }
 
-    if (init_base > codec->base) 
-        ac_propagate_carry(codec);                 // overflow = carry
+    if (codec->length < AC__MinLength)
+        ac_renorm_dec_interval(codec);  // renormalization
 
-    if (codec->length < AC__MinLength) 
-        ac_renorm_enc_interval(codec);        // renormalization
+    return bit;
+}
 
-    ++model->symbol_count[data];
-    if (--model->symbols_until_update == 0)
-        adaptive_model_update(model, 1);
-        
+//----------------------------------------------------------------------------------------------------------------------
+void ac_encode_bit(struct arithmetic_codec* codec, uint32_t bit, ac_bit_model* model)
+{
+    AC__TRACE(codec, AC_TRACE_ENCODE_BIT, *model, bit);
+    ac__encode_bit(codec, bit, model);
+}
 
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t ac_decode_bit(struct arithmetic_codec* codec, ac_bit_model* model)
+{
+#ifdef AC_TRACE
+    uint32_t probability = *model;
+    uint32_t bit = ac__decode_bit(codec, model);
+    ac_trace_record(codec, AC_TRACE_DECODE_BIT, probability, bit);
+    return bit;
+#else
+    return ac__decode_bit(codec, model);
+#endif
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-uint32_t ac_decode_adaptive(struct arithmetic_codec* codec, struct adaptive_model* model)
+// Hashed context model
+//----------------------------------------------------------------------------------------------------------------------
+
+// one slot is 32 bytes, a bucket of two slots fits in a cache line
+struct context_hash_slot
 {
-    assert(codec->mode == 2); // decoder not initialized
-    assert(model->distribution != NULL); // adaptive model should be initialized
+    uint8_t check, hits;
+    ac_bit_model nibble[15];    // binary tree of the 16 values of a nibble
+};
 
-    uint32_t n, s, x, y = codec->length;
+struct context_hash_model
+{
+    struct context_hash_slot* slots;
+    void* memory;
+    uint32_t bucket_mask;
+    struct ac_allocator allocator;
+#ifdef AC_TRACE
+    struct ac__trace_stamp trace;
+#endif
+};
+
+#ifdef AC_TRACE
+//----------------------------------------------------------------------------------------------------------------------
+static void ac_trace_context_hash_model(struct arithmetic_codec* codec, const struct context_hash_model* model)
+{
+    if (!ac_trace_model_changed(codec, &model->trace))
+        return;
 
-    if (model->decoder_table) 
+    ac_trace_record(codec, AC_TRACE_CONTEXT_HASH_MODEL, model->trace.id,
+                    (model->bucket_mask + 1) * 2 * (uint32_t) sizeof(struct context_hash_slot));
+    if (model->trace.reset == model->trace.revision)
     {
-        // use table look-up for faster decoding
-        uint32_t dv = codec->value / (codec->length >>= DM__LengthShift);
-        uint32_t t = dv >> model->table_shift;
+        ac_trace_state(codec, NULL, 0);
+        return;
+    }
 
-        s = model->decoder_table[t];         // initial decision based on table look-up
-        n = model->decoder_table[t+1] + 1;
+    uint32_t size = context_hash_model_get_state_size(model);
+    uint8_t* state = (uint8_t*) ac__alloc(&codec->allocator, size);
+    context_hash_model_save_state(model, state);
+    ac_trace_state(codec, state, size);
+    ac__free(&codec->allocator, state);
+}
+#endif
 
-        while (n > s + 1) 
-        {                        // finish with bisection search
-            uint32_t m = (s + n) >> 1;
-            if (model->distribution[m] > dv) 
-                n = m; 
-            else s = m;
-        }
+//----------------------------------------------------------------------------------------------------------------------
+static inline uint32_t context_hash(uint32_t value)
+{
+    value *= 0x9E3779B1U;
+    value ^= value >> 15;
+    value *= 0x2C1B3C6DU;
+    value ^= value >> 12;
+    return value;
+}
 
-        // compute products
-        x = model->distribution[s] * codec->length;
-        if (s != model->last_symbol) 
-            y = model->distribution[s+1] * codec->length;
-    }
-    else 
-    {
-        // decode using only multiplications
-        x = s = 0;
-        codec->length >>= DM__LengthShift;
-        uint32_t m = (n = model->data_symbols) >> 1;
+//----------------------------------------------------------------------------------------------------------------------
+static inline void context_hash_slot_reset(struct context_hash_slot* slot, uint8_t check)
+{
+    slot->check = check;
+    slot->hits = 0;
+    for(uint32_t i=0; i<15; ++i)
+        slot->nibble[i] = AC_BIT_MODEL_INIT;
+}
 
-        // decode via bisection search
-        do 
+//----------------------------------------------------------------------------------------------------------------------
+static inline struct context_hash_slot* context_hash_find(struct context_hash_model* model, uint32_t hash)
+{
+    uint8_t check = (uint8_t)(hash >> 24);
+    struct context_hash_slot* bucket = model->slots + ((hash & model->bucket_mask) << 1);
+
+    for(uint32_t i=0; i<2; ++i)
+    {
+        if (bucket[i].check == check)
         {
-            uint32_t z = codec->length * model->distribution[m];
-            if (z > codec->value) 
-            {
-                n = m;
-                y = z;                                             // value is smaller
-            }
-            else 
-            {
-                s = m;
-                x = z;                                     // value is larger or equal
-            }
-        } while ((m = (s + n) >> 1) != s);
+            if (bucket[i].hits < 255)
+                bucket[i].hits++;
+            return &bucket[i];
+        }
     }
 
-    codec->value -= x;                                               // update interval
-    codec->length = y - x;
+    // miss: replace the least used slot, age the other one so stale contexts can be evicted later
+    uint32_t victim = (bucket[0].hits > bucket[1].hits) ? 1 : 0;
+    bucket[victim^1].hits >>= 1;
+    context_hash_slot_reset(&bucket[victim], check);
+    return &bucket[victim];
+}
 
-    if (codec->length < AC__MinLength) 
-        ac_renorm_dec_interval(codec);        // renormalization
+//----------------------------------------------------------------------------------------------------------------------
+struct context_hash_model* context_hash_model_init(uint32_t memory_size)
+{
+    return context_hash_model_init_with_allocator(memory_size, NULL);
+}
 
-    ++model->symbol_count[s];
-    if (--model->symbols_until_update == 0) 
-        adaptive_model_update(model, 0);
+//----------------------------------------------------------------------------------------------------------------------
+struct context_hash_model* context_hash_model_init_with_allocator(uint32_t memory_size, const struct ac_allocator* allocator)
+{
+    if (allocator == NULL)
+        allocator = &ac__default_allocator;
 
-    return s;
+    assert(memory_size >= 2 * sizeof(struct context_hash_slot)); // memory budget too small
+
+    uint32_t num_buckets = 1;
+    while (num_buckets * 2 * 2 * sizeof(struct context_hash_slot) <= memory_size)
+        num_buckets <<= 1;
+
+    struct context_hash_model* model = (struct context_hash_model*) ac__alloc(allocator, sizeof(struct context_hash_model));
+    model->allocator = *allocator;
+    model->bucket_mask = num_buckets - 1;
+    AC__TRACE_INIT(model);
+
+    // align slots on cache lines
+    model->memory = ac__alloc(&model->allocator, num_buckets * 2 * sizeof(struct context_hash_slot) + 63);
+    assert(model->memory != NULL); // cannot assign model memory
+    model->slots = (struct context_hash_slot*) (((uintptr_t)model->memory + 63) & ~(uintptr_t)63);
+
+    context_hash_model_reset(model);
+    return model;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-void ac_encode_static(struct arithmetic_codec* codec, uint32_t data, struct static_model* model)
+void context_hash_model_reset(struct context_hash_model* model)
 {
-    assert(codec->mode == 1);   // encoder not initialized
-    assert(data < model->data_symbols); // invalid data symbol
+    for(uint32_t i=0; i<(model->bucket_mask + 1) * 2; ++i)
+        context_hash_slot_reset(&model->slots[i], 0);
+    AC__TRACE_RESET(model);
+}
 
-    uint32_t x, init_base = codec->base;
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t context_hash_model_get_state_size(const struct context_hash_model* model)
+{
+    return sizeof(uint32_t) + (model->bucket_mask + 1) * 2 * sizeof(struct context_hash_slot);
+}
 
-    // compute products
-    if (data == model->last_symbol) 
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t context_hash_model_save_state(const struct context_hash_model* model, void* state)
+{
+    uint8_t* p = ac__write_state((uint8_t*) state, &model->bucket_mask, sizeof(uint32_t));
+    p = ac__write_state(p, model->slots, (model->bucket_mask + 1) * 2 * sizeof(struct context_hash_slot));
+    return (uint32_t)(p - (uint8_t*) state);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+int context_hash_model_load_state(struct context_hash_model* model, const void* state, uint32_t size)
+{
+    uint32_t bucket_mask;
+    if (size != context_hash_model_get_state_size(model))
+        return 0;
+
+    const uint8_t* p = ac__read_state((const uint8_t*) state, &bucket_mask, sizeof(uint32_t));
+    if (bucket_mask != model->bucket_mask)
+        return 0;
+
+    for (uint32_t i = 0; i < (model->bucket_mask + 1) * 2; ++i)
     {
-        x = model->distribution[data] * (codec->length >> DM__LengthShift);
-        codec->base   += x;  // update interval
-        codec->length -= x;  // no product needed
+        struct context_hash_slot slot;
+        memcpy(&slot, p + i * sizeof(struct context_hash_slot), sizeof(struct context_hash_slot));
+        for (uint32_t j = 0; j < 15; ++j)
+            if (!ac__valid_bit_model(slot.nibble[j]))
+                return 0;
     }
-    else 
+
+    ac__read_state(p, model->slots, (model->bucket_mask + 1) * 2 * sizeof(struct context_hash_slot));
+    AC__TRACE_CHANGE(model);
+    return 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void context_hash_model_terminate(struct context_hash_model* model)
+{
+    ac__free(&model->allocator, model->memory);
+    struct ac_allocator allocator = model->allocator;
+    ac__free(&allocator, model);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ac_encode_context_hash(struct arithmetic_codec* codec, uint32_t data, uint32_t context, struct context_hash_model* model)
+{
+    assert(data < 256); // invalid data symbol
+    AC__TRACE_MODEL(codec, context_hash, model);
+    AC__TRACE_CHANGE(model);
+    AC__TRACE_SYMBOL(codec, AC_TRACE_ENCODE_CONTEXT_HASH, model, data, context);
+
+    uint32_t hash = context_hash(context);
+    struct context_hash_slot* slot = context_hash_find(model, hash);
+    uint32_t node = 1;
+
+    for(int i=7; i>=4; --i)
     {
-        x = model->distribution[data] * (codec->length >>= DM__LengthShift);
-        codec->base   += x;                                            // update interval
-        codec->length  = model->distribution[data+1] * codec->length - x;
+        uint32_t bit = (data >> i) & 1;
+        ac__encode_bit(codec, bit, &slot->nibble[node-1]);
+        node = (node << 1) | bit;
     }
-                
-    if (init_base > codec->base) 
-        ac_propagate_carry(codec); // overflow = carry
 
-    if (codec->length < AC__MinLength)
-        ac_renorm_enc_interval(codec);        // renormalization
+    // low nibble uses the high nibble as additional context
+    slot = context_hash_find(model, context_hash(hash + node));
+    node = 1;
+
+    for(int i=3; i>=0; --i)
+    {
+        uint32_t bit = (data >> i) & 1;
+        ac__encode_bit(codec, bit, &slot->nibble[node-1]);
+        node = (node << 1) | bit;
+    }
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-uint32_t ac_decode_static(struct arithmetic_codec* codec, struct static_model* model)
+uint32_t ac_decode_context_hash(struct arithmetic_codec* codec, uint32_t context, struct context_hash_model* model)
 {
-    assert(codec->mode == 2);  // decoder not initialized
+    AC__TRACE_MODEL(codec, context_hash, model);
+    uint32_t hash = context_hash(context);
+    struct context_hash_slot* slot = context_hash_find(model, hash);
+    uint32_t node = 1;
 
-    uint32_t n, s, x, y = codec->length;
+    for(int i=0; i<4; ++i)
+        node = (node << 1) | ac__decode_bit(codec, &slot->nibble[node-1]);
+
+    uint32_t high = node;
+    slot = context_hash_find(model, context_hash(hash + high));
+    node = 1;
+
+    for(int i=0; i<4; ++i)
+        node = (node << 1) | ac__decode_bit(codec, &slot->nibble[node-1]);
+
+    uint32_t data = ((high & 15) << 4) | (node & 15);
+    AC__TRACE_CHANGE(model);
+    AC__TRACE_SYMBOL(codec, AC_TRACE_DECODE_CONTEXT_HASH, model, data, context);
+    return data;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Binary tree model
+//----------------------------------------------------------------------------------------------------------------------
+
+struct tree_node
+{
+    ac_bit_model probability;
+    uint32_t child[2];          // 0 = not allocated yet, the root is never a child
+};
+
+struct tree_model
+{
+    struct tree_node* nodes;
+    uint32_t num_nodes, capacity, max_nodes, number_of_bits;
+    ac_bit_model level[32];     // used when the pool is full
+    struct ac_allocator allocator;
+#ifdef AC_TRACE
+    struct ac__trace_stamp trace;
+#endif
+};
 
-    if (model->decoder_table) 
+#ifdef AC_TRACE
+//----------------------------------------------------------------------------------------------------------------------
+static void ac_trace_tree_model(struct arithmetic_codec* codec, const struct tree_model* model)
+{
+    if (!ac_trace_model_changed(codec, &model->trace))
+        return;
+
+    ac_trace_record(codec, AC_TRACE_TREE_MODEL, model->trace.id, model->number_of_bits);
+    ac_trace_varint(codec, model->max_nodes);
+    if (model->trace.reset == model->trace.revision)
     {
-        // use table look-up for faster decoding
-        uint32_t dv = codec->value / (codec->length >>= DM__LengthShift);
-        uint32_t t = dv >> model->table_shift;
+        ac_trace_state(codec, NULL, 0);
+        return;
+    }
 
-        // initial decision based on table look-up
-        s = model->decoder_table[t];
-        n = model->decoder_table[t+1] + 1;
+    uint32_t size = tree_model_get_state_size(model);
+    uint8_t* state = (uint8_t*) ac__alloc(&codec->allocator, size);
+    tree_model_save_state(model, state);
+    ac_trace_state(codec, state, size);
+    ac__free(&codec->allocator, state);
+}
+#endif
 
-        while (n > s + 1) 
-        {
-            // finish with bisection search
-            uint32_t m = (s + n) >> 1;
-            if (model->distribution[m] > dv) 
-                n = m; 
-            else 
-                s = m;
-        }
+//----------------------------------------------------------------------------------------------------------------------
+struct tree_model* tree_model_init(uint32_t number_of_bits, uint32_t max_nodes)
+{
+    return tree_model_init_with_allocator(number_of_bits, max_nodes, NULL);
+}
 
-        // compute products
-        x = model->distribution[s] * codec->length;
-        if (s != model->last_symbol) y = model->distribution[s+1] * codec->length;
+//----------------------------------------------------------------------------------------------------------------------
+struct tree_model* tree_model_init_with_allocator(uint32_t number_of_bits, uint32_t max_nodes,
+                                                  const struct ac_allocator* allocator)
+{
+    if (allocator == NULL)
+        allocator = &ac__default_allocator;
+
+    assert(number_of_bits > 0 && number_of_bits <= 32); // invalid number of bits
+    assert(max_nodes > 0);
+
+    struct tree_model* model = (struct tree_model*) ac__alloc(allocator, sizeof(struct tree_model));
+    model->allocator = *allocator;
+    model->number_of_bits = number_of_bits;
+    model->max_nodes = max_nodes;
+    AC__TRACE_INIT(model);
+    model->capacity = (max_nodes < 1024) ? max_nodes : 1024;
+    model->nodes = (struct tree_node*) ac__alloc(&model->allocator, model->capacity * sizeof(struct tree_node));
+    assert(model->nodes != NULL); // cannot assign model memory
+
+    tree_model_reset(model);
+    return model;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void tree_model_reset(struct tree_model* model)
+{
+    model->num_nodes = 1;
+    model->nodes[0].probability = AC_BIT_MODEL_INIT;
+    model->nodes[0].child[0] = model->nodes[0].child[1] = 0;
+
+    for (uint32_t i = 0; i < 32; ++i)
+        model->level[i] = AC_BIT_MODEL_INIT;
+    AC__TRACE_RESET(model);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Nodes are stored field by field, without the padding of struct tree_node
+#define TM__NodeStateSize (sizeof(ac_bit_model) + 2 * sizeof(uint32_t))
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t tree_model_get_state_size(const struct tree_model* model)
+{
+    return (uint32_t)(3 * sizeof(uint32_t) + sizeof(model->level) + model->num_nodes * TM__NodeStateSize);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t tree_model_save_state(const struct tree_model* model, void* state)
+{
+    const uint32_t header[3] = {model->number_of_bits, model->max_nodes, model->num_nodes};
+
+    uint8_t* p = ac__write_state((uint8_t*) state, header, sizeof(header));
+    p = ac__write_state(p, model->level, sizeof(model->level));
+    for (uint32_t i = 0; i < model->num_nodes; ++i)
+    {
+        p = ac__write_state(p, &model->nodes[i].probability, sizeof(ac_bit_model));
+        p = ac__write_state(p, model->nodes[i].child, 2 * sizeof(uint32_t));
     }
-    else 
+    return (uint32_t)(p - (uint8_t*) state);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+int tree_model_load_state(struct tree_model* model, const void* state, uint32_t size)
+{
+    uint32_t header[3];
+    ac_bit_model level[32];
+    if (size < sizeof(header) + sizeof(level))
+        return 0;
+
+    const uint8_t* p = ac__read_state((const uint8_t*) state, header, sizeof(header));
+    if (header[0] != model->number_of_bits || header[1] != model->max_nodes || header[2] == 0 ||
+        header[2] > model->max_nodes || size != sizeof(header) + sizeof(level) + header[2] * TM__NodeStateSize)
+        return 0;
+
+    // the nodes are checked before the model is changed: children are in the pool, the root is never a child
+    p = ac__read_state(p, level, sizeof(level));
+    for (uint32_t i = 0; i < 32; ++i)
+        if (!ac__valid_bit_model(level[i]))
+            return 0;
+    for (uint32_t i = 0; i < header[2]; ++i)
     {
-        // decode using only multiplications
-        x = s = 0;
-        codec->length >>= DM__LengthShift;
-        uint32_t m = (n = model->data_symbols) >> 1;
+        struct tree_node node;
+        const uint8_t* q = ac__read_state(p + i * TM__NodeStateSize, &node.probability, sizeof(ac_bit_model));
+        ac__read_state(q, node.child, 2 * sizeof(uint32_t));
+        if (!ac__valid_bit_model(node.probability) || node.child[0] >= header[2] || node.child[1] >= header[2])
+            return 0;
+    }
 
-        // decode via bisection search
-        do 
-        {
-            uint32_t z = codec->length * model->distribution[m];
-            if (z > codec->value) 
-            {
-                n = m;
-                y = z;  // value is smaller
-            }
-            else 
-            {
-                s = m;
-                x = z; // value is larger or equal
-            }
-        } while ((m = (s + n) >> 1) != s);
+    if (header[2] > model->capacity)
+    {
+        ac__free(&model->allocator, model->nodes);
+        model->capacity = header[2];
+        model->nodes = (struct tree_node*) ac__alloc(&model->allocator, model->capacity * sizeof(struct tree_node));
+        assert(model->nodes != NULL); // cannot assign model memory
     }
 
-    // update interval
-    codec->value -= x;
-    codec->length = y - x;
+    model->num_nodes = header[2];
+    memcpy(model->level, level, sizeof(level));
+    for (uint32_t i = 0; i < model->num_nodes; ++i)
+    {
+        p = ac__read_state(p, &model->nodes[i].probability, sizeof(ac_bit_model));
+        p = ac__read_state(p, model->nodes[i].child, 2 * sizeof(uint32_t));
+    }
+    AC__TRACE_CHANGE(model);
+    return 1;
+}
 
-    if (codec->length < AC__MinLength) 
-        ac_renorm_dec_interval(codec);        // renormalization
+//----------------------------------------------------------------------------------------------------------------------
+void tree_model_terminate(struct tree_model* model)
+{
+    ac__free(&model->allocator, model->nodes);
+    struct ac_allocator allocator = model->allocator;
+    ac__free(&allocator, model);
+}
 
-    return s;
+//----------------------------------------------------------------------------------------------------------------------
+// Returns the index of the child node, allocates it if needed. Returns 0 if the pool is full
+static inline uint32_t tree_model_child(struct tree_model* model, uint32_t node, uint32_t bit)
+{
+    uint32_t child = model->nodes[node].child[bit];
+    if (child != 0 || model->num_nodes == model->max_nodes)
+        return child;
+
+    // grow the pool, nodes are referenced by index so they can move
+    if (model->num_nodes == model->capacity)
+    {
+        uint32_t capacity = (model->capacity > model->max_nodes / 2) ? model->max_nodes : model->capacity * 2;
+        struct tree_node* nodes = (struct tree_node*) ac__alloc(&model->allocator, capacity * sizeof(struct tree_node));
+        assert(nodes != NULL); // cannot assign model memory
+        for (uint32_t i = 0; i < model->num_nodes; ++i)
+            nodes[i] = model->nodes[i];
+        ac__free(&model->allocator, model->nodes);
+        model->nodes = nodes;
+        model->capacity = capacity;
+    }
+
+    child = model->num_nodes++;
+    model->nodes[child].probability = AC_BIT_MODEL_INIT;
+    model->nodes[child].child[0] = model->nodes[child].child[1] = 0;
+    model->nodes[node].child[bit] = child;
+    return child;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-uint8_t* ac_get_buffer(struct arithmetic_codec* codec)
+void ac_encode_tree(struct arithmetic_codec* codec, uint32_t data, struct tree_model* model)
 {
-    return codec->code_buffer;
+    assert(model->number_of_bits == 32 || data < (1U << model->number_of_bits)); // invalid data symbol
+    AC__TRACE_MODEL(codec, tree, model);
+    AC__TRACE_CHANGE(model);
+    AC__TRACE_SYMBOL(codec, AC_TRACE_ENCODE_TREE, model, data, 0);
+
+    uint32_t node = 0;
+    for (uint32_t i = model->number_of_bits; i-- > 0; )
+    {
+        uint32_t bit = (data >> i) & 1;
+        uint32_t depth = model->number_of_bits - 1 - i;
+
+        if (depth == 0 || node != 0)
+        {
+            ac__encode_bit(codec, bit, &model->nodes[node].probability);
+            if (i != 0)
+                node = tree_model_child(model, node, bit);
+        }
+        else
+            ac__encode_bit(codec, bit, &model->level[depth]);
+    }
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-void ac_terminate(struct arithmetic_codec* codec)
+uint32_t ac_decode_tree(struct arithmetic_codec* codec, struct tree_model* model)
 {
-    AC_FREE(codec->new_buffer);
+    AC__TRACE_MODEL(codec, tree, model);
+    uint32_t node = 0, data = 0;
+    for (uint32_t i = model->number_of_bits; i-- > 0; )
+    {
+        uint32_t bit, depth = model->number_of_bits - 1 - i;
+
+        if (depth == 0 || node != 0)
+        {
+            bit = ac__decode_bit(codec, &model->nodes[node].probability);
+            if (i != 0)
+                node = tree_model_child(model, node, bit);
+        }
+        else
+            bit = ac__decode_bit(codec, &model->level[depth]);
+
+        data = (data << 1) | bit;
+    }
+
+    AC__TRACE_CHANGE(model);
+    AC__TRACE_SYMBOL(codec, AC_TRACE_DECODE_TREE, model, data, 0);
+    return data;
 }
 
 #endif // __ARITHMETIC_CODEC__IMPLEMENTATION__
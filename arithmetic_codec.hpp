@@ -0,0 +1,199 @@
+#ifndef __ARITHMETIC_CODEC_HPP__
+#define __ARITHMETIC_CODEC_HPP__
+
+// C++20 interface over the decoder of arithmetic_codec.h
+//
+//  * ac::decode_adaptive() / ac::decode_static() return a lazy generator of symbols, usable in a range-for loop.
+//    Symbols are decoded one at a time as the loop advances, the loop can stop at any time.
+//
+//  * ac::async_decoder decodes from input pushed with feed() as it arrives. Decoding a symbol is awaited in a
+//    coroutine, which suspends when the decoder could run out of input and is resumed by the next feed().
+//    The input is not copied, it is read in place as segments (see ac_start_segment_decoder()).
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iterator>
+#include <utility>
+#include <vector>
+#include "arithmetic_codec.h"
+
+namespace ac
+{
+
+//----------------------------------------------------------------------------------------------------------------------
+// Lazy sequence of values produced by a coroutine with co_yield
+template <class T>
+class generator
+{
+public:
+    struct promise_type
+    {
+        T value;
+
+        generator get_return_object() {return generator(std::coroutine_handle<promise_type>::from_promise(*this));}
+        std::suspend_always initial_suspend() noexcept {return {};}
+        std::suspend_always final_suspend() noexcept {return {};}
+        std::suspend_always yield_value(T v) noexcept {value = v; return {};}
+        void return_void() noexcept {}
+        void unhandled_exception() {std::terminate();}
+    };
+
+    struct iterator
+    {
+        using iterator_category = std::input_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using value_type = T;
+
+        std::coroutine_handle<promise_type> handle;
+
+        const T& operator*() const {return handle.promise().value;}
+        iterator& operator++() {handle.resume(); return *this;}
+        void operator++(int) {handle.resume();}
+        bool operator==(std::default_sentinel_t) const {return handle.done();}
+    };
+
+    generator(generator&& other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+    generator(const generator&) = delete;
+    generator& operator=(const generator&) = delete;
+    ~generator() {if (m_handle) m_handle.destroy();}
+
+    iterator begin() {m_handle.resume(); return iterator{m_handle};}
+    std::default_sentinel_t end() const noexcept {return {};}
+
+private:
+    explicit generator(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// Decode count symbols, the codec must be in decoding mode
+inline generator<uint32_t> decode_adaptive(arithmetic_codec* codec, adaptive_model* model, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        co_yield ac_decode_adaptive(codec, model);
+}
+
+inline generator<uint32_t> decode_static(arithmetic_codec* codec, static_model* model, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        co_yield ac_decode_static(codec, model);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Coroutine started immediately, which can be suspended by co_await
+class task
+{
+public:
+    struct promise_type
+    {
+        task get_return_object() {return task(std::coroutine_handle<promise_type>::from_promise(*this));}
+        std::suspend_never initial_suspend() noexcept {return {};}
+        std::suspend_always final_suspend() noexcept {return {};}
+        void return_void() noexcept {}
+        void unhandled_exception() {std::terminate();}
+    };
+
+    task(task&& other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+    ~task() {if (m_handle) m_handle.destroy();}
+
+    bool done() const {return m_handle.done();}
+
+private:
+    explicit task(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// Decoder fed with input as it arrives, one coroutine at a time can wait on it
+//
+//      ac::task parse(ac::async_decoder& decoder, adaptive_model* model)
+//      {
+//          uint32_t symbol = co_await decoder.decode_adaptive(model);
+//          ...
+//      }
+//
+// The codec stays in decoding mode until the async_decoder is destroyed
+class async_decoder
+{
+public:
+    explicit async_decoder(arithmetic_codec* codec) : m_codec(codec) {}
+    async_decoder(const async_decoder&) = delete;
+    async_decoder& operator=(const async_decoder&) = delete;
+    ~async_decoder() {if (m_started) ac_stop_decoder(m_codec);}
+
+    // Push input, the data must stay valid until it has been decoded. Resumes the waiting coroutine if any
+    void feed(const void* data, size_t size)
+    {
+        if (size == 0)
+            return;
+
+        ac_chunk segment = {const_cast<void*>(data), size};
+        if (m_started)
+            ac_append_segments(m_codec, &segment, 1);
+        else
+        {
+            m_pending.push_back(segment);
+            m_pending_bytes += size;
+        }
+        resume();
+    }
+
+    // No more input, the end of the stream is read as zeros
+    void finish()
+    {
+        m_finished = true;
+        resume();
+    }
+
+    template <class Model, uint32_t (*Decode)(arithmetic_codec*, Model*)>
+    struct awaitable
+    {
+        async_decoder& decoder;
+        Model* model;
+
+        bool await_ready() {return decoder.ready();}
+        void await_suspend(std::coroutine_handle<> handle) {decoder.m_waiting = handle;}
+        uint32_t await_resume() {return Decode(decoder.m_codec, model);}
+    };
+
+    awaitable<adaptive_model, ac_decode_adaptive> decode_adaptive(adaptive_model* model) {return {*this, model};}
+    awaitable<static_model, ac_decode_static> decode_static(static_model* model) {return {*this, model};}
+    awaitable<ac_bit_model, ac_decode_bit> decode_bit(ac_bit_model* model) {return {*this, model};}
+
+private:
+    // Returns true if a symbol can be decoded without running out of input
+    bool ready()
+    {
+        if (!m_started)
+        {
+            if (m_pending_bytes < 4 && !m_finished)
+                return false;
+
+            // until the next append, the codec reads the segment descriptors from m_pending
+            ac_start_segment_decoder(m_codec, m_pending.data(), (uint32_t) m_pending.size());
+            m_started = true;
+        }
+        return m_finished || ac_get_segment_bytes_left(m_codec) >= AC_MAX_SYMBOL_BYTES;
+    }
+
+    void resume()
+    {
+        if (m_waiting && ready())
+            std::exchange(m_waiting, nullptr).resume();
+    }
+
+    arithmetic_codec* m_codec;
+    std::vector<ac_chunk> m_pending;
+    size_t m_pending_bytes = 0;
+    std::coroutine_handle<> m_waiting;
+    bool m_started = false;
+    bool m_finished = false;
+};
+
+} // namespace ac
+
+#endif
@@ -0,0 +1,346 @@
+#ifndef __BINARY_CODEC__
+#define __BINARY_CODEC__
+
+// Multiplication-free binary arithmetic codec in the style of the M-coder (CABAC of H.264/HEVC)
+//
+// The range is kept on 9 bits, the width of the least probable symbol is read from a table indexed by the quantized
+// range and the probability state of the context, and renormalization is a single count-leading-zeros. It trades a
+// little compression against the multiply-based bit models of arithmetic_codec.h for more bins per second, which
+// matters for formats with many binary decisions per symbol.
+//
+// Put those lines in a c/cpp file:
+//      #define __BINARY_CODEC__IMPLEMENTATION__
+//      #include "binary_codec.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+struct binary_codec;
+
+// A context is a probability state (6 bits) and the most probable bit (1 bit). It can be embedded in any user structure
+typedef uint8_t bc_context;
+
+// Initial state of a context (probability of 0.5)
+#define BC_CONTEXT_INIT (0)
+
+// Allocate a binary codec
+struct binary_codec* bc_init(void);
+
+// Start the encoder, the compressed data is written in the user buffer
+void bc_start_encoder(struct binary_codec* codec, uint8_t* buffer, uint32_t size);
+
+// Stop the encoder, returns the size of the compressed data in bytes
+uint32_t bc_stop_encoder(struct binary_codec* codec);
+
+// Start the decoder on a compressed buffer. Bytes past the end of the buffer are read as zeros
+void bc_start_decoder(struct binary_codec* codec, const uint8_t* buffer, uint32_t size);
+
+// Stop the decoder
+void bc_stop_decoder(struct binary_codec* codec);
+
+// Encode a bit with an adaptive context, the context is updated
+void bc_encode_bit(struct binary_codec* codec, uint32_t bit, bc_context* context);
+
+// Decode a bit with an adaptive context, the context is updated
+uint32_t bc_decode_bit(struct binary_codec* codec, bc_context* context);
+
+// Encode a bit with a fixed probability of 0.5
+void bc_encode_bypass(struct binary_codec* codec, uint32_t bit);
+
+// Decode a bit with a fixed probability of 0.5
+uint32_t bc_decode_bypass(struct binary_codec* codec);
+
+// Release memory
+void bc_terminate(struct binary_codec* codec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __BINARY_CODEC__
+
+
+//----------------------------------------------------------------------------------------------------------------------
+// Implementation
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifdef __BINARY_CODEC__IMPLEMENTATION__
+
+#include <assert.h>
+
+#if !defined(BC_FREE) && !defined(BC_ALLOC)
+#include <stdlib.h>
+#define BC_FREE(a) free(a)
+#define BC_ALLOC(a) malloc(a)
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+static inline uint32_t bc__clz(uint32_t x) {unsigned long index; _BitScanReverse(&index, x); return 31 - index;}
+#else
+static inline uint32_t bc__clz(uint32_t x) {return (uint32_t) __builtin_clz(x);}
+#endif
+
+//-- constants ---------------------------------------------------------------------------------------------------------
+#define BC__MinDecoderBits (6)              // largest renormalization shift, the range is kept in [256;510]
+
+// Width of the least probable symbol, indexed by state and by bits 6-7 of the range
+static const uint8_t bc__range_lps[64][4] =
+{
+    {128,176,208,240}, {128,167,197,227}, {128,158,187,216}, {123,150,178,205}, {116,142,169,195}, {111,135,160,185},
+    {105,128,152,175}, {100,122,144,166}, { 95,116,137,158}, { 90,110,130,150}, { 85,104,123,142}, { 81, 99,117,135},
+    { 77, 94,111,128}, { 73, 89,105,122}, { 69, 85,100,116}, { 66, 80, 95,110}, { 62, 76, 90,104}, { 59, 72, 86, 99},
+    { 56, 69, 81, 94}, { 53, 65, 77, 89}, { 51, 62, 73, 85}, { 48, 59, 69, 80}, { 46, 56, 66, 76}, { 43, 53, 63, 72},
+    { 41, 50, 59, 69}, { 39, 48, 56, 65}, { 37, 45, 54, 62}, { 35, 43, 51, 59}, { 33, 41, 48, 56}, { 32, 39, 46, 53},
+    { 30, 37, 43, 50}, { 29, 35, 41, 48}, { 27, 33, 39, 45}, { 26, 31, 37, 43}, { 24, 30, 35, 41}, { 23, 28, 33, 39},
+    { 22, 27, 32, 37}, { 21, 26, 30, 35}, { 20, 24, 29, 33}, { 19, 23, 27, 31}, { 18, 22, 26, 30}, { 17, 21, 25, 28},
+    { 16, 20, 23, 27}, { 15, 19, 22, 25}, { 14, 18, 21, 24}, { 14, 17, 20, 23}, { 13, 16, 19, 22}, { 12, 15, 18, 21},
+    { 12, 14, 17, 20}, { 11, 14, 16, 19}, { 11, 13, 15, 18}, { 10, 12, 15, 17}, { 10, 12, 14, 16}, {  9, 11, 13, 15},
+    {  9, 11, 12, 14}, {  8, 10, 12, 14}, {  8,  9, 11, 13}, {  7,  9, 11, 12}, {  7,  9, 10, 12}, {  7,  8, 10, 11},
+    {  6,  8,  9, 11}, {  6,  7,  9, 10}, {  6,  7,  8,  9}, {  2,  2,  2,  2}
+};
+
+// Next context (state and most probable bit) after coding a bit, the transitions of CABAC: the state grows by one
+// after a most probable bit (up to 62) and drops after a least probable one, the most probable bit flips in state 0
+static const uint8_t bc__transition[128][2] =
+{
+    {  2,  1}, {  0,  3}, {  4,  0}, {  1,  5}, {  6,  2}, {  3,  7}, {  8,  4}, {  5,  9},
+    { 10,  4}, {  5, 11}, { 12,  8}, {  9, 13}, { 14,  8}, {  9, 15}, { 16, 10}, { 11, 17},
+    { 18, 12}, { 13, 19}, { 20, 14}, { 15, 21}, { 22, 16}, { 17, 23}, { 24, 18}, { 19, 25},
+    { 26, 18}, { 19, 27}, { 28, 22}, { 23, 29}, { 30, 22}, { 23, 31}, { 32, 24}, { 25, 33},
+    { 34, 26}, { 27, 35}, { 36, 26}, { 27, 37}, { 38, 30}, { 31, 39}, { 40, 30}, { 31, 41},
+    { 42, 32}, { 33, 43}, { 44, 32}, { 33, 45}, { 46, 36}, { 37, 47}, { 48, 36}, { 37, 49},
+    { 50, 38}, { 39, 51}, { 52, 38}, { 39, 53}, { 54, 42}, { 43, 55}, { 56, 42}, { 43, 57},
+    { 58, 44}, { 45, 59}, { 60, 44}, { 45, 61}, { 62, 46}, { 47, 63}, { 64, 48}, { 49, 65},
+    { 66, 48}, { 49, 67}, { 68, 50}, { 51, 69}, { 70, 52}, { 53, 71}, { 72, 52}, { 53, 73},
+    { 74, 54}, { 55, 75}, { 76, 54}, { 55, 77}, { 78, 56}, { 57, 79}, { 80, 58}, { 59, 81},
+    { 82, 58}, { 59, 83}, { 84, 60}, { 61, 85}, { 86, 60}, { 61, 87}, { 88, 60}, { 61, 89},
+    { 90, 62}, { 63, 91}, { 92, 64}, { 65, 93}, { 94, 64}, { 65, 95}, { 96, 66}, { 67, 97},
+    { 98, 66}, { 67, 99}, {100, 66}, { 67,101}, {102, 68}, { 69,103}, {104, 68}, { 69,105},
+    {106, 70}, { 71,107}, {108, 70}, { 71,109}, {110, 70}, { 71,111}, {112, 72}, { 73,113},
+    {114, 72}, { 73,115}, {116, 72}, { 73,117}, {118, 74}, { 75,119}, {120, 74}, { 75,121},
+    {122, 74}, { 75,123}, {124, 76}, { 77,125}, {124, 76}, { 77,125}, {126,126}, {127,127}
+};
+
+struct binary_codec
+{
+    uint8_t *code_buffer, *ac_pointer, *end_buffer;
+    const uint8_t *read_pointer, *read_end;
+    uint32_t low, range;        // encoder: low has 10 fractional bits, range 9 bits
+    int32_t queue;              // encoder: bits of low ready to be output minus 8
+    uint32_t outstanding;       // encoder: 0xff bytes waiting for a possible carry
+    uint32_t value, bits;       // decoder: offset and number of bits below the 9-bit window
+    uint32_t mode;              // 0 = undef, 1 = encoder, 2 = decoder
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+struct binary_codec* bc_init(void)
+{
+    struct binary_codec* codec = (struct binary_codec*) BC_ALLOC(sizeof(struct binary_codec));
+    assert(codec != NULL);
+    codec->mode = 0;
+    return codec;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void bc_start_encoder(struct binary_codec* codec, uint8_t* buffer, uint32_t size)
+{
+    assert(codec->mode == 0); // cannot start encoder
+    assert(buffer != NULL && size > 0);
+
+    codec->mode = 1;
+    codec->code_buffer = codec->ac_pointer = buffer;
+    codec->end_buffer = buffer + size;
+    codec->low = 0;
+    codec->range = 510;
+    codec->queue = -9;
+    codec->outstanding = 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Output the top byte of low once 8 bits are ready. Bytes of 0xff are held back until we know if a carry reaches them
+static inline void bc__put_byte(struct binary_codec* codec)
+{
+    if (codec->queue < 0)
+        return;
+
+    uint32_t out = codec->low >> (codec->queue + 10);
+    codec->low &= (0x400U << codec->queue) - 1;
+    codec->queue -= 8;
+
+    if ((out & 0xff) == 0xff)
+    {
+        codec->outstanding++;
+        return;
+    }
+
+    uint32_t carry = out >> 8;
+    assert(codec->ac_pointer + codec->outstanding < codec->end_buffer); // code buffer overflow
+
+    // the interval never exceeds the initial one, so there is no carry before the first byte
+    if (carry)
+        codec->ac_pointer[-1]++;
+
+    for (; codec->outstanding > 0; codec->outstanding--)
+        *codec->ac_pointer++ = (uint8_t) (carry - 1);
+
+    *codec->ac_pointer++ = (uint8_t) out;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t bc_stop_encoder(struct binary_codec* codec)
+{
+    assert(codec->mode == 1); // invalid to stop encoder
+
+    // low is inside the final interval: output all its bits, the decoder reads zeros after
+    for (int i = 0; i < 3; ++i)
+    {
+        codec->low <<= 8;
+        codec->queue += 8;
+        bc__put_byte(codec);
+    }
+
+    assert(codec->ac_pointer + codec->outstanding <= codec->end_buffer); // code buffer overflow
+    for (; codec->outstanding > 0; codec->outstanding--)
+        *codec->ac_pointer++ = 0xff;
+
+    // trailing zeros are implicit
+    while (codec->ac_pointer > codec->code_buffer && codec->ac_pointer[-1] == 0)
+        codec->ac_pointer--;
+
+    codec->mode = 0;
+    return (uint32_t) (codec->ac_pointer - codec->code_buffer);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static inline void bc__refill(struct binary_codec* codec)
+{
+    while (codec->bits < 16)
+    {
+        uint32_t byte = (codec->read_pointer < codec->read_end) ? *codec->read_pointer++ : 0;
+        codec->value = (codec->value << 8) | byte;
+        codec->bits += 8;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void bc_start_decoder(struct binary_codec* codec, const uint8_t* buffer, uint32_t size)
+{
+    assert(codec->mode == 0); // cannot start decoder
+
+    codec->mode = 2;
+    codec->read_pointer = buffer;
+    codec->read_end = buffer + size;
+    codec->range = 510;
+
+    // the window starts with the first 9 bits of the stream
+    codec->value = 0;
+    codec->bits = 0;
+    bc__refill(codec);
+    codec->bits -= 9;
+    bc__refill(codec);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void bc_stop_decoder(struct binary_codec* codec)
+{
+    assert(codec->mode == 2); // invalid to stop decoder
+    codec->mode = 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void bc_encode_bit(struct binary_codec* codec, uint32_t bit, bc_context* context)
+{
+    assert(codec->mode == 1); // encoder not initialized
+
+    // work on locals: partial stores of the codec would stall the next loads
+    uint32_t range = codec->range, low = codec->low;
+    uint32_t range_lps = bc__range_lps[*context >> 1][(range >> 6) & 3];
+    uint32_t lps_mask = 0 - (bit ^ (*context & 1));
+
+    // least probable bit: the top part of the interval, no branch
+    range -= range_lps;
+    low += range & lps_mask;
+    range ^= (range ^ range_lps) & lps_mask;
+    *context = bc__transition[*context][bit];
+
+    // renormalization
+    uint32_t shift = bc__clz(range) - 23;
+    codec->range = range << shift;
+    codec->low = low << shift;
+    codec->queue += (int32_t) shift;
+    bc__put_byte(codec);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t bc_decode_bit(struct binary_codec* codec, bc_context* context)
+{
+    assert(codec->mode == 2); // decoder not initialized
+
+    // work on locals: partial stores of the codec would stall the next loads
+    uint32_t range = codec->range, bits = codec->bits, value = codec->value;
+    uint32_t range_lps = bc__range_lps[*context >> 1][(range >> 6) & 3];
+
+    range -= range_lps;
+    uint32_t scaled_range = range << bits, bit = *context & 1;
+
+    // least probable bit: the top part of the interval. A branch, the decoder can speculate on the likely bit
+    if (value >= scaled_range)
+    {
+        codec->value = value - scaled_range;
+        range = range_lps;
+        bit ^= 1;
+    }
+    *context = bc__transition[*context][bit];
+
+    // renormalization: the window moves down, value is unchanged
+    uint32_t shift = bc__clz(range) - 23;
+    codec->range = range << shift;
+    codec->bits = bits - shift;
+    if (codec->bits < BC__MinDecoderBits)
+        bc__refill(codec);
+
+    return bit;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void bc_encode_bypass(struct binary_codec* codec, uint32_t bit)
+{
+    assert(codec->mode == 1); // encoder not initialized
+
+    codec->low <<= 1;
+    if (bit)
+        codec->low += codec->range;
+    codec->queue++;
+    bc__put_byte(codec);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t bc_decode_bypass(struct binary_codec* codec)
+{
+    assert(codec->mode == 2); // decoder not initialized
+
+    codec->bits--;
+    uint32_t scaled_range = codec->range << codec->bits, bit = 0;
+    if (codec->value >= scaled_range)
+    {
+        codec->value -= scaled_range;
+        bit = 1;
+    }
+
+    if (codec->bits < BC__MinDecoderBits)
+        bc__refill(codec);
+
+    return bit;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void bc_terminate(struct binary_codec* codec)
+{
+    BC_FREE(codec);
+}
+
+#endif // __BINARY_CODEC__IMPLEMENTATION__
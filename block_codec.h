@@ -0,0 +1,288 @@
+#ifndef __BLOCK_CODEC__
+#define __BLOCK_CODEC__
+
+// Block mode shared by the byte compressors (lz_codec.h, bwt_codec.h): the input is split in blocks compressed
+// independently, in parallel on several threads, and stored in a container with the size of each block.
+//
+// Only included by the implementation of a compressor, which describes itself with a struct block_codec.
+// Define BLOCK_NO_THREADS to run the blocks on the calling thread.
+//
+// Layout: decompressed size, block size, number of blocks, compressed size of each block, then the blocks.
+// All fields are 32 bits little endian
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef BLOCK_NO_THREADS
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#endif
+
+struct block_codec
+{
+    // a codec per thread, created from params
+    void* (*init)(const void* params);
+    void (*terminate)(void* codec);
+
+    // same contract as lz_compress() / lz_decompress()
+    uint32_t (*compress)(void* codec, const uint8_t* input, uint32_t size, uint8_t* output, uint32_t capacity);
+    uint32_t (*decompress)(void* codec, const uint8_t* input, uint32_t size, uint8_t* output, uint32_t capacity);
+    uint32_t (*compress_bound)(uint32_t size);
+
+    // memory of the container and the jobs
+    void* (*alloc)(size_t size);
+    void (*free)(void* pointer);
+
+    const void* params;
+};
+
+struct block__job
+{
+    const struct block_codec* desc;
+    const uint8_t* input;
+    uint8_t* output;
+    uint32_t *input_offsets, *output_offsets, *result;
+    uint32_t num_blocks, num_threads, thread_index;
+    uint32_t block_size, size, compress;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+static inline void block__write32(uint8_t* p, uint32_t value)
+{
+    p[0] = (uint8_t) value; p[1] = (uint8_t)(value >> 8); p[2] = (uint8_t)(value >> 16); p[3] = (uint8_t)(value >> 24);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static inline uint32_t block__read32(const uint8_t* p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static inline uint32_t block__num_blocks(uint32_t size, uint32_t block_size)
+{
+    return (uint32_t)(((uint64_t) size + block_size - 1) / block_size);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Blocks are assigned to threads round-robin, each thread creates its own codec
+static void block__run_job(struct block__job* job)
+{
+    void* codec = job->desc->init(job->desc->params);
+    for (uint32_t i = job->thread_index; i < job->num_blocks; i += job->num_threads)
+    {
+        uint32_t size = (i == job->num_blocks - 1) ? job->size - i * job->block_size : job->block_size;
+        if (job->compress)
+            job->result[i] = job->desc->compress(codec, job->input + (size_t) i * job->block_size, size,
+                                                 job->output + job->output_offsets[i], job->desc->compress_bound(size));
+        else
+            job->result[i] = job->desc->decompress(codec, job->input + job->input_offsets[i],
+                                                   job->input_offsets[i + 1] - job->input_offsets[i],
+                                                   job->output + (size_t) i * job->block_size, size) == size;
+    }
+    job->desc->terminate(codec);
+}
+
+#ifndef BLOCK_NO_THREADS
+#if defined(_WIN32)
+static DWORD WINAPI block__thread_entry(LPVOID job) {block__run_job((struct block__job*) job); return 0;}
+#else
+static void* block__thread_entry(void* job) {block__run_job((struct block__job*) job); return NULL;}
+#endif
+#endif
+
+//----------------------------------------------------------------------------------------------------------------------
+// Run the job on num_threads threads, the calling thread takes the first share
+static void block__run_threads(struct block__job* job, uint32_t num_threads)
+{
+    const struct block_codec* desc = job->desc;
+    if (num_threads > job->num_blocks)
+        num_threads = job->num_blocks;
+    if (num_threads == 0)
+        num_threads = 1;
+
+#ifdef BLOCK_NO_THREADS
+    num_threads = 1;
+#endif
+
+    struct block__job* jobs = (struct block__job*) desc->alloc(num_threads * sizeof(struct block__job));
+    for (uint32_t t = 0; t < num_threads; ++t)
+    {
+        jobs[t] = *job;
+        jobs[t].num_threads = num_threads;
+        jobs[t].thread_index = t;
+    }
+
+#ifndef BLOCK_NO_THREADS
+    // a job whose thread cannot be created runs on the calling thread
+#if defined(_WIN32)
+    HANDLE* threads = (HANDLE*) desc->alloc(num_threads * sizeof(HANDLE));
+    for (uint32_t t = 1; t < num_threads; ++t)
+    {
+        threads[t] = CreateThread(NULL, 0, block__thread_entry, &jobs[t], 0, NULL);
+        if (threads[t] == NULL)
+            block__run_job(&jobs[t]);
+    }
+    block__run_job(&jobs[0]);
+    for (uint32_t t = 1; t < num_threads; ++t)
+    {
+        if (threads[t] == NULL)
+            continue;
+        WaitForSingleObject(threads[t], INFINITE);
+        CloseHandle(threads[t]);
+    }
+#else
+    pthread_t* threads = (pthread_t*) desc->alloc(num_threads * (sizeof(pthread_t) + 1));
+    uint8_t* started = (uint8_t*)(threads + num_threads);
+    for (uint32_t t = 1; t < num_threads; ++t)
+    {
+        started[t] = pthread_create(&threads[t], NULL, block__thread_entry, &jobs[t]) == 0;
+        if (!started[t])
+            block__run_job(&jobs[t]);
+    }
+    block__run_job(&jobs[0]);
+    for (uint32_t t = 1; t < num_threads; ++t)
+        if (started[t])
+            pthread_join(threads[t], NULL);
+#endif
+    desc->free(threads);
+#else
+    block__run_job(&jobs[0]);
+#endif
+
+    desc->free(jobs);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static uint32_t block__bound(const struct block_codec* desc, uint32_t size, uint32_t block_size)
+{
+    uint32_t num_blocks = block__num_blocks(size, block_size);
+    if (num_blocks == 0)
+        return 12;
+
+    uint32_t last = size - (num_blocks - 1) * block_size;
+    return 12 + num_blocks * 4 + (num_blocks - 1) * desc->compress_bound(block_size) + desc->compress_bound(last);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static uint32_t block__compress(const struct block_codec* desc, const uint8_t* input, uint32_t size, uint8_t* output,
+                                uint32_t capacity, uint32_t block_size, uint32_t num_threads)
+{
+    assert(block_size > 0);
+    uint32_t num_blocks = block__num_blocks(size, block_size);
+    if (capacity < 12 + num_blocks * 4)
+        return 0;
+
+    // blocks are compressed at their worst case offset in a scratch buffer, then packed
+    uint32_t* offsets = (uint32_t*) desc->alloc((num_blocks + 1) * 2 * sizeof(uint32_t));
+    uint32_t* sizes = offsets + num_blocks + 1;
+    offsets[0] = 0;
+    for (uint32_t i = 0; i < num_blocks; ++i)
+    {
+        uint32_t block = (i == num_blocks - 1) ? size - i * block_size : block_size;
+        offsets[i + 1] = offsets[i] + desc->compress_bound(block);
+    }
+    uint8_t* scratch = (uint8_t*) desc->alloc(offsets[num_blocks] + 1);
+
+    struct block__job job;
+    memset(&job, 0, sizeof(job));
+    job.desc = desc;
+    job.input = input;
+    job.output = scratch;
+    job.output_offsets = offsets;
+    job.result = sizes;
+    job.num_blocks = num_blocks;
+    job.block_size = block_size;
+    job.size = size;
+    job.compress = 1;
+    block__run_threads(&job, num_threads);
+
+    uint32_t header_size = 12 + num_blocks * 4, total = header_size;
+    for (uint32_t i = 0; i < num_blocks; ++i)
+        total += sizes[i];
+
+    if (total <= capacity)
+    {
+        block__write32(output, size);
+        block__write32(output + 4, block_size);
+        block__write32(output + 8, num_blocks);
+        uint8_t* p = output + header_size;
+        for (uint32_t i = 0; i < num_blocks; ++i)
+        {
+            block__write32(output + 12 + i * 4, sizes[i]);
+            memcpy(p, scratch + offsets[i], sizes[i]);
+            p += sizes[i];
+        }
+    }
+    else
+        total = 0;
+
+    desc->free(scratch);
+    desc->free(offsets);
+    return total;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static uint32_t block__decompressed_size(const uint8_t* input, uint32_t size)
+{
+    if (size < 12)
+        return 0;
+
+    uint32_t output_size = block__read32(input), block_size = block__read32(input + 4);
+    uint32_t num_blocks = block__read32(input + 8);
+    if (block_size == 0 || num_blocks != block__num_blocks(output_size, block_size) || (size - 12) / 4 < num_blocks)
+        return 0;
+    return output_size;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static uint32_t block__decompress(const struct block_codec* desc, const uint8_t* input, uint32_t size, uint8_t* output,
+                                  uint32_t capacity, uint32_t num_threads)
+{
+    uint32_t output_size = block__decompressed_size(input, size);
+    if (output_size == 0 || output_size > capacity)
+        return 0;
+
+    uint32_t block_size = block__read32(input + 4), num_blocks = block__read32(input + 8);
+
+    uint32_t* offsets = (uint32_t*) desc->alloc((num_blocks + 1) * 2 * sizeof(uint32_t));
+    uint32_t* results = offsets + num_blocks + 1;
+    uint64_t offset = 12 + (uint64_t) num_blocks * 4;
+    for (uint32_t i = 0; i < num_blocks; ++i)
+    {
+        offsets[i] = (uint32_t) offset;
+        offset += block__read32(input + 12 + i * 4);
+        if (offset > size)
+        {
+            desc->free(offsets);
+            return 0;
+        }
+    }
+    offsets[num_blocks] = (uint32_t) offset;
+
+    struct block__job job;
+    memset(&job, 0, sizeof(job));
+    job.desc = desc;
+    job.input = input;
+    job.output = output;
+    job.input_offsets = offsets;
+    job.result = results;
+    job.num_blocks = num_blocks;
+    job.block_size = block_size;
+    job.size = output_size;
+    block__run_threads(&job, num_threads);
+
+    for (uint32_t i = 0; i < num_blocks; ++i)
+        if (!results[i])
+            output_size = 0;
+
+    desc->free(offsets);
+    return output_size;
+}
+
+#endif // __BLOCK_CODEC__
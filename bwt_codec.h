@@ -0,0 +1,626 @@
+#ifndef __BWT_CODEC__
+#define __BWT_CODEC__
+
+// Block-sorting compressor using arithmetic_codec.h as entropy coder, in the spirit of bzip2
+//
+// Each block goes through the Burrows-Wheeler transform (suffix array built with SA-IS in linear time), move-to-front
+// and zero-run-length coding (runs of zeros as bijective base-2 numbers, RUNA/RUNB of bzip2). The frequent small
+// symbols are coded with adaptive models selected by the previous symbol, the others escape to a shared model.
+//
+// Blocks are independent, the block mode compresses them in parallel on several threads.
+//
+// Put those lines in a c/cpp file, arithmetic_codec.h must be implemented in the program as well:
+//      #define __BWT_CODEC__IMPLEMENTATION__
+//      #include "bwt_codec.h"
+//
+// The block mode is shared with lz_codec.h in block_codec.h, which must be next to this file. Define BWT_NO_THREADS
+// (or BLOCK_NO_THREADS) to compile without threads, the block mode then runs on the calling thread.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+struct bwt_codec;
+
+// Allocate a compressor/decompressor, its buffers grow with the size of the blocks
+struct bwt_codec* bwt_init(void);
+
+// Returns the maximum compressed size of a block of size bytes
+uint32_t bwt_compress_bound(uint32_t size);
+
+// Compress a block (up to 1 << 30 bytes), returns the compressed size or 0 if the output is too small
+uint32_t bwt_compress(struct bwt_codec* bwt, const uint8_t* input, uint32_t size, uint8_t* output, uint32_t capacity);
+
+// Returns the decompressed size stored in a compressed block, 0 if invalid
+uint32_t bwt_decompressed_size(const uint8_t* input, uint32_t size);
+
+// Decompress a block, returns the decompressed size or 0 if the data is corrupted or the output too small
+uint32_t bwt_decompress(struct bwt_codec* bwt, const uint8_t* input, uint32_t size, uint8_t* output, uint32_t capacity);
+
+// Release memory
+void bwt_terminate(struct bwt_codec* bwt);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Block mode
+//----------------------------------------------------------------------------------------------------------------------
+
+// Returns the maximum size of the compressed blocks of size bytes
+uint32_t bwt_blocks_bound(uint32_t size, uint32_t block_size);
+
+// Compress the input in blocks of block_size bytes on num_threads threads, returns the compressed size or 0 if the
+// output is too small (see bwt_blocks_bound())
+uint32_t bwt_compress_blocks(const uint8_t* input, uint32_t size, uint8_t* output, uint32_t capacity,
+                             uint32_t block_size, uint32_t num_threads);
+
+// Returns the decompressed size stored in the compressed blocks, 0 if invalid
+uint32_t bwt_blocks_decompressed_size(const uint8_t* input, uint32_t size);
+
+// Decompress blocks on num_threads threads, returns the decompressed size or 0 if the data is corrupted or the
+// output too small
+uint32_t bwt_decompress_blocks(const uint8_t* input, uint32_t size, uint8_t* output, uint32_t capacity,
+                               uint32_t num_threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __BWT_CODEC__
+
+
+//----------------------------------------------------------------------------------------------------------------------
+// Implementation
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifdef __BWT_CODEC__IMPLEMENTATION__
+
+#include <assert.h>
+#include <string.h>
+#include "arithmetic_codec.h"
+
+#if !defined(BWT_FREE) && !defined(BWT_ALLOC)
+#include <stdlib.h>
+#define BWT_FREE(a) free(a)
+#define BWT_ALLOC(a) malloc(a)
+#endif
+
+#if defined(BWT_NO_THREADS) && !defined(BLOCK_NO_THREADS)
+#define BLOCK_NO_THREADS
+#endif
+#include "block_codec.h"
+
+//-- constants ---------------------------------------------------------------------------------------------------------
+#define BWT__HeaderSize (9)                 // method, decompressed size, primary index
+#define BWT__RunA (0)
+#define BWT__RunB (1)
+#define BWT__Symbols (257)                  // RUNA, RUNB, move-to-front ranks 1 to 255 shifted by 1
+#define BWT__HeadSymbols (16)               // symbols coded with the context, the last one escapes to the tail model
+#define BWT__Contexts (4)                   // previous symbol: RUNA, RUNB, rank 1, larger rank
+#define BWT__DecayShift (5)
+
+enum {bwt__stored = 0, bwt__compressed = 1};
+
+struct bwt_codec
+{
+    struct arithmetic_codec* codec;
+    struct adaptive_model* head[BWT__Contexts];
+    struct adaptive_model* tail;
+
+    // work buffers, grown on demand
+    int32_t *text, *suffix_array;           // compression: text + sentinel and its suffix array
+    uint8_t* block;                         // transformed block
+    uint16_t* symbols;                      // zero-run coded ranks
+    uint32_t capacity;                      // in bytes of block
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+struct bwt_codec* bwt_init(void)
+{
+    struct bwt_codec* bwt = (struct bwt_codec*) BWT_ALLOC(sizeof(struct bwt_codec));
+    bwt->codec = ac_init();
+    for (uint32_t i = 0; i < BWT__Contexts; ++i)
+    {
+        bwt->head[i] = adaptive_model_init(BWT__HeadSymbols);
+        adaptive_model_set_decay(bwt->head[i], BWT__DecayShift);
+    }
+    bwt->tail = adaptive_model_init(BWT__Symbols - BWT__HeadSymbols + 1);
+    adaptive_model_set_decay(bwt->tail, BWT__DecayShift);
+    bwt->text = bwt->suffix_array = NULL;
+    bwt->block = NULL;
+    bwt->symbols = NULL;
+    bwt->capacity = 0;
+    return bwt;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void bwt__reserve(struct bwt_codec* bwt, uint32_t size)
+{
+    if (size <= bwt->capacity)
+        return;
+
+    BWT_FREE(bwt->text);
+    BWT_FREE(bwt->suffix_array);
+    BWT_FREE(bwt->block);
+    BWT_FREE(bwt->symbols);
+
+    // text and suffix array have a sentinel, the inverse transform uses suffix_array for size + 1 links
+    bwt->text = (int32_t*) BWT_ALLOC((size + 1) * sizeof(int32_t));
+    bwt->suffix_array = (int32_t*) BWT_ALLOC((size + 1) * sizeof(int32_t));
+    bwt->block = (uint8_t*) BWT_ALLOC(size + 1);
+    bwt->symbols = (uint16_t*) BWT_ALLOC((size + 1) * sizeof(uint16_t));
+    assert(bwt->text != NULL && bwt->suffix_array != NULL && bwt->block != NULL && bwt->symbols != NULL);
+    bwt->capacity = size;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static inline void bwt__write32(uint8_t* p, uint32_t value)
+{
+    p[0] = (uint8_t) value; p[1] = (uint8_t)(value >> 8); p[2] = (uint8_t)(value >> 16); p[3] = (uint8_t)(value >> 24);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static inline uint32_t bwt__read32(const uint8_t* p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Suffix array by induced sorting (SA-IS, Nong, Zhang and Chan 2009)
+//----------------------------------------------------------------------------------------------------------------------
+//
+// The text is an array of integers in [0, k], its last element is a unique 0 (sentinel). Suffixes are typed S
+// (smaller than the next one) or L (larger), the leftmost S of each run (LMS) are sorted first, then the order of
+// the other suffixes is induced from them. If two LMS substrings are equal the problem is reduced to the sorted
+// names of the LMS substrings, solved recursively.
+
+#define BWT__TypeS(types, i) (((types)[(i) >> 3] >> ((i) & 7)) & 1)
+#define BWT__IsLMS(types, i) ((i) > 0 && BWT__TypeS(types, i) && !BWT__TypeS(types, (i) - 1))
+
+//----------------------------------------------------------------------------------------------------------------------
+static void bwt__buckets(const int32_t* text, int32_t* buckets, int32_t n, int32_t k, int end)
+{
+    int32_t sum = 0;
+    memset(buckets, 0, (size_t)(k + 1) * sizeof(int32_t));
+    for (int32_t i = 0; i < n; ++i)
+        buckets[text[i]]++;
+    for (int32_t i = 0; i <= k; ++i)
+    {
+        sum += buckets[i];
+        buckets[i] = end ? sum : sum - buckets[i];
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void bwt__induce(const int32_t* text, int32_t* sa, const uint8_t* types, int32_t* buckets, int32_t n, int32_t k)
+{
+    // L suffixes from the start of the buckets, left to right
+    bwt__buckets(text, buckets, n, k, 0);
+    for (int32_t i = 0; i < n; ++i)
+    {
+        int32_t j = sa[i] - 1;
+        if (j >= 0 && !BWT__TypeS(types, j))
+            sa[buckets[text[j]]++] = j;
+    }
+
+    // S suffixes from the end of the buckets, right to left
+    bwt__buckets(text, buckets, n, k, 1);
+    for (int32_t i = n - 1; i >= 0; --i)
+    {
+        int32_t j = sa[i] - 1;
+        if (j >= 0 && BWT__TypeS(types, j))
+            sa[--buckets[text[j]]] = j;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void bwt__sais(const int32_t* text, int32_t* sa, int32_t n, int32_t k)
+{
+    uint8_t* types = (uint8_t*) BWT_ALLOC((size_t) n / 8 + 1);
+    int32_t* buckets = (int32_t*) BWT_ALLOC((size_t)(k + 1) * sizeof(int32_t));
+    memset(types, 0, (size_t) n / 8 + 1);
+
+    // the sentinel is S, the symbol before is L
+    types[(n - 1) >> 3] |= (uint8_t)(1 << ((n - 1) & 7));
+    for (int32_t i = n - 3; i >= 0; --i)
+        if (text[i] < text[i + 1] || (text[i] == text[i + 1] && BWT__TypeS(types, i + 1)))
+            types[i >> 3] |= (uint8_t)(1 << (i & 7));
+
+    // sort the LMS substrings
+    bwt__buckets(text, buckets, n, k, 1);
+    for (int32_t i = 0; i < n; ++i)
+        sa[i] = -1;
+    for (int32_t i = 1; i < n; ++i)
+        if (BWT__IsLMS(types, i))
+            sa[--buckets[text[i]]] = i;
+    bwt__induce(text, sa, types, buckets, n, k);
+
+    // compact the sorted LMS substrings in the first n1 items
+    int32_t n1 = 0;
+    for (int32_t i = 0; i < n; ++i)
+        if (BWT__IsLMS(types, sa[i]))
+            sa[n1++] = sa[i];
+
+    // name the LMS substrings, equal substrings get the same name
+    for (int32_t i = n1; i < n; ++i)
+        sa[i] = -1;
+    int32_t name = 0, previous = -1;
+    for (int32_t i = 0; i < n1; ++i)
+    {
+        int32_t position = sa[i], diff = 0;
+        for (int32_t d = 0; d < n; ++d)
+        {
+            if (previous == -1 || text[position + d] != text[previous + d] ||
+                BWT__TypeS(types, position + d) != BWT__TypeS(types, previous + d))
+            {
+                diff = 1;
+                break;
+            }
+            if (d > 0 && (BWT__IsLMS(types, position + d) || BWT__IsLMS(types, previous + d)))
+                break;
+        }
+
+        if (diff)
+        {
+            name++;
+            previous = position;
+        }
+        sa[n1 + position / 2] = name - 1;
+    }
+    for (int32_t i = n - 1, j = n - 1; i >= n1; --i)
+        if (sa[i] >= 0)
+            sa[j--] = sa[i];
+
+    // sort the reduced problem, recursively if names are not unique
+    int32_t* sa1 = sa;
+    int32_t* text1 = sa + n - n1;
+    if (name < n1)
+        bwt__sais(text1, sa1, n1, name - 1);
+    else
+        for (int32_t i = 0; i < n1; ++i)
+            sa1[text1[i]] = i;
+
+    // induce the suffix array from the sorted LMS suffixes
+    bwt__buckets(text, buckets, n, k, 1);
+    for (int32_t i = 1, j = 0; i < n; ++i)
+        if (BWT__IsLMS(types, i))
+            text1[j++] = i;
+    for (int32_t i = 0; i < n1; ++i)
+        sa1[i] = text1[sa1[i]];
+    for (int32_t i = n1; i < n; ++i)
+        sa[i] = -1;
+    for (int32_t i = n1 - 1; i >= 0; --i)
+    {
+        int32_t j = sa[i];
+        sa[i] = -1;
+        sa[--buckets[text[j]]] = j;
+    }
+    bwt__induce(text, sa, types, buckets, n, k);
+
+    BWT_FREE(buckets);
+    BWT_FREE(types);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Compression
+//----------------------------------------------------------------------------------------------------------------------
+
+uint32_t bwt_compress_bound(uint32_t size)
+{
+    return size + BWT__HeaderSize;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static inline uint32_t bwt__context(uint32_t symbol)
+{
+    return (symbol < BWT__Contexts) ? symbol : BWT__Contexts - 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void bwt__reset_models(struct bwt_codec* bwt)
+{
+    for (uint32_t i = 0; i < BWT__Contexts; ++i)
+        adaptive_model_reset(bwt->head[i]);
+    adaptive_model_reset(bwt->tail);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Small symbols are the most frequent, they are coded in the context of the previous symbol
+static inline void bwt__encode_symbol(struct bwt_codec* bwt, uint32_t symbol, uint32_t context)
+{
+    if (symbol < BWT__HeadSymbols - 1)
+    {
+        ac_encode_adaptive(bwt->codec, symbol, bwt->head[context]);
+        return;
+    }
+    ac_encode_adaptive(bwt->codec, BWT__HeadSymbols - 1, bwt->head[context]);
+    ac_encode_adaptive(bwt->codec, symbol - (BWT__HeadSymbols - 1), bwt->tail);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static inline uint32_t bwt__decode_symbol(struct bwt_codec* bwt, uint32_t context)
+{
+    uint32_t symbol = ac_decode_adaptive(bwt->codec, bwt->head[context]);
+    if (symbol == BWT__HeadSymbols - 1)
+        symbol += ac_decode_adaptive(bwt->codec, bwt->tail);
+    return symbol;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t bwt_compress(struct bwt_codec* bwt, const uint8_t* input, uint32_t size, uint8_t* output, uint32_t capacity)
+{
+    assert(size < (1U << 30));
+    if (capacity < bwt_compress_bound(size))
+        return 0;
+
+    bwt__write32(output + 1, size);
+    if (size == 0)
+    {
+        output[0] = bwt__stored;
+        return 5;
+    }
+
+    bwt__reserve(bwt, size);
+
+    // Burrows-Wheeler transform, the row of the sentinel is not stored
+    int32_t* sa = bwt->suffix_array;
+    for (uint32_t i = 0; i < size; ++i)
+        bwt->text[i] = (int32_t) input[i] + 1;
+    bwt->text[size] = 0;
+    bwt__sais(bwt->text, sa, (int32_t) size + 1, 256);
+
+    uint32_t primary = 0, count = 0;
+    for (uint32_t i = 0; i <= size; ++i)
+    {
+        if (sa[i] == 0)
+            primary = i;
+        else
+            bwt->block[count++] = input[sa[i] - 1];
+    }
+
+    // move-to-front, then runs of rank 0 as bijective base-2 numbers
+    uint8_t order[256];
+    for (uint32_t i = 0; i < 256; ++i)
+        order[i] = (uint8_t) i;
+
+    uint32_t num_symbols = 0, run = 0;
+    for (uint32_t i = 0; i <= size; ++i)
+    {
+        uint32_t rank = 0;
+        if (i < size)
+        {
+            uint8_t c = bwt->block[i];
+            while (order[rank] != c)
+                rank++;
+            memmove(order + 1, order, rank);
+            order[0] = c;
+        }
+
+        if (rank == 0 && i < size)
+        {
+            run++;
+            continue;
+        }
+
+        for (; run > 0; run >>= 1)
+        {
+            run--;
+            bwt->symbols[num_symbols++] = (run & 1) ? BWT__RunB : BWT__RunA;
+        }
+        if (i < size)
+            bwt->symbols[num_symbols++] = (uint16_t)(rank + 1);
+    }
+
+    // a symbol costs at most 32 bits: the coded block fits in 4 bytes per symbol
+    bwt__reset_models(bwt);
+    ac_set_buffer(bwt->codec, num_symbols * 4 + 64, NULL);
+    ac_start_encoder(bwt->codec);
+    uint32_t context = 0;
+    for (uint32_t i = 0; i < num_symbols; ++i)
+    {
+        bwt__encode_symbol(bwt, bwt->symbols[i], context);
+        context = bwt__context(bwt->symbols[i]);
+    }
+    uint32_t compressed_size = ac_stop_encoder(bwt->codec);
+    if (compressed_size + BWT__HeaderSize >= size + 5)
+    {
+        output[0] = bwt__stored;
+        memcpy(output + 5, input, size);
+        return size + 5;
+    }
+
+    output[0] = bwt__compressed;
+    bwt__write32(output + 5, primary);
+    memcpy(output + BWT__HeaderSize, ac_get_buffer(bwt->codec), compressed_size);
+    return compressed_size + BWT__HeaderSize;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Decompression
+//----------------------------------------------------------------------------------------------------------------------
+
+uint32_t bwt_decompressed_size(const uint8_t* input, uint32_t size)
+{
+    if (size < 5 || input[0] > bwt__compressed || (input[0] == bwt__compressed && size < BWT__HeaderSize))
+        return 0;
+    return bwt__read32(input + 1);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t bwt_decompress(struct bwt_codec* bwt, const uint8_t* input, uint32_t size, uint8_t* output, uint32_t capacity)
+{
+    uint32_t output_size = bwt_decompressed_size(input, size);
+    if ((output_size == 0 && size != 5) || output_size > capacity || output_size >= (1U << 30))
+        return 0;
+
+    if (input[0] == bwt__stored)
+    {
+        if (size - 5 != output_size)
+            return 0;
+        memcpy(output, input + 5, output_size);
+        return output_size;
+    }
+
+    uint32_t primary = bwt__read32(input + 5);
+    if (primary > output_size)
+        return 0;
+
+    bwt__reserve(bwt, output_size);
+
+    // symbols to move-to-front ranks to the transformed block
+    bwt__reset_models(bwt);
+    ac_start_message_decoder(bwt->codec, input + BWT__HeaderSize, size - BWT__HeaderSize);
+
+    uint8_t order[256];
+    for (uint32_t i = 0; i < 256; ++i)
+        order[i] = (uint8_t) i;
+
+    uint32_t count = 0, run = 0, run_bit = 0, context = 0;
+    while (count < output_size || run != 0)
+    {
+        uint32_t symbol = (count + run < output_size) ? bwt__decode_symbol(bwt, context) : 2;
+        context = bwt__context(symbol);
+        if (symbol <= BWT__RunB)
+        {
+            if (run_bit > 30)
+                break;
+            run += (symbol + 1) << run_bit++;
+            continue;
+        }
+
+        if (run > output_size - count)
+            break;
+        memset(bwt->block + count, order[0], run);
+        count += run;
+        run = run_bit = 0;
+
+        if (count == output_size)
+            break;
+
+        uint32_t rank = symbol - 1;
+        uint8_t c = order[rank];
+        memmove(order + 1, order, rank);
+        order[0] = c;
+        bwt->block[count++] = c;
+    }
+    ac_stop_decoder(bwt->codec);
+
+    if (count != output_size)
+        return 0;
+
+    // inverse transform: next[row] is the row of the rotation starting one character earlier
+    uint32_t* next = (uint32_t*) bwt->suffix_array;
+    uint32_t start[256] = {0};
+    for (uint32_t i = 0; i < output_size; ++i)
+        start[bwt->block[i]]++;
+    for (uint32_t c = 0, sum = 1; c < 256; ++c)
+    {
+        uint32_t n = start[c];
+        start[c] = sum;
+        sum += n;
+    }
+
+    // row 0 is the rotation starting with the sentinel, it ends with the last character
+    if (output_size < (1U << 24))
+    {
+        // the walk is bound by memory latency: the character is packed with the next row to load a single array
+        for (uint32_t row = 0, i = 0; row <= output_size; ++row)
+        {
+            if (row == primary)
+                next[row] = 0;
+            else
+            {
+                uint8_t c = bwt->block[i++];
+                next[row] = (start[c]++ << 8) | c;
+            }
+        }
+
+        for (uint32_t entry = next[0], i = output_size; i-- > 0; )
+        {
+            output[i] = (uint8_t) entry;
+            entry = next[entry >> 8];
+        }
+        return output_size;
+    }
+
+    for (uint32_t row = 0, i = 0; row <= output_size; ++row)
+    {
+        if (row == primary)
+            next[row] = 0;
+        else
+            next[row] = start[bwt->block[i++]]++;
+    }
+
+    for (uint32_t row = 0, i = output_size; i-- > 0; )
+    {
+        output[i] = bwt->block[row - (row > primary)];
+        row = next[row];
+    }
+    return output_size;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void bwt_terminate(struct bwt_codec* bwt)
+{
+    ac_terminate(bwt->codec);
+    for (uint32_t i = 0; i < BWT__Contexts; ++i)
+        adaptive_model_terminate(bwt->head[i]);
+    adaptive_model_terminate(bwt->tail);
+    BWT_FREE(bwt->text);
+    BWT_FREE(bwt->suffix_array);
+    BWT_FREE(bwt->block);
+    BWT_FREE(bwt->symbols);
+    BWT_FREE(bwt);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Block mode (see block_codec.h)
+//----------------------------------------------------------------------------------------------------------------------
+
+static void* bwt__block_init(const void* params) {(void) params; return bwt_init();}
+static void bwt__block_terminate(void* bwt) {bwt_terminate((struct bwt_codec*) bwt);}
+static void* bwt__alloc(size_t size) {return BWT_ALLOC(size);}
+static void bwt__free(void* pointer) {BWT_FREE(pointer);}
+
+static uint32_t bwt__block_compress(void* bwt, const uint8_t* input, uint32_t size, uint8_t* output, uint32_t capacity)
+{
+    return bwt_compress((struct bwt_codec*) bwt, input, size, output, capacity);
+}
+
+static uint32_t bwt__block_decompress(void* bwt, const uint8_t* input, uint32_t size, uint8_t* output,
+                                      uint32_t capacity)
+{
+    return bwt_decompress((struct bwt_codec*) bwt, input, size, output, capacity);
+}
+
+static const struct block_codec bwt__block_codec = {bwt__block_init, bwt__block_terminate, bwt__block_compress,
+                                                    bwt__block_decompress, bwt_compress_bound, bwt__alloc, bwt__free,
+                                                    NULL};
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t bwt_blocks_bound(uint32_t size, uint32_t block_size)
+{
+    return block__bound(&bwt__block_codec, size, block_size);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t bwt_compress_blocks(const uint8_t* input, uint32_t size, uint8_t* output, uint32_t capacity,
+                             uint32_t block_size, uint32_t num_threads)
+{
+    return block__compress(&bwt__block_codec, input, size, output, capacity, block_size, num_threads);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t bwt_blocks_decompressed_size(const uint8_t* input, uint32_t size)
+{
+    return block__decompressed_size(input, size);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t bwt_decompress_blocks(const uint8_t* input, uint32_t size, uint8_t* output, uint32_t capacity,
+                               uint32_t num_threads)
+{
+    return block__decompress(&bwt__block_codec, input, size, output, capacity, num_threads);
+}
+
+#endif // __BWT_CODEC__IMPLEMENTATION__
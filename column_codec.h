@@ -0,0 +1,455 @@
+#ifndef __COLUMN_CODEC__
+#define __COLUMN_CODEC__
+
+// Integer column compressor using arithmetic_codec.h as entropy coder, for timestamps, offsets, sorted ids...
+//
+// The column is split in blocks of 128 values, each block picks the cheapest of three predictions:
+//  * delta: difference with the previous value (sorted ids, offsets)
+//  * delta-of-delta: difference with the previous delta (regularly sampled timestamps)
+//  * frame-of-reference: difference with the minimum of the block (values in a narrow range)
+//
+// Residuals are coded as their bit length with an adaptive model per prediction (frequency-sorted, a column has few
+// distinct lengths), followed by the bits under the leading one with ac_put_bits(). The decoder reconstructs a whole
+// block at once with vectorized prefix sums, the instruction set follows the kernels selected by arithmetic_codec.h
+// (see ac_get_isa()).
+//
+// Put those lines in a c/cpp file, arithmetic_codec.h must be implemented in the program as well:
+//      #define __COLUMN_CODEC__IMPLEMENTATION__
+//      #include "column_codec.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+struct column_codec;
+
+// Allocate a compressor/decompressor
+struct column_codec* column_init(void);
+
+// Returns the maximum compressed size in bytes of count values
+uint32_t column_compress_bound(uint32_t count);
+
+// Compress count values (less than 1 << 28), returns the compressed size or 0 if the output is too small
+// (see column_compress_bound())
+uint32_t column_compress(struct column_codec* column, const uint64_t* values, uint32_t count, uint8_t* output,
+                         uint32_t capacity);
+
+// Returns the number of values stored in the compressed data, 0 if invalid
+uint32_t column_decompressed_count(const uint8_t* input, uint32_t size);
+
+// Decompress up to capacity values, returns the number of values or 0 if the data is corrupted or the output too small
+uint32_t column_decompress(struct column_codec* column, const uint8_t* input, uint32_t size, uint64_t* values,
+                           uint32_t capacity);
+
+// Release memory
+void column_terminate(struct column_codec* column);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __COLUMN_CODEC__
+
+
+//----------------------------------------------------------------------------------------------------------------------
+// Implementation
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifdef __COLUMN_CODEC__IMPLEMENTATION__
+
+#include <assert.h>
+#include <string.h>
+#include "arithmetic_codec.h"
+
+#if !defined(COLUMN_FREE) && !defined(COLUMN_ALLOC)
+#include <stdlib.h>
+#define COLUMN_FREE(a) free(a)
+#define COLUMN_ALLOC(a) malloc(a)
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define COLUMN__X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#define COLUMN__TARGET(isa)
+#else
+#define COLUMN__TARGET(isa) __attribute__((target(isa)))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define COLUMN__NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+static inline uint32_t column__bit_length(uint64_t x) {unsigned long index; return _BitScanReverse64(&index, x) ? index + 1 : 0;}
+#else
+static inline uint32_t column__bit_length(uint64_t x) {return x ? 64 - (uint32_t) __builtin_clzll(x) : 0;}
+#endif
+
+//-- constants ---------------------------------------------------------------------------------------------------------
+#define COLUMN__BlockSize (128)
+#define COLUMN__HeaderSize (5)              // method, number of values
+#define COLUMN__LengthSymbols (65)          // bit length of a 64 bits residual
+
+enum {column__stored = 0, column__compressed = 1};
+enum {column__delta, column__delta_of_delta, column__frame, column__num_predictions};
+
+struct column_codec
+{
+    struct arithmetic_codec* codec;
+    struct adaptive_model* prediction;
+    struct adaptive_model* length[column__num_predictions];
+    struct adaptive_model* base;            // frame of reference, relative to the previous value
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+struct column_codec* column_init(void)
+{
+    struct column_codec* column = (struct column_codec*) COLUMN_ALLOC(sizeof(struct column_codec));
+    column->codec = ac_init();
+    column->prediction = adaptive_model_init(column__num_predictions);
+    for (uint32_t i = 0; i < column__num_predictions; ++i)
+    {
+        column->length[i] = adaptive_model_init(COLUMN__LengthSymbols);
+        adaptive_model_set_sorted(column->length[i], 1);
+    }
+    column->base = adaptive_model_init(COLUMN__LengthSymbols);
+    return column;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void column__reset_models(struct column_codec* column)
+{
+    adaptive_model_reset(column->prediction);
+    for (uint32_t i = 0; i < column__num_predictions; ++i)
+        adaptive_model_reset(column->length[i]);
+    adaptive_model_reset(column->base);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static inline void column__write32(uint8_t* p, uint32_t value)
+{
+    p[0] = (uint8_t) value; p[1] = (uint8_t)(value >> 8); p[2] = (uint8_t)(value >> 16); p[3] = (uint8_t)(value >> 24);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static inline uint32_t column__read32(const uint8_t* p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static inline uint64_t column__zigzag(uint64_t delta) {return (delta << 1) ^ (uint64_t)((int64_t) delta >> 63);}
+static inline uint64_t column__unzigzag(uint64_t zigzag) {return (zigzag >> 1) ^ (0 - (zigzag & 1));}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Prefix sums
+//----------------------------------------------------------------------------------------------------------------------
+//
+// values[i] = carry + values[0] + ... + values[i] in place, returns the last sum. Additions wrap around like the
+// differences computed by the encoder.
+
+typedef uint64_t (*column__prefix_sum_func)(uint64_t* values, uint32_t count, uint64_t carry);
+
+//----------------------------------------------------------------------------------------------------------------------
+static uint64_t column__prefix_sum_scalar(uint64_t* values, uint32_t count, uint64_t carry)
+{
+    for (uint32_t i = 0; i < count; ++i)
+        values[i] = carry += values[i];
+    return carry;
+}
+
+#ifdef COLUMN__X86
+
+//----------------------------------------------------------------------------------------------------------------------
+COLUMN__TARGET("sse2")
+static uint64_t column__prefix_sum_sse2(uint64_t* values, uint32_t count, uint64_t carry)
+{
+    __m128i sum = _mm_set1_epi64x((long long) carry);
+    uint32_t i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(values + i));
+        v = _mm_add_epi64(v, _mm_slli_si128(v, 8));
+        v = _mm_add_epi64(v, sum);
+        _mm_storeu_si128((__m128i*)(values + i), v);
+        sum = _mm_unpackhi_epi64(v, v);
+    }
+    return column__prefix_sum_scalar(values + i, count - i, i ? values[i - 1] : carry);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Sums within the 128 bits lanes, then the low lane total is added to the high lane
+COLUMN__TARGET("avx2")
+static uint64_t column__prefix_sum_avx2(uint64_t* values, uint32_t count, uint64_t carry)
+{
+    __m256i sum = _mm256_set1_epi64x((long long) carry);
+    uint32_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(values + i));
+        v = _mm256_add_epi64(v, _mm256_slli_si256(v, 8));
+        v = _mm256_add_epi64(v, _mm256_blend_epi32(_mm256_setzero_si256(), _mm256_permute4x64_epi64(v, 0x55), 0xF0));
+        v = _mm256_add_epi64(v, sum);
+        _mm256_storeu_si256((__m256i*)(values + i), v);
+        sum = _mm256_permute4x64_epi64(v, 0xFF);
+    }
+    return column__prefix_sum_scalar(values + i, count - i, i ? values[i - 1] : carry);
+}
+
+#endif
+
+#ifdef COLUMN__NEON
+
+//----------------------------------------------------------------------------------------------------------------------
+static uint64_t column__prefix_sum_neon(uint64_t* values, uint32_t count, uint64_t carry)
+{
+    uint64x2_t sum = vdupq_n_u64(carry);
+    uint32_t i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        uint64x2_t v = vld1q_u64(values + i);
+        v = vaddq_u64(v, vextq_u64(vdupq_n_u64(0), v, 1));
+        v = vaddq_u64(v, sum);
+        vst1q_u64(values + i, v);
+        sum = vdupq_laneq_u64(v, 1);
+    }
+    return column__prefix_sum_scalar(values + i, count - i, i ? values[i - 1] : carry);
+}
+
+#endif
+
+//----------------------------------------------------------------------------------------------------------------------
+static column__prefix_sum_func column__select_prefix_sum(void)
+{
+#if defined(COLUMN__X86)
+    enum ac_isa isa = ac_get_isa();
+    if (isa >= AC_ISA_AVX2)
+        return column__prefix_sum_avx2;
+    if (isa >= AC_ISA_SSE42)
+        return column__prefix_sum_sse2;
+#elif defined(COLUMN__NEON)
+    return column__prefix_sum_neon;
+#endif
+    return column__prefix_sum_scalar;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Residuals
+//----------------------------------------------------------------------------------------------------------------------
+
+static inline void column__encode_residual(struct arithmetic_codec* codec, uint64_t value, struct adaptive_model* model)
+{
+    uint32_t bits = column__bit_length(value);
+    ac_encode_adaptive(codec, bits, model);
+
+    // bits under the leading one, 16 at a time from the top
+    for (uint32_t shift = (bits > 1) ? bits - 1 : 0; shift > 0; )
+    {
+        uint32_t n = (shift > 16) ? 16 : shift;
+        shift -= n;
+        ac_put_bits(codec, (uint32_t)(value >> shift) & ((1U << n) - 1), n);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static inline uint64_t column__decode_residual(struct arithmetic_codec* codec, struct adaptive_model* model)
+{
+    uint32_t bits = ac_decode_adaptive(codec, model);
+    if (bits <= 1)
+        return bits;
+
+    uint64_t value = 1;
+    for (uint32_t shift = bits - 1; shift > 0; )
+    {
+        uint32_t n = (shift > 16) ? 16 : shift;
+        shift -= n;
+        value = (value << n) | ac_get_bits(codec, n);
+    }
+    return value;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Compression
+//----------------------------------------------------------------------------------------------------------------------
+
+uint32_t column_compress_bound(uint32_t count)
+{
+    return count * 8 + COLUMN__HeaderSize;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Returns the prediction with the fewest residual bits, frame of reference also pays for its base
+static uint32_t column__select(const uint64_t* values, uint32_t count, uint64_t previous, uint64_t previous_delta,
+                               uint64_t* base)
+{
+    uint64_t cost[column__num_predictions] = {0};
+    uint64_t minimum = values[0], base_delta = column__zigzag(values[0] - previous);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        uint64_t delta = values[i] - previous;
+        cost[column__delta] += column__bit_length(column__zigzag(delta));
+        cost[column__delta_of_delta] += column__bit_length(column__zigzag(delta - previous_delta));
+        minimum = (values[i] < minimum) ? values[i] : minimum;
+        previous = values[i];
+        previous_delta = delta;
+    }
+
+    cost[column__frame] = column__bit_length(base_delta);
+    for (uint32_t i = 0; i < count; ++i)
+        cost[column__frame] += column__bit_length(values[i] - minimum);
+
+    *base = minimum;
+    uint32_t best = column__delta;
+    for (uint32_t i = 1; i < column__num_predictions; ++i)
+        best = (cost[i] < cost[best]) ? i : best;
+    return best;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t column_compress(struct column_codec* column, const uint64_t* values, uint32_t count, uint8_t* output,
+                         uint32_t capacity)
+{
+    assert(count < (1U << 28));
+    if (capacity < column_compress_bound(count))
+        return 0;
+
+    column__reset_models(column);
+
+    // a residual costs at most 16 bits for its length and 63 bits for the rest, a block adds its prediction and base
+    uint32_t num_blocks = (count + COLUMN__BlockSize - 1) / COLUMN__BlockSize;
+    ac_set_buffer(column->codec, count * 10 + num_blocks * 12 + 64, NULL);
+    ac_start_encoder(column->codec);
+
+    uint64_t previous = 0, previous_delta = 0;
+    for (uint32_t start = 0; start < count; start += COLUMN__BlockSize)
+    {
+        const uint64_t* block = values + start;
+        uint32_t n = (count - start < COLUMN__BlockSize) ? count - start : COLUMN__BlockSize;
+        uint64_t base;
+        uint32_t prediction = column__select(block, n, previous, previous_delta, &base);
+        struct adaptive_model* model = column->length[prediction];
+        ac_encode_adaptive(column->codec, prediction, column->prediction);
+
+        if (prediction == column__frame)
+        {
+            column__encode_residual(column->codec, column__zigzag(base - previous), column->base);
+            for (uint32_t i = 0; i < n; ++i)
+                column__encode_residual(column->codec, block[i] - base, model);
+        }
+
+        for (uint32_t i = 0; i < n; ++i)
+        {
+            uint64_t delta = block[i] - previous;
+            if (prediction == column__delta)
+                column__encode_residual(column->codec, column__zigzag(delta), model);
+            else if (prediction == column__delta_of_delta)
+                column__encode_residual(column->codec, column__zigzag(delta - previous_delta), model);
+            previous = block[i];
+            previous_delta = delta;
+        }
+    }
+
+    uint32_t compressed_size = ac_stop_encoder(column->codec);
+    column__write32(output + 1, count);
+
+    // incompressible columns are stored, 8 bytes little endian per value
+    if (compressed_size >= count * 8)
+    {
+        output[0] = column__stored;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            column__write32(output + COLUMN__HeaderSize + i * 8, (uint32_t) values[i]);
+            column__write32(output + COLUMN__HeaderSize + i * 8 + 4, (uint32_t)(values[i] >> 32));
+        }
+        return column_compress_bound(count);
+    }
+
+    output[0] = column__compressed;
+    memcpy(output + COLUMN__HeaderSize, ac_get_buffer(column->codec), compressed_size);
+    return compressed_size + COLUMN__HeaderSize;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Decompression
+//----------------------------------------------------------------------------------------------------------------------
+
+uint32_t column_decompressed_count(const uint8_t* input, uint32_t size)
+{
+    if (size < COLUMN__HeaderSize || input[0] > column__compressed)
+        return 0;
+    return column__read32(input + 1);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t column_decompress(struct column_codec* column, const uint8_t* input, uint32_t size, uint64_t* values,
+                           uint32_t capacity)
+{
+    uint32_t count = column_decompressed_count(input, size);
+    if ((count == 0 && size != COLUMN__HeaderSize) || count > capacity || count >= (1U << 28))
+        return 0;
+
+    if (input[0] == column__stored)
+    {
+        if (size != column_compress_bound(count))
+            return 0;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            const uint8_t* p = input + COLUMN__HeaderSize + i * 8;
+            values[i] = (uint64_t) column__read32(p) | ((uint64_t) column__read32(p + 4) << 32);
+        }
+        return count;
+    }
+
+    column__prefix_sum_func prefix_sum = column__select_prefix_sum();
+    column__reset_models(column);
+    ac_start_message_decoder(column->codec, input + COLUMN__HeaderSize, size - COLUMN__HeaderSize);
+
+    // residuals of a block are decoded in place, then turned into values with one or two prefix sums
+    uint64_t previous = 0, previous_delta = 0;
+    for (uint32_t start = 0; start < count; start += COLUMN__BlockSize)
+    {
+        uint64_t* block = values + start;
+        uint32_t n = (count - start < COLUMN__BlockSize) ? count - start : COLUMN__BlockSize;
+        uint32_t prediction = ac_decode_adaptive(column->codec, column->prediction);
+        struct adaptive_model* model = column->length[prediction];
+
+        if (prediction == column__frame)
+        {
+            uint64_t base = previous + column__unzigzag(column__decode_residual(column->codec, column->base));
+            for (uint32_t i = 0; i < n; ++i)
+                block[i] = base + column__decode_residual(column->codec, model);
+            previous_delta = block[n - 1] - ((n > 1) ? block[n - 2] : previous);
+            previous = block[n - 1];
+            continue;
+        }
+
+        for (uint32_t i = 0; i < n; ++i)
+            block[i] = column__unzigzag(column__decode_residual(column->codec, model));
+
+        if (prediction == column__delta_of_delta)
+            previous_delta = prefix_sum(block, n, previous_delta);
+        else
+            previous_delta = block[n - 1];
+        previous = prefix_sum(block, n, previous);
+    }
+
+    ac_stop_decoder(column->codec);
+    return count;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void column_terminate(struct column_codec* column)
+{
+    ac_terminate(column->codec);
+    adaptive_model_terminate(column->prediction);
+    for (uint32_t i = 0; i < column__num_predictions; ++i)
+        adaptive_model_terminate(column->length[i]);
+    adaptive_model_terminate(column->base);
+    COLUMN_FREE(column);
+}
+
+#endif // __COLUMN_CODEC__IMPLEMENTATION__
@@ -0,0 +1,570 @@
+#ifndef __LZ_CODEC__
+#define __LZ_CODEC__
+
+// LZ77 compressor using arithmetic_codec.h as entropy coder
+//
+// Matches are found with hash chains and lazy evaluation (a match is delayed by one byte if the next position has a
+// longer one). Literals are coded with an order-1 context (one adaptive model per previous byte), lengths with an
+// adaptive model of slots and distances with slot models selected by the length, the low bits of large values are
+// sent with ac_put_bits(). A match can reuse the previous distance for the price of a bit.
+//
+// The block mode splits the input in blocks compressed independently, in parallel on several threads.
+//
+// Put those lines in a c/cpp file, arithmetic_codec.h must be implemented in the program as well:
+//      #define __LZ_CODEC__IMPLEMENTATION__
+//      #include "lz_codec.h"
+//
+// The block mode is shared with bwt_codec.h in block_codec.h, which must be next to this file. Define LZ_NO_THREADS
+// (or BLOCK_NO_THREADS) to compile without threads, the block mode then runs on the calling thread.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+struct lz_codec;
+
+// Allocate a compressor/decompressor
+//      window_log      Size of the match window, 1 << window_log bytes (10 to 24), only used to compress
+//      level           Effort of the match finder (1 to 12), up to 1 << level candidates are checked per position
+struct lz_codec* lz_init(uint32_t window_log, uint32_t level);
+
+// Returns the maximum compressed size of size bytes
+uint32_t lz_compress_bound(uint32_t size);
+
+// Compress the input, returns the compressed size or 0 if the output is too small (see lz_compress_bound())
+uint32_t lz_compress(struct lz_codec* lz, const uint8_t* input, uint32_t size, uint8_t* output, uint32_t capacity);
+
+// Returns the decompressed size stored in the compressed data, 0 if invalid
+uint32_t lz_decompressed_size(const uint8_t* input, uint32_t size);
+
+// Decompress, returns the decompressed size or 0 if the data is corrupted or the output too small
+uint32_t lz_decompress(struct lz_codec* lz, const uint8_t* input, uint32_t size, uint8_t* output, uint32_t capacity);
+
+// Release memory
+void lz_terminate(struct lz_codec* lz);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Block mode
+//----------------------------------------------------------------------------------------------------------------------
+
+// Returns the maximum size of the compressed blocks of size bytes
+uint32_t lz_blocks_bound(uint32_t size, uint32_t block_size);
+
+// Compress the input in blocks of block_size bytes on num_threads threads, returns the compressed size or 0 if the
+// output is too small (see lz_blocks_bound())
+uint32_t lz_compress_blocks(const uint8_t* input, uint32_t size, uint8_t* output, uint32_t capacity,
+                            uint32_t block_size, uint32_t window_log, uint32_t level, uint32_t num_threads);
+
+// Returns the decompressed size stored in the compressed blocks, 0 if invalid
+uint32_t lz_blocks_decompressed_size(const uint8_t* input, uint32_t size);
+
+// Decompress blocks on num_threads threads, returns the decompressed size or 0 if the data is corrupted or the
+// output too small
+uint32_t lz_decompress_blocks(const uint8_t* input, uint32_t size, uint8_t* output, uint32_t capacity,
+                              uint32_t num_threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __LZ_CODEC__
+
+
+//----------------------------------------------------------------------------------------------------------------------
+// Implementation
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifdef __LZ_CODEC__IMPLEMENTATION__
+
+#include <assert.h>
+#include <string.h>
+#include "arithmetic_codec.h"
+
+#if !defined(LZ_FREE) && !defined(LZ_ALLOC)
+#include <stdlib.h>
+#define LZ_FREE(a) free(a)
+#define LZ_ALLOC(a) malloc(a)
+#endif
+
+#if defined(LZ_NO_THREADS) && !defined(BLOCK_NO_THREADS)
+#define BLOCK_NO_THREADS
+#endif
+#include "block_codec.h"
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+static inline uint32_t lz__log2(uint32_t x) {unsigned long index; _BitScanReverse(&index, x); return index;}
+#else
+static inline uint32_t lz__log2(uint32_t x) {return 31 - (uint32_t) __builtin_clz(x);}
+#endif
+
+//-- constants ---------------------------------------------------------------------------------------------------------
+#define LZ__MinMatch (4)
+#define LZ__MaxMatch (LZ__MinMatch + 4095)
+#define LZ__HashLog (17)
+#define LZ__NiceMatch (128)                 // long enough to stop the search
+#define LZ__LazyMatch (32)                  // long enough to skip the lazy evaluation
+#define LZ__HeaderSize (5)                  // method, decompressed size
+#define LZ__LengthSlots (24)                // slots of match length - LZ__MinMatch
+#define LZ__DistanceSlots (48)              // slots of distance - 1
+#define LZ__DistanceContexts (4)
+#define LZ__States (4)                      // kind of the last two tokens
+
+enum {lz__stored = 0, lz__compressed = 1};
+
+struct lz_codec
+{
+    struct arithmetic_codec* codec;
+    struct adaptive_model* literal[256];
+    struct adaptive_model* length;
+    struct adaptive_model* distance[LZ__DistanceContexts];
+    ac_bit_model is_match[LZ__States], is_rep[LZ__States];
+
+    // match finder, allocated by the first compression
+    uint32_t *head, *prev;                  // positions + 1, 0 = none
+    uint32_t window_log, max_chain, next_insert;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+struct lz_codec* lz_init(uint32_t window_log, uint32_t level)
+{
+    assert(window_log >= 10 && window_log <= 24);
+    assert(level >= 1 && level <= 12);
+
+    struct lz_codec* lz = (struct lz_codec*) LZ_ALLOC(sizeof(struct lz_codec));
+    lz->codec = ac_init();
+    for (uint32_t i = 0; i < 256; ++i)
+        lz->literal[i] = adaptive_model_init(256);
+    lz->length = adaptive_model_init(LZ__LengthSlots);
+    for (uint32_t i = 0; i < LZ__DistanceContexts; ++i)
+        lz->distance[i] = adaptive_model_init(LZ__DistanceSlots);
+
+    lz->head = lz->prev = NULL;
+    lz->window_log = window_log;
+    lz->max_chain = 1U << level;
+    return lz;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void lz__reset_models(struct lz_codec* lz)
+{
+    for (uint32_t i = 0; i < 256; ++i)
+        adaptive_model_reset(lz->literal[i]);
+    adaptive_model_reset(lz->length);
+    for (uint32_t i = 0; i < LZ__DistanceContexts; ++i)
+        adaptive_model_reset(lz->distance[i]);
+    for (uint32_t i = 0; i < LZ__States; ++i)
+        lz->is_match[i] = lz->is_rep[i] = AC_BIT_MODEL_INIT;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static inline void lz__write32(uint8_t* p, uint32_t value)
+{
+    p[0] = (uint8_t) value; p[1] = (uint8_t)(value >> 8); p[2] = (uint8_t)(value >> 16); p[3] = (uint8_t)(value >> 24);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static inline uint32_t lz__read32(const uint8_t* p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Values are coded as a slot: 0 to 3 directly, then 2 slots per power of 2 followed by the bits below the top two
+static void lz__encode_value(struct arithmetic_codec* codec, uint32_t value, struct adaptive_model* model)
+{
+    if (value < 4)
+    {
+        ac_encode_adaptive(codec, value, model);
+        return;
+    }
+
+    uint32_t n = lz__log2(value), bits = n - 1;
+    ac_encode_adaptive(codec, 2 * n + ((value >> bits) & 1), model);
+
+    value &= (1U << bits) - 1;
+    if (bits > 16)
+    {
+        ac_put_bits(codec, value & 0xFFFF, 16);
+        value >>= 16;
+        bits -= 16;
+    }
+    ac_put_bits(codec, value, bits);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static uint32_t lz__decode_value(struct arithmetic_codec* codec, struct adaptive_model* model)
+{
+    uint32_t slot = ac_decode_adaptive(codec, model);
+    if (slot < 4)
+        return slot;
+
+    uint32_t bits = (slot >> 1) - 1, value = 0, shift = 0;
+    if (bits > 16)
+    {
+        value = ac_get_bits(codec, 16);
+        bits -= 16;
+        shift = 16;
+    }
+    value |= ac_get_bits(codec, bits) << shift;
+    return ((2 | (slot & 1)) << ((slot >> 1) - 1)) | value;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Match finder
+//----------------------------------------------------------------------------------------------------------------------
+
+static inline uint32_t lz__hash(const uint8_t* p)
+{
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return (x * 2654435761U) >> (32 - LZ__HashLog);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static inline uint32_t lz__match_length(const uint8_t* a, const uint8_t* b, const uint8_t* end)
+{
+    const uint8_t* start = a;
+    while (a + 8 <= end)
+    {
+        uint64_t x, y;
+        memcpy(&x, a, 8);
+        memcpy(&y, b, 8);
+        if (x != y)
+            break;
+        a += 8;
+        b += 8;
+    }
+    while (a < end && *a == *b)
+    {
+        a++;
+        b++;
+    }
+    return (uint32_t)(a - start);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static inline void lz__insert(struct lz_codec* lz, const uint8_t* input, uint32_t pos)
+{
+    uint32_t h = lz__hash(input + pos);
+    lz->prev[pos & ((1U << lz->window_log) - 1)] = lz->head[h];
+    lz->head[h] = pos + 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Returns the length of the best match at pos (0 if none) and its distance. The previous distance is preferred if its
+// match is almost as long
+static uint32_t lz__find_match(struct lz_codec* lz, const uint8_t* input, uint32_t size, uint32_t pos,
+                               uint32_t last_distance, uint32_t* distance)
+{
+    if (pos + LZ__MinMatch > size)
+        return 0;
+
+    // the positions skipped by the last match are inserted now
+    for (; lz->next_insert < pos; lz->next_insert++)
+        lz__insert(lz, input, lz->next_insert);
+
+    uint32_t max_length = size - pos;
+    if (max_length > LZ__MaxMatch)
+        max_length = LZ__MaxMatch;
+
+    const uint8_t* current = input + pos;
+    const uint8_t* end = current + max_length;
+    uint32_t window = (1U << lz->window_log) - 1;
+    uint32_t limit = (pos > window) ? pos - window : 0;
+    uint32_t best_length = LZ__MinMatch - 1, best_distance = 0;
+
+    uint32_t candidate = lz->head[lz__hash(current)];
+    for (uint32_t chain = lz->max_chain; chain != 0 && candidate > limit; --chain)
+    {
+        uint32_t c = candidate - 1;
+        candidate = lz->prev[c & window];
+
+        // quick rejection on the byte that would make the match longer
+        if (input[c + best_length] != current[best_length])
+            continue;
+
+        uint32_t length = lz__match_length(current, input + c, end);
+        if (length > best_length)
+        {
+            best_length = length;
+            best_distance = pos - c;
+            if (length == max_length || length >= LZ__NiceMatch)
+                break;
+        }
+    }
+
+    lz__insert(lz, input, pos);
+    lz->next_insert = pos + 1;
+
+    if (last_distance != 0 && last_distance <= pos)
+    {
+        uint32_t length = lz__match_length(current, current - last_distance, end);
+        if (length >= LZ__MinMatch && length + 2 >= best_length)
+        {
+            best_length = length;
+            best_distance = last_distance;
+        }
+    }
+
+    *distance = best_distance;
+    return (best_length >= LZ__MinMatch) ? best_length : 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Compression
+//----------------------------------------------------------------------------------------------------------------------
+
+uint32_t lz_compress_bound(uint32_t size)
+{
+    return size + LZ__HeaderSize;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static inline void lz__encode_literal(struct lz_codec* lz, const uint8_t* input, uint32_t pos, uint32_t* state)
+{
+    ac_encode_bit(lz->codec, 0, &lz->is_match[*state]);
+    ac_encode_adaptive(lz->codec, input[pos], lz->literal[pos ? input[pos - 1] : 0]);
+    *state = (*state << 1) & (LZ__States - 1);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t lz_compress(struct lz_codec* lz, const uint8_t* input, uint32_t size, uint8_t* output, uint32_t capacity)
+{
+    if (capacity < lz_compress_bound(size))
+        return 0;
+
+    if (lz->head == NULL)
+    {
+        lz->head = (uint32_t*) LZ_ALLOC(sizeof(uint32_t) << LZ__HashLog);
+        lz->prev = (uint32_t*) LZ_ALLOC(sizeof(uint32_t) << lz->window_log);
+        assert(lz->head != NULL && lz->prev != NULL);
+    }
+    memset(lz->head, 0, sizeof(uint32_t) << LZ__HashLog);
+    lz->next_insert = 0;
+    lz__reset_models(lz);
+
+    // a literal costs at most 12 bits for its flag and 16 bits for its value: the coded tokens always fit in
+    // 4 bytes per input byte
+    assert(size < (1U << 30));
+    ac_set_buffer(lz->codec, size * 4 + 64, NULL);
+    ac_start_encoder(lz->codec);
+
+    uint32_t pos = 0, state = 0, last_distance = 0, distance = 0;
+    uint32_t length = lz__find_match(lz, input, size, 0, 0, &distance);
+    while (pos < size)
+    {
+        if (length == 0)
+        {
+            lz__encode_literal(lz, input, pos++, &state);
+            length = lz__find_match(lz, input, size, pos, last_distance, &distance);
+            continue;
+        }
+
+        // lazy evaluation: a longer match at the next position is worth a literal
+        uint32_t next_distance, next_length = 0;
+        if (length < LZ__LazyMatch)
+            next_length = lz__find_match(lz, input, size, pos + 1, last_distance, &next_distance);
+        if (next_length > length)
+        {
+            lz__encode_literal(lz, input, pos++, &state);
+            length = next_length;
+            distance = next_distance;
+            continue;
+        }
+
+        ac_encode_bit(lz->codec, 1, &lz->is_match[state]);
+        ac_encode_bit(lz->codec, distance == last_distance, &lz->is_rep[state]);
+        lz__encode_value(lz->codec, length - LZ__MinMatch, lz->length);
+        if (distance != last_distance)
+        {
+            uint32_t context = (length - LZ__MinMatch < LZ__DistanceContexts) ? length - LZ__MinMatch : LZ__DistanceContexts - 1;
+            lz__encode_value(lz->codec, distance - 1, lz->distance[context]);
+        }
+
+        state = ((state << 1) | 1) & (LZ__States - 1);
+        last_distance = distance;
+        pos += length;
+        length = lz__find_match(lz, input, size, pos, last_distance, &distance);
+    }
+
+    uint32_t compressed_size = ac_stop_encoder(lz->codec);
+    lz__write32(output + 1, size);
+
+    // incompressible data is stored
+    if (compressed_size >= size)
+    {
+        output[0] = lz__stored;
+        memcpy(output + LZ__HeaderSize, input, size);
+        return size + LZ__HeaderSize;
+    }
+
+    output[0] = lz__compressed;
+    memcpy(output + LZ__HeaderSize, ac_get_buffer(lz->codec), compressed_size);
+    return compressed_size + LZ__HeaderSize;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Decompression
+//----------------------------------------------------------------------------------------------------------------------
+
+uint32_t lz_decompressed_size(const uint8_t* input, uint32_t size)
+{
+    if (size < LZ__HeaderSize || input[0] > lz__compressed)
+        return 0;
+    return lz__read32(input + 1);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t lz_decompress(struct lz_codec* lz, const uint8_t* input, uint32_t size, uint8_t* output, uint32_t capacity)
+{
+    uint32_t output_size = lz_decompressed_size(input, size);
+    if ((output_size == 0 && size != LZ__HeaderSize) || output_size > capacity)
+        return 0;
+
+    if (input[0] == lz__stored)
+    {
+        if (size - LZ__HeaderSize != output_size)
+            return 0;
+        memcpy(output, input + LZ__HeaderSize, output_size);
+        return output_size;
+    }
+
+    lz__reset_models(lz);
+    ac_start_message_decoder(lz->codec, input + LZ__HeaderSize, size - LZ__HeaderSize);
+
+    uint32_t pos = 0, state = 0, last_distance = 0;
+    while (pos < output_size)
+    {
+        if (!ac_decode_bit(lz->codec, &lz->is_match[state]))
+        {
+            output[pos] = (uint8_t) ac_decode_adaptive(lz->codec, lz->literal[pos ? output[pos - 1] : 0]);
+            pos++;
+            state = (state << 1) & (LZ__States - 1);
+            continue;
+        }
+
+        uint32_t is_rep = ac_decode_bit(lz->codec, &lz->is_rep[state]);
+        uint32_t length = lz__decode_value(lz->codec, lz->length) + LZ__MinMatch;
+        uint32_t distance = last_distance;
+        if (!is_rep)
+        {
+            uint32_t context = (length - LZ__MinMatch < LZ__DistanceContexts) ? length - LZ__MinMatch : LZ__DistanceContexts - 1;
+            distance = lz__decode_value(lz->codec, lz->distance[context]) + 1;
+        }
+
+        if (distance == 0 || distance > pos || length > output_size - pos)
+        {
+            ac_stop_decoder(lz->codec);
+            return 0;
+        }
+
+        // overlapping copy, 8 bytes at a time when the source is far enough behind
+        uint8_t* dst = output + pos;
+        const uint8_t* src = dst - distance;
+        if (distance >= 8 && pos + length + 8 <= output_size)
+        {
+            for (uint32_t i = 0; i < length; i += 8)
+                memcpy(dst + i, src + i, 8);
+        }
+        else
+        {
+            for (uint32_t i = 0; i < length; ++i)
+                dst[i] = src[i];
+        }
+
+        state = ((state << 1) | 1) & (LZ__States - 1);
+        last_distance = distance;
+        pos += length;
+    }
+
+    ac_stop_decoder(lz->codec);
+    return output_size;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void lz_terminate(struct lz_codec* lz)
+{
+    ac_terminate(lz->codec);
+    for (uint32_t i = 0; i < 256; ++i)
+        adaptive_model_terminate(lz->literal[i]);
+    adaptive_model_terminate(lz->length);
+    for (uint32_t i = 0; i < LZ__DistanceContexts; ++i)
+        adaptive_model_terminate(lz->distance[i]);
+    if (lz->head != NULL)
+    {
+        LZ_FREE(lz->head);
+        LZ_FREE(lz->prev);
+    }
+    LZ_FREE(lz);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Block mode (see block_codec.h)
+//----------------------------------------------------------------------------------------------------------------------
+
+struct lz__params {uint32_t window_log, level;};
+
+static void* lz__block_init(const void* params)
+{
+    const struct lz__params* p = (const struct lz__params*) params;
+    return lz_init(p->window_log, p->level);
+}
+
+static void lz__block_terminate(void* lz) {lz_terminate((struct lz_codec*) lz);}
+static void* lz__alloc(size_t size) {return LZ_ALLOC(size);}
+static void lz__free(void* pointer) {LZ_FREE(pointer);}
+
+static uint32_t lz__block_compress(void* lz, const uint8_t* input, uint32_t size, uint8_t* output, uint32_t capacity)
+{
+    return lz_compress((struct lz_codec*) lz, input, size, output, capacity);
+}
+
+static uint32_t lz__block_decompress(void* lz, const uint8_t* input, uint32_t size, uint8_t* output, uint32_t capacity)
+{
+    return lz_decompress((struct lz_codec*) lz, input, size, output, capacity);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static struct block_codec lz__block_codec(const struct lz__params* params)
+{
+    struct block_codec desc = {lz__block_init, lz__block_terminate, lz__block_compress, lz__block_decompress,
+                               lz_compress_bound, lz__alloc, lz__free, params};
+    return desc;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t lz_blocks_bound(uint32_t size, uint32_t block_size)
+{
+    struct block_codec desc = lz__block_codec(NULL);
+    return block__bound(&desc, size, block_size);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t lz_compress_blocks(const uint8_t* input, uint32_t size, uint8_t* output, uint32_t capacity,
+                            uint32_t block_size, uint32_t window_log, uint32_t level, uint32_t num_threads)
+{
+    struct lz__params params = {window_log, level};
+    struct block_codec desc = lz__block_codec(&params);
+    return block__compress(&desc, input, size, output, capacity, block_size, num_threads);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t lz_blocks_decompressed_size(const uint8_t* input, uint32_t size)
+{
+    return block__decompressed_size(input, size);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+uint32_t lz_decompress_blocks(const uint8_t* input, uint32_t size, uint8_t* output, uint32_t capacity,
+                              uint32_t num_threads)
+{
+    // the match finder is only allocated to compress, the smallest settings do
+    struct lz__params params = {10, 1};
+    struct block_codec desc = lz__block_codec(&params);
+    return block__decompress(&desc, input, size, output, capacity, num_threads);
+}
+
+#endif // __LZ_CODEC__IMPLEMENTATION__
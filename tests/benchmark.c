@@ -0,0 +1,908 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+// Throughput benchmark of the different engines and models.
+// Configure with -DCMAKE_BUILD_TYPE=Release to get meaningful numbers.
+//
+// On Linux, hardware counters are collected with perf_event_open() and reported per symbol.
+// If the counters are not available (other OS, virtual machine, perf_event_paranoid too high) only the
+// throughput is reported.
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../arithmetic_codec.h"
+#include "../binary_codec.h"
+#include "../lz_codec.h"
+#include "../bwt_codec.h"
+#include "../column_codec.h"
+
+enum {num_symbols = 1 << 20};
+enum {num_runs = 5};
+enum {message_symbols = 256, message_buffer_size = 64 * 1024};     // small RPC-like messages
+enum {message_capacity = message_symbols * 2};
+enum {lz_size = 1 << 22, lz_block_size = 1 << 20, lz_threads = 4};
+enum {bwt_size = 1 << 22, bwt_block_size = 1 << 20, bwt_threads = 4};
+enum {column_size = 1 << 21, bitpack_block = 128};
+
+//----------------------------------------------------------------------------------------------------------------------
+// Hardware performance counters
+//----------------------------------------------------------------------------------------------------------------------
+
+enum {counter_cycles, counter_instructions, counter_branch_misses, counter_l1_misses, counter_llc_misses, num_counters};
+
+static const char* counter_names[num_counters] = {"cycles", "instr", "br-miss", "L1-miss", "LLC-miss"};
+
+struct perf_counters
+{
+    int fd[num_counters];
+    uint64_t value[num_counters];
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+static void perf_counters_init(struct perf_counters* counters)
+{
+#if defined(__linux__)
+    static const uint32_t types[num_counters] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+                                                 PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE};
+    static const uint64_t configs[num_counters] =
+    {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_BRANCH_MISSES,
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        PERF_COUNT_HW_CACHE_MISSES
+    };
+
+    for(uint32_t i=0; i<num_counters; ++i)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = types[i];
+        attr.size = sizeof(attr);
+        attr.config = configs[i];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.inherit = 1;   // the block benchmarks run on worker threads created after this point
+
+        // each counter is opened on its own so a missing one doesn't disable the others
+        counters->fd[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#else
+    for(uint32_t i=0; i<num_counters; ++i)
+        counters->fd[i] = -1;
+#endif
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static int perf_counters_available(const struct perf_counters* counters)
+{
+    for(uint32_t i=0; i<num_counters; ++i)
+        if (counters->fd[i] >= 0)
+            return 1;
+    return 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void perf_counters_start(struct perf_counters* counters)
+{
+    for(uint32_t i=0; i<num_counters; ++i)
+    {
+        counters->value[i] = 0;
+#if defined(__linux__)
+        if (counters->fd[i] >= 0)
+        {
+            // the reset doesn't clear the counts of the exited threads, so the value at start is subtracted at stop
+            ioctl(counters->fd[i], PERF_EVENT_IOC_RESET, 0);
+            if (read(counters->fd[i], &counters->value[i], sizeof(uint64_t)) != sizeof(uint64_t))
+                counters->value[i] = 0;
+            ioctl(counters->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void perf_counters_stop(struct perf_counters* counters)
+{
+#if defined(__linux__)
+    for(uint32_t i=0; i<num_counters; ++i)
+    {
+        if (counters->fd[i] < 0)
+            continue;
+
+        ioctl(counters->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        uint64_t value;
+        if (read(counters->fd[i], &value, sizeof(uint64_t)) == sizeof(uint64_t) && value >= counters->value[i])
+            counters->value[i] = value - counters->value[i];
+        else
+            counters->value[i] = 0;
+    }
+#else
+    (void) counters;
+#endif
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void perf_counters_terminate(struct perf_counters* counters)
+{
+#if defined(__linux__)
+    for(uint32_t i=0; i<num_counters; ++i)
+        if (counters->fd[i] >= 0)
+            close(counters->fd[i]);
+#else
+    (void) counters;
+#endif
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Harness
+//----------------------------------------------------------------------------------------------------------------------
+
+static struct perf_counters counters;
+
+//----------------------------------------------------------------------------------------------------------------------
+static double get_time(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Runs the kernel several times, reports the best throughput and the counters of the best run
+static void run_benchmark(const char* name, uint32_t symbols, void (*kernel)(void* user), void* user)
+{
+    double best_time = 1e30;
+    uint64_t best_counters[num_counters] = {0};
+
+    for(uint32_t run=0; run<num_runs; ++run)
+    {
+        perf_counters_start(&counters);
+        double start = get_time();
+        kernel(user);
+        double elapsed = get_time() - start;
+        perf_counters_stop(&counters);
+
+        if (elapsed < best_time)
+        {
+            best_time = elapsed;
+            memcpy(best_counters, counters.value, sizeof(best_counters));
+        }
+    }
+
+    printf("%-32s %8.1f Msym/s", name, (double)symbols / best_time * 1e-6);
+
+    for(uint32_t i=0; i<num_counters; ++i)
+    {
+        if (counters.fd[i] >= 0)
+            printf(" %8.2f", (double)best_counters[i] / (double)symbols);
+        else
+            printf(" %8s", "n/a");
+    }
+    printf("\n");
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void print_header(void)
+{
+    printf("%-32s %15s", "benchmark", "throughput");
+    for(uint32_t i=0; i<num_counters; ++i)
+        printf(" %8s", counter_names[i]);
+    printf("   (counters per symbol)\n");
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Test data: skewed distribution, symbol k has a probability roughly proportional to 1/(k+1)
+//----------------------------------------------------------------------------------------------------------------------
+
+static uint32_t random_state = 0x12345678;
+
+//----------------------------------------------------------------------------------------------------------------------
+static uint32_t random_next(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void generate_data(uint32_t* data, uint32_t count, uint32_t alphabet_size, float* probability)
+{
+    float sum = 0.f;
+    for(uint32_t k=0; k<alphabet_size; ++k)
+        sum += (probability[k] = 1.f / (float)(k + 1));
+
+    for(uint32_t k=0; k<alphabet_size; ++k)
+        probability[k] /= sum;
+
+    // inverse transform sampling
+    for(uint32_t i=0; i<count; ++i)
+    {
+        float u = (float)(random_next() >> 8) * (1.f / 16777216.f), cumulative = 0.f;
+        uint32_t k = 0;
+        while (k < alphabet_size - 1 && (cumulative += probability[k]) <= u)
+            ++k;
+        data[i] = k;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Kernels
+//----------------------------------------------------------------------------------------------------------------------
+
+struct codec_context
+{
+    struct arithmetic_codec* codec;
+    struct adaptive_model* adaptive;
+    struct static_model* model;
+    struct binary_codec* binary;
+    struct ac_codec_pool* pool;
+    uint8_t* binary_buffer;
+    uint8_t* messages;
+    uint32_t* message_sizes;
+    const uint32_t* data;
+    uint32_t* output;
+    uint32_t count, buffer_size, compressed_size;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+static void encode_adaptive(void* user)
+{
+    struct codec_context* ctx = (struct codec_context*) user;
+    adaptive_model_reset(ctx->adaptive);
+    ac_start_encoder(ctx->codec);
+    for(uint32_t i=0; i<ctx->count; ++i)
+        ac_encode_adaptive(ctx->codec, ctx->data[i], ctx->adaptive);
+    ctx->compressed_size = ac_stop_encoder(ctx->codec);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void decode_adaptive(void* user)
+{
+    struct codec_context* ctx = (struct codec_context*) user;
+    adaptive_model_reset(ctx->adaptive);
+    ac_start_decoder(ctx->codec);
+    for(uint32_t i=0; i<ctx->count; ++i)
+        ctx->output[i] = ac_decode_adaptive(ctx->codec, ctx->adaptive);
+    ac_stop_decoder(ctx->codec);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void encode_static(void* user)
+{
+    struct codec_context* ctx = (struct codec_context*) user;
+    ac_start_encoder(ctx->codec);
+    for(uint32_t i=0; i<ctx->count; ++i)
+        ac_encode_static(ctx->codec, ctx->data[i], ctx->model);
+    ctx->compressed_size = ac_stop_encoder(ctx->codec);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void decode_static(void* user)
+{
+    struct codec_context* ctx = (struct codec_context*) user;
+    ac_start_decoder(ctx->codec);
+    for(uint32_t i=0; i<ctx->count; ++i)
+        ctx->output[i] = ac_decode_static(ctx->codec, ctx->model);
+    ac_stop_decoder(ctx->codec);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void encode_bits(void* user)
+{
+    struct codec_context* ctx = (struct codec_context*) user;
+    ac_bit_model model = AC_BIT_MODEL_INIT;
+    ac_start_encoder(ctx->codec);
+    for(uint32_t i=0; i<ctx->count; ++i)
+        ac_encode_bit(ctx->codec, ctx->data[i] != 0, &model);
+    ctx->compressed_size = ac_stop_encoder(ctx->codec);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void decode_bits(void* user)
+{
+    struct codec_context* ctx = (struct codec_context*) user;
+    ac_bit_model model = AC_BIT_MODEL_INIT;
+    ac_start_decoder(ctx->codec);
+    for(uint32_t i=0; i<ctx->count; ++i)
+        ctx->output[i] = ac_decode_bit(ctx->codec, &model);
+    ac_stop_decoder(ctx->codec);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void encode_binary_codec(void* user)
+{
+    struct codec_context* ctx = (struct codec_context*) user;
+    bc_context context = BC_CONTEXT_INIT;
+    bc_start_encoder(ctx->binary, ctx->binary_buffer, ctx->buffer_size);
+    for(uint32_t i=0; i<ctx->count; ++i)
+        bc_encode_bit(ctx->binary, ctx->data[i] != 0, &context);
+    ctx->compressed_size = bc_stop_encoder(ctx->binary);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void decode_binary_codec(void* user)
+{
+    struct codec_context* ctx = (struct codec_context*) user;
+    bc_context context = BC_CONTEXT_INIT;
+    bc_start_decoder(ctx->binary, ctx->binary_buffer, ctx->compressed_size);
+    for(uint32_t i=0; i<ctx->count; ++i)
+        ctx->output[i] = bc_decode_bit(ctx->binary, &context);
+    bc_stop_decoder(ctx->binary);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void encode_message(struct arithmetic_codec* codec, const uint32_t* data)
+{
+    ac_bit_model model = AC_BIT_MODEL_INIT;
+    ac_start_encoder(codec);
+    for(uint32_t i=0; i<message_symbols; ++i)
+        ac_encode_bit(codec, data[i] != 0, &model);
+    ac_stop_encoder(codec);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void encode_messages_init(void* user)
+{
+    struct codec_context* ctx = (struct codec_context*) user;
+    for(uint32_t i=0; i+message_symbols<=ctx->count; i+=message_symbols)
+    {
+        struct arithmetic_codec* codec = ac_init();
+        ac_set_buffer(codec, message_buffer_size, NULL);
+        encode_message(codec, ctx->data + i);
+        ac_terminate(codec);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void encode_messages_pool(void* user)
+{
+    struct codec_context* ctx = (struct codec_context*) user;
+    for(uint32_t i=0; i+message_symbols<=ctx->count; i+=message_symbols)
+    {
+        struct arithmetic_codec* codec = ac_codec_pool_acquire(ctx->pool);
+        encode_message(codec, ctx->data + i);
+        ac_codec_pool_release(ctx->pool, codec);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void encode_messages_stack(void* user)
+{
+    struct codec_context* ctx = (struct codec_context*) user;
+    uint8_t buffer[message_symbols];
+    for(uint32_t i=0; i+message_symbols<=ctx->count; i+=message_symbols)
+    {
+        ac_bit_model model = AC_BIT_MODEL_INIT;
+        ac_start_message_encoder(ctx->codec, buffer, sizeof(buffer));
+        for(uint32_t j=0; j<message_symbols; ++j)
+            ac_encode_bit(ctx->codec, ctx->data[i+j] != 0, &model);
+        ac_stop_message_encoder(ctx->codec);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void encode_messages_static(void* user)
+{
+    struct codec_context* ctx = (struct codec_context*) user;
+    for(uint32_t m=0; m<ctx->count/message_symbols; ++m)
+    {
+        const uint32_t* data = ctx->data + m * message_symbols;
+        ac_start_message_encoder(ctx->codec, ctx->messages + m * message_capacity, message_capacity);
+        for(uint32_t i=0; i<message_symbols; ++i)
+            ac_encode_static(ctx->codec, data[i], ctx->model);
+        ctx->message_sizes[m] = ac_stop_message_encoder(ctx->codec);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void decode_messages_static(void* user)
+{
+    struct codec_context* ctx = (struct codec_context*) user;
+    for(uint32_t m=0; m<ctx->count/message_symbols; ++m)
+    {
+        uint32_t* output = ctx->output + m * message_symbols;
+        ac_start_message_decoder(ctx->codec, ctx->messages + m * message_capacity, ctx->message_sizes[m]);
+        for(uint32_t i=0; i<message_symbols; ++i)
+            output[i] = ac_decode_static(ctx->codec, ctx->model);
+        ac_stop_decoder(ctx->codec);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void encode_messages_batch(void* user)
+{
+    struct codec_context* ctx = (struct codec_context*) user;
+    uint8_t* buffers[AC_BATCH_LANES];
+    const uint32_t* symbols[AC_BATCH_LANES];
+    uint32_t count[AC_BATCH_LANES];
+
+    for(uint32_t m=0; m+AC_BATCH_LANES<=ctx->count/message_symbols; m+=AC_BATCH_LANES)
+    {
+        for(uint32_t lane=0; lane<AC_BATCH_LANES; ++lane)
+        {
+            buffers[lane] = ctx->messages + (m + lane) * message_capacity;
+            symbols[lane] = ctx->data + (m + lane) * message_symbols;
+            count[lane] = message_symbols;
+        }
+        ac_encode_static_batch(buffers, message_capacity, symbols, count, ctx->model, ctx->message_sizes + m);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void decode_messages_batch(void* user)
+{
+    struct codec_context* ctx = (struct codec_context*) user;
+    const uint8_t* messages[AC_BATCH_LANES];
+    uint32_t* output[AC_BATCH_LANES];
+    uint32_t count[AC_BATCH_LANES];
+
+    for(uint32_t m=0; m+AC_BATCH_LANES<=ctx->count/message_symbols; m+=AC_BATCH_LANES)
+    {
+        for(uint32_t lane=0; lane<AC_BATCH_LANES; ++lane)
+        {
+            messages[lane] = ctx->messages + (m + lane) * message_capacity;
+            output[lane] = ctx->output + (m + lane) * message_symbols;
+            count[lane] = message_symbols;
+        }
+        ac_decode_static_batch(messages, ctx->message_sizes + m, output, count, ctx->model);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// LZ77
+//----------------------------------------------------------------------------------------------------------------------
+
+struct lz_context
+{
+    struct lz_codec* lz;
+    uint8_t *data, *compressed, *output;
+    uint32_t capacity, compressed_size, blocks_size;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// Text-like data: words of a vocabulary with a skewed distribution, separators and numbers
+static void generate_text(uint8_t* data, uint32_t size)
+{
+    static const char* words[] = {"the", "of", "and", "a", "to", "in", "is", "you", "that", "it", "he", "was", "for",
+                                  "on", "are", "as", "with", "his", "they", "at", "be", "this", "have", "from", "or",
+                                  "one", "had", "by", "word", "but", "not", "what", "all", "were", "we", "when",
+                                  "your", "can", "said", "there", "use", "an", "each", "which", "she", "do", "how",
+                                  "their", "if", "will", "up", "other", "about", "out", "many", "then", "them"};
+    const uint32_t num_words = sizeof(words) / sizeof(words[0]);
+
+    uint32_t pos = 0;
+    while (pos < size)
+    {
+        uint32_t r = random_next();
+        const char* word = words[((r & 0xFFFF) * (r & 0xFFFF) >> 16) * num_words >> 16];
+        for (; *word != 0 && pos < size; word++)
+            data[pos++] = (uint8_t) *word;
+
+        if (pos < size)
+            data[pos++] = ((r >> 16) & 15) ? ' ' : (uint8_t)('0' + (r >> 28) % 10);
+        if (pos < size && ((r >> 20) & 63) == 0)
+            data[pos++] = '\n';
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void lz_compress_kernel(void* user)
+{
+    struct lz_context* ctx = (struct lz_context*) user;
+    ctx->compressed_size = lz_compress(ctx->lz, ctx->data, lz_size, ctx->compressed, ctx->capacity);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void lz_decompress_kernel(void* user)
+{
+    struct lz_context* ctx = (struct lz_context*) user;
+    lz_decompress(ctx->lz, ctx->compressed, ctx->compressed_size, ctx->output, lz_size);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void lz_compress_blocks_kernel(void* user)
+{
+    struct lz_context* ctx = (struct lz_context*) user;
+    ctx->blocks_size = lz_compress_blocks(ctx->data, lz_size, ctx->compressed, ctx->capacity, lz_block_size, 20, 6,
+                                          lz_threads);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void lz_decompress_blocks_kernel(void* user)
+{
+    struct lz_context* ctx = (struct lz_context*) user;
+    lz_decompress_blocks(ctx->compressed, ctx->blocks_size, ctx->output, lz_size, lz_threads);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Block-sorting
+//----------------------------------------------------------------------------------------------------------------------
+
+struct bwt_context
+{
+    struct bwt_codec* bwt;
+    uint8_t *data, *compressed, *output;
+    uint32_t capacity, compressed_size, blocks_size;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+static void bwt_compress_kernel(void* user)
+{
+    struct bwt_context* ctx = (struct bwt_context*) user;
+    ctx->compressed_size = bwt_compress(ctx->bwt, ctx->data, bwt_block_size, ctx->compressed, ctx->capacity);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void bwt_decompress_kernel(void* user)
+{
+    struct bwt_context* ctx = (struct bwt_context*) user;
+    bwt_decompress(ctx->bwt, ctx->compressed, ctx->compressed_size, ctx->output, bwt_block_size);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void bwt_compress_blocks_kernel(void* user)
+{
+    struct bwt_context* ctx = (struct bwt_context*) user;
+    ctx->blocks_size = bwt_compress_blocks(ctx->data, bwt_size, ctx->compressed, ctx->capacity, bwt_block_size,
+                                           bwt_threads);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void bwt_decompress_blocks_kernel(void* user)
+{
+    struct bwt_context* ctx = (struct bwt_context*) user;
+    bwt_decompress_blocks(ctx->compressed, ctx->blocks_size, ctx->output, bwt_size, bwt_threads);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Integer columns
+//----------------------------------------------------------------------------------------------------------------------
+
+struct column_context
+{
+    struct column_codec* column;
+    uint64_t *values, *output;
+    uint8_t* compressed;
+    uint32_t capacity, compressed_size, packed_size;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// Timestamps sampled every second with jitter, sorted ids with gaps, then values in a narrow range
+static void generate_columns(uint64_t* values, uint32_t count)
+{
+    uint64_t timestamp = 1700000000000ULL, id = 1ULL << 40;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        uint32_t r = random_next();
+        if (i < count / 3)
+            values[i] = (timestamp += 1000) + ((r & 15) == 0 ? (r >> 4) % 7 : 0);
+        else if (i < count / 3 * 2)
+            values[i] = id += 1 + (r & 63);
+        else
+            values[i] = 5000000000ULL + (r & 4095);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void column_compress_kernel(void* user)
+{
+    struct column_context* ctx = (struct column_context*) user;
+    ctx->compressed_size = column_compress(ctx->column, ctx->values, column_size, ctx->compressed, ctx->capacity);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void column_decompress_kernel(void* user)
+{
+    struct column_context* ctx = (struct column_context*) user;
+    column_decompress(ctx->column, ctx->compressed, ctx->compressed_size, ctx->output, column_size);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Baseline: zigzag deltas bit packed at the width of the largest one of each block
+static void bitpack_encode_kernel(void* user)
+{
+    struct column_context* ctx = (struct column_context*) user;
+    uint32_t* out = (uint32_t*) ctx->compressed;
+    uint64_t previous = 0;
+    for (uint32_t start = 0; start < column_size; start += bitpack_block)
+    {
+        uint64_t zigzag[bitpack_block], all = 0;
+        for (uint32_t i = 0; i < bitpack_block; ++i)
+        {
+            uint64_t delta = ctx->values[start + i] - previous;
+            previous = ctx->values[start + i];
+            all |= zigzag[i] = (delta << 1) ^ (uint64_t)((int64_t) delta >> 63);
+        }
+
+        uint32_t width = 0;
+        while (width < 64 && (all >> width) != 0)
+            ++width;
+        *out++ = width;
+
+        // at most 32 bits at a time in a 64 bits accumulator
+        uint64_t bits = 0;
+        uint32_t fill = 0;
+        for (uint32_t i = 0; i < bitpack_block; ++i)
+        {
+            for (uint32_t shift = 0; shift < width; shift += 32)
+            {
+                uint32_t n = (width - shift < 32) ? width - shift : 32;
+                bits |= ((zigzag[i] >> shift) & ((1ULL << n) - 1)) << fill;
+                if ((fill += n) >= 32)
+                {
+                    *out++ = (uint32_t) bits;
+                    bits >>= 32;
+                    fill -= 32;
+                }
+            }
+        }
+        if (fill != 0)
+            *out++ = (uint32_t) bits;
+    }
+    ctx->packed_size = (uint32_t)((uint8_t*) out - ctx->compressed);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void bitpack_decode_kernel(void* user)
+{
+    struct column_context* ctx = (struct column_context*) user;
+    const uint32_t* in = (const uint32_t*) ctx->compressed;
+    uint64_t previous = 0;
+    for (uint32_t start = 0; start < column_size; start += bitpack_block)
+    {
+        uint32_t width = *in++;
+        uint64_t bits = 0;
+        uint32_t fill = 0;
+        for (uint32_t i = 0; i < bitpack_block; ++i)
+        {
+            uint64_t zigzag = 0;
+            for (uint32_t shift = 0; shift < width; shift += 32)
+            {
+                uint32_t n = (width - shift < 32) ? width - shift : 32;
+                if (fill < n)
+                {
+                    bits |= (uint64_t) *in++ << fill;
+                    fill += 32;
+                }
+                zigzag |= (bits & ((1ULL << n) - 1)) << shift;
+                bits >>= n;
+                fill -= n;
+            }
+            previous += (zigzag >> 1) ^ (0 - (zigzag & 1));
+            ctx->output[start + i] = previous;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static int check_output(const struct codec_context* ctx, int binary)
+{
+    for(uint32_t i=0; i<ctx->count; ++i)
+    {
+        uint32_t expected = binary ? (ctx->data[i] != 0) : ctx->data[i];
+        if (ctx->output[i] != expected)
+        {
+            printf("decoding error at symbol %u\n", i);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+int main(void)
+{
+    static const uint32_t alphabet_sizes[] = {2, 16, 256, 2048};
+    char name[64];
+    int result = EXIT_SUCCESS;
+
+    uint32_t* data = (uint32_t*) malloc(num_symbols * sizeof(uint32_t));
+    uint32_t* output = (uint32_t*) malloc(num_symbols * sizeof(uint32_t));
+    float* probability = (float*) malloc(2048 * sizeof(float));
+
+    static const char* isa_names[] = {"scalar", "SSE4.2", "AVX2", "AVX-512"};
+    printf("kernels: %s\n", isa_names[ac_get_isa()]);
+
+    perf_counters_init(&counters);
+    if (!perf_counters_available(&counters))
+        printf("hardware counters not available, reporting throughput only\n\n");
+
+    print_header();
+
+    struct codec_context ctx;
+    ctx.codec = ac_init();
+    ctx.data = data;
+    ctx.output = output;
+    ctx.count = num_symbols;
+    ctx.buffer_size = num_symbols * 2 + 1024;
+    ac_set_buffer(ctx.codec, ctx.buffer_size, NULL);
+
+    for(uint32_t i=0; i<sizeof(alphabet_sizes)/sizeof(alphabet_sizes[0]); ++i)
+    {
+        uint32_t alphabet_size = alphabet_sizes[i];
+        generate_data(data, num_symbols, alphabet_size, probability);
+
+        ctx.adaptive = adaptive_model_init(alphabet_size);
+        ctx.model = static_model_init(alphabet_size, probability);
+
+        snprintf(name, sizeof(name), "encode adaptive %u", alphabet_size);
+        run_benchmark(name, num_symbols, encode_adaptive, &ctx);
+        snprintf(name, sizeof(name), "decode adaptive %u", alphabet_size);
+        run_benchmark(name, num_symbols, decode_adaptive, &ctx);
+        if (!check_output(&ctx, 0))
+            result = EXIT_FAILURE;
+
+        adaptive_model_set_sorted(ctx.adaptive, 1);
+        snprintf(name, sizeof(name), "encode sorted %u", alphabet_size);
+        run_benchmark(name, num_symbols, encode_adaptive, &ctx);
+        snprintf(name, sizeof(name), "decode sorted %u", alphabet_size);
+        run_benchmark(name, num_symbols, decode_adaptive, &ctx);
+        if (!check_output(&ctx, 0))
+            result = EXIT_FAILURE;
+
+        snprintf(name, sizeof(name), "encode static %u", alphabet_size);
+        run_benchmark(name, num_symbols, encode_static, &ctx);
+        snprintf(name, sizeof(name), "decode static %u", alphabet_size);
+        run_benchmark(name, num_symbols, decode_static, &ctx);
+        if (!check_output(&ctx, 0))
+            result = EXIT_FAILURE;
+
+        static_model_set_lookup(ctx.model, 1);
+        snprintf(name, sizeof(name), "decode lookup %u", alphabet_size);
+        run_benchmark(name, num_symbols, decode_static, &ctx);
+        if (!check_output(&ctx, 0))
+            result = EXIT_FAILURE;
+
+        static_model_set_cutoff(ctx.model, 1);
+        snprintf(name, sizeof(name), "decode cutoff %u", alphabet_size);
+        run_benchmark(name, num_symbols, decode_static, &ctx);
+        if (!check_output(&ctx, 0))
+            result = EXIT_FAILURE;
+
+        adaptive_model_terminate(ctx.adaptive);
+        static_model_terminate(ctx.model);
+    }
+
+    run_benchmark("encode bit model", num_symbols, encode_bits, &ctx);
+    run_benchmark("decode bit model", num_symbols, decode_bits, &ctx);
+    if (!check_output(&ctx, 1))
+        result = EXIT_FAILURE;
+
+    ctx.binary = bc_init();
+    ctx.binary_buffer = (uint8_t*) malloc(ctx.buffer_size);
+    run_benchmark("encode binary codec", num_symbols, encode_binary_codec, &ctx);
+    run_benchmark("decode binary codec", num_symbols, decode_binary_codec, &ctx);
+    if (!check_output(&ctx, 1))
+        result = EXIT_FAILURE;
+    bc_terminate(ctx.binary);
+    free(ctx.binary_buffer);
+
+    run_benchmark("encode messages ac_init", num_symbols, encode_messages_init, &ctx);
+    ctx.pool = ac_codec_pool_init(4, message_buffer_size, NULL);
+    run_benchmark("encode messages pool", num_symbols, encode_messages_pool, &ctx);
+    ac_codec_pool_terminate(ctx.pool);
+    run_benchmark("encode messages stack", num_symbols, encode_messages_stack, &ctx);
+
+    // independent messages sharing a static model, one after the other then interleaved
+    generate_data(data, num_symbols, 16, probability);
+    ctx.model = static_model_init(16, probability);
+    ctx.messages = (uint8_t*) malloc((num_symbols / message_symbols) * message_capacity);
+    ctx.message_sizes = (uint32_t*) malloc((num_symbols / message_symbols) * sizeof(uint32_t));
+    run_benchmark("encode messages static 16", num_symbols, encode_messages_static, &ctx);
+    run_benchmark("decode messages static 16", num_symbols, decode_messages_static, &ctx);
+    if (!check_output(&ctx, 0))
+        result = EXIT_FAILURE;
+    run_benchmark("encode messages batch 16", num_symbols, encode_messages_batch, &ctx);
+    run_benchmark("decode messages batch 16", num_symbols, decode_messages_batch, &ctx);
+    if (!check_output(&ctx, 0))
+        result = EXIT_FAILURE;
+    free(ctx.message_sizes);
+    free(ctx.messages);
+    static_model_terminate(ctx.model);
+
+    // LZ77 front end on text, throughput in MB/s of uncompressed data
+    struct lz_context lz;
+    lz.lz = lz_init(20, 6);
+    lz.capacity = lz_blocks_bound(lz_size, lz_block_size);
+    lz.data = (uint8_t*) malloc(lz_size);
+    lz.compressed = (uint8_t*) malloc(lz.capacity);
+    lz.output = (uint8_t*) malloc(lz_size);
+    generate_text(lz.data, lz_size);
+
+    run_benchmark("lz compress", lz_size, lz_compress_kernel, &lz);
+    run_benchmark("lz decompress", lz_size, lz_decompress_kernel, &lz);
+    if (memcmp(lz.data, lz.output, lz_size) != 0)
+        result = EXIT_FAILURE;
+    float ratio = (float) lz_size / (float) lz.compressed_size;
+
+    snprintf(name, sizeof(name), "lz compress blocks x%u", lz_threads);
+    run_benchmark(name, lz_size, lz_compress_blocks_kernel, &lz);
+    snprintf(name, sizeof(name), "lz decompress blocks x%u", lz_threads);
+    run_benchmark(name, lz_size, lz_decompress_blocks_kernel, &lz);
+    if (memcmp(lz.data, lz.output, lz_size) != 0)
+        result = EXIT_FAILURE;
+    printf("lz ratio %.2f, blocks of %u KB %.2f\n", ratio, lz_block_size >> 10, (float) lz_size / (float) lz.blocks_size);
+
+    lz_terminate(lz.lz);
+    free(lz.output);
+    free(lz.compressed);
+    free(lz.data);
+
+    // block-sorting on text, a single block then the block mode
+    struct bwt_context bwt;
+    bwt.bwt = bwt_init();
+    bwt.capacity = bwt_blocks_bound(bwt_size, bwt_block_size);
+    bwt.data = (uint8_t*) malloc(bwt_size);
+    bwt.compressed = (uint8_t*) malloc(bwt.capacity);
+    bwt.output = (uint8_t*) malloc(bwt_size);
+    generate_text(bwt.data, bwt_size);
+
+    run_benchmark("bwt compress", bwt_block_size, bwt_compress_kernel, &bwt);
+    run_benchmark("bwt decompress", bwt_block_size, bwt_decompress_kernel, &bwt);
+    if (memcmp(bwt.data, bwt.output, bwt_block_size) != 0)
+        result = EXIT_FAILURE;
+    ratio = (float) bwt_block_size / (float) bwt.compressed_size;
+
+    snprintf(name, sizeof(name), "bwt compress blocks x%u", bwt_threads);
+    run_benchmark(name, bwt_size, bwt_compress_blocks_kernel, &bwt);
+    memset(bwt.output, 0, bwt_size);
+    snprintf(name, sizeof(name), "bwt decompress blocks x%u", bwt_threads);
+    run_benchmark(name, bwt_size, bwt_decompress_blocks_kernel, &bwt);
+    if (memcmp(bwt.data, bwt.output, bwt_size) != 0)
+        result = EXIT_FAILURE;
+    printf("bwt ratio %.2f, blocks of %u KB %.2f\n", ratio, bwt_block_size >> 10,
+           (float) bwt_size / (float) bwt.blocks_size);
+
+    bwt_terminate(bwt.bwt);
+    free(bwt.output);
+    free(bwt.compressed);
+    free(bwt.data);
+
+    // integer columns, throughput in values per second
+    struct column_context col;
+    col.column = column_init();
+    col.capacity = column_compress_bound(column_size) + (column_size / bitpack_block) * 4;
+    col.values = (uint64_t*) malloc(column_size * sizeof(uint64_t));
+    col.output = (uint64_t*) malloc(column_size * sizeof(uint64_t));
+    col.compressed = (uint8_t*) malloc(col.capacity);
+    generate_columns(col.values, column_size);
+
+    run_benchmark("column compress", column_size, column_compress_kernel, &col);
+    run_benchmark("column decompress", column_size, column_decompress_kernel, &col);
+    if (memcmp(col.values, col.output, column_size * sizeof(uint64_t)) != 0)
+        result = EXIT_FAILURE;
+    run_benchmark("bitpack delta encode", column_size, bitpack_encode_kernel, &col);
+    run_benchmark("bitpack delta decode", column_size, bitpack_decode_kernel, &col);
+    if (memcmp(col.values, col.output, column_size * sizeof(uint64_t)) != 0)
+        result = EXIT_FAILURE;
+    printf("column %.2f bits per value, bitpack delta %.2f\n", (double) col.compressed_size * 8.0 / column_size,
+           (double) col.packed_size * 8.0 / column_size);
+
+    column_terminate(col.column);
+    free(col.compressed);
+    free(col.output);
+    free(col.values);
+
+    ac_terminate(ctx.codec);
+    perf_counters_terminate(&counters);
+    free(probability);
+    free(output);
+    free(data);
+
+    return result;
+}
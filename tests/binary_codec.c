@@ -0,0 +1,3 @@
+
+#define __BINARY_CODEC__IMPLEMENTATION__
+#include "../binary_codec.h"
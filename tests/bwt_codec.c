@@ -0,0 +1,3 @@
+
+#define __BWT_CODEC__IMPLEMENTATION__
+#include "../bwt_codec.h"
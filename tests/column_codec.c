@@ -0,0 +1,3 @@
+
+#define __COLUMN_CODEC__IMPLEMENTATION__
+#include "../column_codec.h"
@@ -0,0 +1,3 @@
+
+#define __LZ_CODEC__IMPLEMENTATION__
+#include "../lz_codec.h"
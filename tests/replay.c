@@ -0,0 +1,114 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+// Replay a trace log recorded with a library compiled with AC_TRACE (see ac_set_trace())
+//
+//      replay <trace file> [runs]
+//
+// Every encoder or decoder session of the log is re-encoded then decoded with the current library, see replay.h.
+// The decoded symbols are checked and the best throughput is reported.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "replay.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+static double get_time(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static uint8_t* load_file(const char* filename, size_t* size)
+{
+    FILE* f = fopen(filename, "rb");
+    if (f == NULL)
+        return NULL;
+
+    size_t capacity = 1 << 16;
+    uint8_t* data = (uint8_t*) malloc(capacity);
+    *size = 0;
+    for (size_t n; (n = fread(data + *size, 1, capacity - *size, f)) != 0; )
+    {
+        *size += n;
+        if (*size == capacity)
+            data = (uint8_t*) realloc(data, capacity *= 2);
+    }
+
+    fclose(f);
+    return data;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("usage: replay <trace file> [runs]\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t log_size;
+    uint8_t* log = load_file(argv[1], &log_size);
+    if (log == NULL)
+    {
+        printf("cannot open %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    struct replay replay;
+    const char* error = replay_parse(&replay, log, log_size);
+    free(log);
+    if (error != NULL)
+    {
+        printf("%s: %s\n", argv[1], error);
+        replay_terminate(&replay);
+        return EXIT_FAILURE;
+    }
+
+    uint32_t runs = (argc > 2) ? (uint32_t)atoi(argv[2]) : 5;
+    if (runs == 0)
+        runs = 1;
+
+    uint8_t* buffer = (uint8_t*) malloc(replay.buffer_size + 16);
+    uint32_t* sizes = (uint32_t*) malloc((replay.num_sessions + 1) * sizeof(uint32_t));
+    struct arithmetic_codec* codec = ac_init();
+
+    double encode_time = 1e30, decode_time = 1e30;
+    uint32_t compressed_size = 0, errors = 0;
+
+    for (uint32_t run = 0; run < runs; ++run)
+    {
+        double start = get_time();
+        compressed_size = replay_encode(&replay, codec, buffer, sizes);
+        double middle = get_time();
+        errors += replay_decode(&replay, codec, buffer, sizes);
+        double end = get_time();
+
+        if (middle - start < encode_time)
+            encode_time = middle - start;
+        if (end - middle < decode_time)
+            decode_time = end - middle;
+    }
+
+    printf("%u sessions, %u models, %u symbols, %u compressed bytes\n", replay.num_sessions, replay.num_models,
+           replay.num_symbols, compressed_size);
+    printf("encode %8.1f Msym/s\n", (double)replay.num_symbols / encode_time * 1e-6);
+    printf("decode %8.1f Msym/s\n", (double)replay.num_symbols / decode_time * 1e-6);
+
+    if (errors)
+        printf("%u decoding errors\n", errors);
+
+    ac_terminate(codec);
+    replay_terminate(&replay);
+    free(sizes);
+    free(buffer);
+
+    return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,543 @@
+#ifndef __REPLAY__
+#define __REPLAY__
+
+// Replay of the trace logs recorded with a library compiled with AC_TRACE (see ac_set_trace()), shared by the replay
+// tool and the unit tests.
+//
+// Every session of the log is encoded again with the same symbols, models and settings: an encoder session gives back
+// the bytes of the original encoder. Decoder sessions are replayed as encoder sessions. Model records restore the
+// settings and the state of the model before the next symbol.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../arithmetic_codec.h"
+
+struct replay_operation
+{
+    uint8_t op;             // START_ENCODER, STOP_ENCODER, a symbol (encode variant) or a model record
+    uint32_t model;         // index of the model, snapshot of a model record
+    uint32_t a, b;          // message session / number_of_bits, probability or context / symbol
+};
+
+// Content of a model record
+struct replay_snapshot
+{
+    uint32_t model;
+    uint32_t settings[4];   // fields of the record before the state or the distribution
+    uint32_t state_offset, state_size;
+    struct static_model* static_model;
+};
+
+struct replay_model
+{
+    uint32_t id, kind;      // kind is the op of the model records
+    uint32_t settings[4];   // of the allocated model
+    struct adaptive_model* adaptive;
+    struct static_model* static_model;      // owned by the snapshot
+    struct context_hash_model* context_hash;
+    struct tree_model* tree;
+};
+
+struct replay
+{
+    struct replay_operation* operations;
+    struct replay_snapshot* snapshots;
+    struct replay_model* models;
+    uint8_t* states;
+    uint32_t num_operations, operations_capacity;
+    uint32_t num_snapshots, snapshots_capacity;
+    uint32_t num_models, models_capacity;
+    uint32_t states_size, states_capacity;
+    uint32_t num_symbols, num_sessions;
+    uint32_t buffer_size;   // worst case of the encoded sessions
+};
+
+struct replay_reader
+{
+    const uint8_t *pointer, *end;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+static void* replay_reserve(void* array, uint32_t count, uint32_t* capacity, size_t item_size)
+{
+    if (count < *capacity)
+        return array;
+
+    *capacity = *capacity ? *capacity * 2 : 64;
+    return realloc(array, *capacity * item_size);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static int replay_read_varint(struct replay_reader* reader, uint32_t* value)
+{
+    uint32_t shift = 0, c;
+    *value = 0;
+    do
+    {
+        if (reader->pointer == reader->end || shift > 28)
+            return 0;
+        c = *reader->pointer++;
+        *value |= (c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    return 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static struct replay_operation* replay_push(struct replay* replay, uint32_t op, uint32_t model, uint32_t a, uint32_t b)
+{
+    replay->operations = (struct replay_operation*) replay_reserve(replay->operations, replay->num_operations,
+                                                   &replay->operations_capacity, sizeof(struct replay_operation));
+
+    struct replay_operation* o = &replay->operations[replay->num_operations++];
+    o->op = (uint8_t) op;
+    o->model = model;
+    o->a = a;
+    o->b = b;
+    return o;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Returns the index of the model with this id, adds it if needed. Returns UINT32_MAX if the id has another kind
+static uint32_t replay_find_model(struct replay* replay, uint32_t id, uint32_t kind)
+{
+    for (uint32_t i = 0; i < replay->num_models; ++i)
+        if (replay->models[i].id == id)
+            return (replay->models[i].kind == kind) ? i : UINT32_MAX;
+
+    replay->models = (struct replay_model*) replay_reserve(replay->models, replay->num_models,
+                                                           &replay->models_capacity, sizeof(struct replay_model));
+
+    struct replay_model* m = &replay->models[replay->num_models];
+    memset(m, 0, sizeof(struct replay_model));
+    m->id = id;
+    m->kind = kind;
+    return replay->num_models++;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Restore the settings and the state of a model
+static int replay_apply(struct replay* replay, uint32_t index)
+{
+    const struct replay_snapshot* s = &replay->snapshots[index];
+    struct replay_model* m = &replay->models[s->model];
+    const uint8_t* state = replay->states + s->state_offset;
+    int same = memcmp(m->settings, s->settings, sizeof(s->settings)) == 0;
+    memcpy(m->settings, s->settings, sizeof(s->settings));
+
+    switch (m->kind)
+    {
+    case AC_TRACE_ADAPTIVE_MODEL:
+        if (m->adaptive == NULL || !same)
+        {
+            if (m->adaptive != NULL)
+                adaptive_model_terminate(m->adaptive);
+            m->adaptive = adaptive_model_init(s->settings[0]);
+            adaptive_model_set_precision(m->adaptive, s->settings[1]);
+            adaptive_model_set_decay(m->adaptive, s->settings[2]);
+            adaptive_model_set_sorted(m->adaptive, (int) s->settings[3]);
+        }
+        if (s->state_size == 0)
+        {
+            adaptive_model_reset(m->adaptive);
+            return 1;
+        }
+        return adaptive_model_load_state(m->adaptive, state, s->state_size);
+
+    case AC_TRACE_STATIC_MODEL:
+        m->static_model = s->static_model;
+        return 1;
+
+    case AC_TRACE_CONTEXT_HASH_MODEL:
+        if (m->context_hash == NULL || !same)
+        {
+            if (m->context_hash != NULL)
+                context_hash_model_terminate(m->context_hash);
+            m->context_hash = context_hash_model_init(s->settings[0]);
+        }
+        if (s->state_size == 0)
+        {
+            context_hash_model_reset(m->context_hash);
+            return 1;
+        }
+        return context_hash_model_load_state(m->context_hash, state, s->state_size);
+
+    default:
+        if (m->tree == NULL || !same)
+        {
+            if (m->tree != NULL)
+                tree_model_terminate(m->tree);
+            m->tree = tree_model_init(s->settings[0], s->settings[1]);
+        }
+        if (s->state_size == 0)
+        {
+            tree_model_reset(m->tree);
+            return 1;
+        }
+        return tree_model_load_state(m->tree, state, s->state_size);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Read a model record, creates the model on its first record. Returns 0 if the record is invalid
+static int replay_parse_model(struct replay* replay, struct replay_reader* reader, uint32_t kind)
+{
+    uint32_t id, settings[4] = {0, 0, 0, 0}, num_settings = 0, size = 0;
+    if (!replay_read_varint(reader, &id))
+        return 0;
+
+    switch (kind)
+    {
+    case AC_TRACE_ADAPTIVE_MODEL: num_settings = 4; break;      // symbols, precision, decay, sorted
+    case AC_TRACE_STATIC_MODEL: num_settings = 4; break;        // symbols, precision, lookup, cutoff
+    case AC_TRACE_CONTEXT_HASH_MODEL: num_settings = 1; break;  // memory size
+    default: num_settings = 2;                                  // number of bits, max nodes
+    }
+
+    for (uint32_t i = 0; i < num_settings; ++i)
+        if (!replay_read_varint(reader, &settings[i]))
+            return 0;
+
+    // the asserts of the model functions
+    if (kind == AC_TRACE_ADAPTIVE_MODEL || kind == AC_TRACE_STATIC_MODEL)
+    {
+        if (settings[0] < 2 || settings[0] > 2048 || settings[1] < 12 || settings[1] > 16 ||
+            settings[0] > (1U << (settings[1] - 1)) || settings[3] > 1)
+            return 0;
+        if ((kind == AC_TRACE_ADAPTIVE_MODEL && settings[2] > 8) || (kind == AC_TRACE_STATIC_MODEL && settings[2] > 1))
+            return 0;
+    }
+    else if (kind == AC_TRACE_CONTEXT_HASH_MODEL && (settings[0] < 64 || settings[0] > (1U << 30)))
+        return 0;
+    else if (kind == AC_TRACE_TREE_MODEL && (settings[0] == 0 || settings[0] > 32 || settings[1] == 0))
+        return 0;
+
+    uint32_t model = replay_find_model(replay, id, kind);
+    if (model == UINT32_MAX)
+        return 0;
+
+    replay->snapshots = (struct replay_snapshot*) replay_reserve(replay->snapshots, replay->num_snapshots,
+                                                 &replay->snapshots_capacity, sizeof(struct replay_snapshot));
+    struct replay_snapshot* s = &replay->snapshots[replay->num_snapshots];
+    memset(s, 0, sizeof(struct replay_snapshot));
+    s->model = model;
+    memcpy(s->settings, settings, sizeof(settings));
+    s->state_offset = replay->states_size;
+
+    if (kind == AC_TRACE_STATIC_MODEL)
+    {
+        // convert back the cumulative distribution to probabilities
+        float probability[2048];
+        uint32_t previous = 0, value = 0, total = 1U << settings[1];
+        for (uint32_t k = 0; k <= settings[0]; ++k)
+        {
+            if (k < settings[0])
+            {
+                if (!replay_read_varint(reader, &value) || value < previous || value > total)
+                    return 0;
+            }
+            else
+                value = total;
+
+            if (k > 0)
+                probability[k-1] = (float)(value - previous) / (float)total;
+            previous = value;
+        }
+
+        s->static_model = static_model_init(settings[0], NULL);
+        static_model_set_precision(s->static_model, settings[1]);
+        static_model_set_distribution(s->static_model, settings[0], probability);
+        static_model_set_lookup(s->static_model, (int) settings[2]);
+        static_model_set_cutoff(s->static_model, (int) settings[3]);
+    }
+    else
+    {
+        if (!replay_read_varint(reader, &size) || size > (uint32_t)(reader->end - reader->pointer))
+            return 0;
+
+        if (replay->states_size + size > replay->states_capacity)
+        {
+            while (replay->states_size + size > replay->states_capacity)
+                replay->states_capacity *= 2;
+            replay->states = (uint8_t*) realloc(replay->states, replay->states_capacity);
+        }
+        memcpy(replay->states + replay->states_size, reader->pointer, size);
+        reader->pointer += size;
+        replay->states_size += size;
+        s->state_size = size;
+    }
+
+    // loading the state checks it against the settings
+    replay_push(replay, kind, model, replay->num_snapshots++, 0);
+    return replay_apply(replay, replay->num_snapshots - 1);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Read a symbol, returns 0 if it does not match its model
+static int replay_parse_symbol(struct replay* replay, struct replay_reader* reader, uint32_t op)
+{
+    uint32_t id, a = 0, b, kind, bytes;
+    switch (op)
+    {
+    case AC_TRACE_ENCODE_ADAPTIVE: case AC_TRACE_ENCODE_QUASI_STATIC: kind = AC_TRACE_ADAPTIVE_MODEL; bytes = 4; break;
+    case AC_TRACE_ENCODE_STATIC: kind = AC_TRACE_STATIC_MODEL; bytes = 4; break;
+    case AC_TRACE_ENCODE_CONTEXT_HASH: kind = AC_TRACE_CONTEXT_HASH_MODEL; bytes = 16; break;
+    default: kind = AC_TRACE_TREE_MODEL; bytes = 0;
+    }
+
+    if (!replay_read_varint(reader, &id) || (op == AC_TRACE_ENCODE_CONTEXT_HASH && !replay_read_varint(reader, &a)) ||
+        !replay_read_varint(reader, &b))
+        return 0;
+
+    uint32_t model = replay_find_model(replay, id, kind);
+    if (model == UINT32_MAX)
+        return 0;
+
+    // the model is defined by a record before its first symbol
+    const struct replay_model* m = &replay->models[model];
+    switch (kind)
+    {
+    case AC_TRACE_ADAPTIVE_MODEL:
+    case AC_TRACE_STATIC_MODEL:
+        if ((m->adaptive == NULL && m->static_model == NULL) || b >= m->settings[0])
+            return 0;
+        break;
+    case AC_TRACE_CONTEXT_HASH_MODEL:
+        if (m->context_hash == NULL || b > 255)
+            return 0;
+        break;
+    default:
+        if (m->tree == NULL || (m->settings[0] < 32 && b >= (1U << m->settings[0])))
+            return 0;
+        bytes = m->settings[0] * 2;
+    }
+
+    replay_push(replay, op, model, a, b);
+    replay->buffer_size += bytes;
+    return 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Returns NULL if the log can be replayed, an error message otherwise
+static const char* replay_parse(struct replay* replay, const uint8_t* log, size_t size)
+{
+    memset(replay, 0, sizeof(struct replay));
+    if (size < 4 || memcmp(log, "ACT2", 4) != 0)
+        return "not a trace log";
+
+    struct replay_reader reader = {log + 4, log + size};
+    replay->states_capacity = 4096;
+    replay->states = (uint8_t*) malloc(replay->states_capacity);
+
+    uint32_t a, b, session_start = UINT32_MAX;
+    while (reader.pointer != reader.end)
+    {
+        uint32_t op = *reader.pointer++;
+        switch (op)
+        {
+        case AC_TRACE_START_ENCODER:
+        case AC_TRACE_START_DECODER:
+        case AC_TRACE_START_MESSAGE_DECODER:
+            if (session_start != UINT32_MAX)
+                return "session started twice";
+            session_start = replay->num_operations;
+            replay_push(replay, AC_TRACE_START_ENCODER, 0, op == AC_TRACE_START_MESSAGE_DECODER, 0);
+            replay->buffer_size += 16;
+            break;
+
+        case AC_TRACE_STOP_ENCODER:
+        case AC_TRACE_STOP_DECODER:
+        case AC_TRACE_STOP_MESSAGE_ENCODER:
+            if (session_start == UINT32_MAX)
+                return "session stopped before its start";
+            if (op == AC_TRACE_STOP_MESSAGE_ENCODER)
+                replay->operations[session_start].a = 1;
+            replay_push(replay, AC_TRACE_STOP_ENCODER, 0, replay->operations[session_start].a, 0);
+            replay->num_sessions++;
+            session_start = UINT32_MAX;
+            break;
+
+        case AC_TRACE_START_DECODER_AT:
+        case AC_TRACE_SUSPEND_ENCODER:
+        case AC_TRACE_RESUME_ENCODER:
+            return "sessions started from a checkpoint or suspended cannot be replayed";
+
+        case AC_TRACE_PUT_BITS:
+        case AC_TRACE_GET_BITS:
+            if (session_start == UINT32_MAX || !replay_read_varint(&reader, &a) || !replay_read_varint(&reader, &b) ||
+                a == 0 || a > 20 || b >= (1U << a))
+                return "corrupted bits";
+            replay_push(replay, AC_TRACE_PUT_BITS, 0, a, b);
+            replay->buffer_size += 4;
+            replay->num_symbols++;
+            break;
+
+        case AC_TRACE_ENCODE_BIT:
+        case AC_TRACE_DECODE_BIT:
+            if (session_start == UINT32_MAX || !replay_read_varint(&reader, &a) || !replay_read_varint(&reader, &b) ||
+                a == 0 || a >= (1U << 12) || b > 1)
+                return "corrupted bit";
+            replay_push(replay, AC_TRACE_ENCODE_BIT, 0, a, b);
+            replay->buffer_size += 2;
+            replay->num_symbols++;
+            break;
+
+        case AC_TRACE_ENCODE_ADAPTIVE:
+        case AC_TRACE_DECODE_ADAPTIVE:
+        case AC_TRACE_ENCODE_QUASI_STATIC:
+        case AC_TRACE_DECODE_QUASI_STATIC:
+        case AC_TRACE_ENCODE_STATIC:
+        case AC_TRACE_DECODE_STATIC:
+        case AC_TRACE_ENCODE_TREE:
+        case AC_TRACE_DECODE_TREE:
+        case AC_TRACE_ENCODE_CONTEXT_HASH:
+        case AC_TRACE_DECODE_CONTEXT_HASH:
+            // the decode variant follows its encode variant
+            if ((op - AC_TRACE_ENCODE_BIT) & 1)
+                op--;
+            if (session_start == UINT32_MAX || !replay_parse_symbol(replay, &reader, op))
+                return "corrupted symbol";
+            replay->num_symbols++;
+            break;
+
+        case AC_TRACE_ADAPTIVE_MODEL:
+        case AC_TRACE_STATIC_MODEL:
+        case AC_TRACE_CONTEXT_HASH_MODEL:
+        case AC_TRACE_TREE_MODEL:
+            if (!replay_parse_model(replay, &reader, op))
+                return "corrupted model";
+            break;
+
+        default:
+            return "unknown operation";
+        }
+    }
+
+    // session interrupted by the end of the log
+    if (session_start != UINT32_MAX)
+    {
+        replay_push(replay, AC_TRACE_STOP_ENCODER, 0, replay->operations[session_start].a, 0);
+        replay->num_sessions++;
+    }
+
+    replay->buffer_size += 16;
+    return NULL;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Encode all sessions in the buffer (replay->buffer_size bytes), returns the total size
+static uint32_t replay_encode(struct replay* replay, struct arithmetic_codec* codec, uint8_t* buffer, uint32_t* sizes)
+{
+    uint32_t session = 0, offset = 0;
+
+    for (uint32_t i = 0; i < replay->num_operations; ++i)
+    {
+        const struct replay_operation* o = &replay->operations[i];
+        const struct replay_model* m = replay->models;
+        ac_bit_model probability;
+
+        switch (o->op)
+        {
+        case AC_TRACE_START_ENCODER:
+            if (o->a)
+                ac_start_message_encoder(codec, buffer + offset, replay->buffer_size - offset);
+            else
+            {
+                ac_set_buffer(codec, replay->buffer_size - offset, buffer + offset);
+                ac_start_encoder(codec);
+            }
+            break;
+        case AC_TRACE_STOP_ENCODER:
+            sizes[session] = o->a ? ac_stop_message_encoder(codec) : ac_stop_encoder(codec);
+            offset += sizes[session++];
+            break;
+        case AC_TRACE_PUT_BITS: ac_put_bits(codec, o->b, o->a); break;
+        case AC_TRACE_ENCODE_BIT:
+            probability = (ac_bit_model) o->a;
+            ac_encode_bit(codec, o->b, &probability);
+            break;
+        case AC_TRACE_ENCODE_ADAPTIVE: ac_encode_adaptive(codec, o->b, m[o->model].adaptive); break;
+        case AC_TRACE_ENCODE_QUASI_STATIC: ac_encode_quasi_static(codec, o->b, m[o->model].adaptive); break;
+        case AC_TRACE_ENCODE_STATIC: ac_encode_static(codec, o->b, m[o->model].static_model); break;
+        case AC_TRACE_ENCODE_TREE: ac_encode_tree(codec, o->b, m[o->model].tree); break;
+        case AC_TRACE_ENCODE_CONTEXT_HASH: ac_encode_context_hash(codec, o->b, o->a, m[o->model].context_hash); break;
+        default: replay_apply(replay, o->a);
+        }
+    }
+    return offset;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Decode all sessions, returns the number of errors
+static uint32_t replay_decode(struct replay* replay, struct arithmetic_codec* codec, uint8_t* buffer,
+                              const uint32_t* sizes)
+{
+    uint32_t session = 0, offset = 0, errors = 0;
+
+    for (uint32_t i = 0; i < replay->num_operations; ++i)
+    {
+        const struct replay_operation* o = &replay->operations[i];
+        const struct replay_model* m = replay->models;
+        ac_bit_model probability;
+        uint32_t value = o->b;
+
+        switch (o->op)
+        {
+        case AC_TRACE_START_ENCODER:
+            if (o->a)
+                ac_start_message_decoder(codec, buffer + offset, sizes[session]);
+            else
+            {
+                ac_set_buffer(codec, sizes[session], buffer + offset);
+                ac_start_decoder(codec);
+            }
+            break;
+        case AC_TRACE_STOP_ENCODER:
+            ac_stop_decoder(codec);
+            offset += sizes[session++];
+            break;
+        case AC_TRACE_PUT_BITS: value = ac_get_bits(codec, o->a); break;
+        case AC_TRACE_ENCODE_BIT:
+            probability = (ac_bit_model) o->a;
+            value = ac_decode_bit(codec, &probability);
+            break;
+        case AC_TRACE_ENCODE_ADAPTIVE: value = ac_decode_adaptive(codec, m[o->model].adaptive); break;
+        case AC_TRACE_ENCODE_QUASI_STATIC: value = ac_decode_quasi_static(codec, m[o->model].adaptive); break;
+        case AC_TRACE_ENCODE_STATIC: value = ac_decode_static(codec, m[o->model].static_model); break;
+        case AC_TRACE_ENCODE_TREE: value = ac_decode_tree(codec, m[o->model].tree); break;
+        case AC_TRACE_ENCODE_CONTEXT_HASH: value = ac_decode_context_hash(codec, o->a, m[o->model].context_hash); break;
+        default: replay_apply(replay, o->a);
+        }
+
+        errors += (value != o->b);
+    }
+    return errors;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static void replay_terminate(struct replay* replay)
+{
+    for (uint32_t i = 0; i < replay->num_models; ++i)
+    {
+        struct replay_model* m = &replay->models[i];
+        if (m->adaptive != NULL)
+            adaptive_model_terminate(m->adaptive);
+        if (m->context_hash != NULL)
+            context_hash_model_terminate(m->context_hash);
+        if (m->tree != NULL)
+            tree_model_terminate(m->tree);
+    }
+
+    for (uint32_t i = 0; i < replay->num_snapshots; ++i)
+        if (replay->snapshots[i].static_model != NULL)
+            static_model_terminate(replay->snapshots[i].static_model);
+
+    free(replay->operations);
+    free(replay->snapshots);
+    free(replay->models);
+    free(replay->states);
+    memset(replay, 0, sizeof(struct replay));
+}
+
+#endif // __REPLAY__
@@ -5,6 +5,14 @@
 #include <stdint.h>
 #include "greatest.h"
 #include "../arithmetic_codec.h"
+#include "../binary_codec.h"
+#include "../lz_codec.h"
+#include "../bwt_codec.h"
+#include "../column_codec.h"
+
+#ifdef AC_TRACE
+#include "replay.h"
+#endif
 
 enum {num_elements = 20};
 enum {local_buffer_size = 256};
@@ -89,14 +97,1863 @@ TEST put_get_bits(void)
     PASS();
 }
 
-GREATEST_MAIN_DEFS();
+TEST context_hash_model(void)
+{
+    enum {text_size = 4096};
+    static const char sentence[] = "the quick brown fox jumps over the lazy dog, ";
+    uint8_t text[text_size];
 
-int main(int argc, char **argv)
+    for(uint32_t i=0; i<text_size; ++i)
+        text[i] = (uint8_t)sentence[(i + i / 256) % (sizeof(sentence) - 1)];
+
+    // small budget to exercise the replacement policy
+    struct context_hash_model* model = context_hash_model_init(16384);
+    struct arithmetic_codec* codec = ac_init();
+
+    ac_set_buffer(codec, text_size, NULL);
+    ac_start_encoder(codec);
+
+    uint32_t context = 0;
+    for(uint32_t i=0; i<text_size; ++i)
+    {
+        ac_encode_context_hash(codec, text[i], context, model);
+        context = ((context << 8) | text[i]) & 0xffff;
+    }
+
+    uint32_t compressed_size = ac_stop_encoder(codec);
+    ASSERT_LT(compressed_size, text_size / 2);
+
+    ac_start_decoder(codec);
+    context_hash_model_reset(model);
+
+    context = 0;
+    for(uint32_t i=0; i<text_size; ++i)
+    {
+        uint32_t value = ac_decode_context_hash(codec, context, model);
+        ASSERT_EQ_FMT((uint32_t)text[i], value, "%d");
+        context = ((context << 8) | value) & 0xffff;
+    }
+
+    ac_stop_decoder(codec);
+    ac_terminate(codec);
+    context_hash_model_terminate(model);
+
+    PASS();
+}
+
+static uint32_t encode_adaptive_data(struct arithmetic_codec* codec, struct adaptive_model* model, const uint32_t* data, uint32_t count)
 {
-    GREATEST_MAIN_BEGIN();
+    adaptive_model_reset(model);
+    ac_start_encoder(codec);
+    for(uint32_t i=0; i<count; ++i)
+        ac_encode_adaptive(codec, data[i], model);
+    return ac_stop_encoder(codec);
+}
 
-    RUN_TEST(adaptive_model);
-    RUN_TEST(put_get_bits);
+TEST adaptive_model_decay(void)
+{
+    enum {count = 32768};
+    static uint32_t data[count];
+
+    // the dominant symbol changes every 4096 symbols
+    uint32_t seed = 1;
+    for(uint32_t i=0; i<count; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        data[i] = ((seed >> 16) & 3) ? (i / 4096) : ((seed >> 20) & 15);
+    }
+
+    struct adaptive_model* model = adaptive_model_init(16);
+    struct arithmetic_codec* codec = ac_init();
+    ac_set_buffer(codec, count, NULL);
+
+    uint32_t stationary_size = encode_adaptive_data(codec, model, data, count);
+
+    adaptive_model_set_decay(model, 4);
+    uint32_t decay_size = encode_adaptive_data(codec, model, data, count);
+    ASSERT_LT(decay_size, stationary_size - stationary_size / 4);
+
+    ac_start_decoder(codec);
+    adaptive_model_reset(model);
+
+    for(uint32_t i=0; i<count; ++i)
+    {
+        uint32_t value = ac_decode_adaptive(codec, model);
+        ASSERT_EQ_FMT(data[i], value, "%d");
+    }
+
+    ac_stop_decoder(codec);
+    ac_terminate(codec);
+    adaptive_model_terminate(model);
+
+    PASS();
+}
+
+TEST quasi_static_model(void)
+{
+    enum {count = 16384, block_size = 1024};
+    static uint32_t data[count];
+
+    uint32_t seed = 7;
+    for(uint32_t i=0; i<count; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        uint32_t r = (seed >> 16) & 255;
+        data[i] = (r * r * r) >> 19;   // skewed distribution over 32 symbols
+    }
+
+    struct adaptive_model* model = adaptive_model_init(32);
+    struct arithmetic_codec* codec = ac_init();
+    ac_set_buffer(codec, count, NULL);
+
+    uint32_t adaptive_size = encode_adaptive_data(codec, model, data, count);
+
+    adaptive_model_reset(model);
+    ac_start_encoder(codec);
+    for(uint32_t i=0; i<count; ++i)
+    {
+        ac_encode_quasi_static(codec, data[i], model);
+        if ((i % block_size) == block_size - 1)
+            adaptive_model_end_block(model);
+    }
+    uint32_t quasi_static_size = ac_stop_encoder(codec);
+    ASSERT_LT(quasi_static_size, adaptive_size + adaptive_size / 20);
+
+    adaptive_model_reset(model);
+    ac_start_decoder(codec);
+    for(uint32_t i=0; i<count; ++i)
+    {
+        uint32_t value = ac_decode_quasi_static(codec, model);
+        ASSERT_EQ_FMT(data[i], value, "%d");
+        if ((i % block_size) == block_size - 1)
+            adaptive_model_end_block(model);
+    }
+
+    ac_stop_decoder(codec);
+    ac_terminate(codec);
+    adaptive_model_terminate(model);
+
+    PASS();
+}
+
+TEST semi_static_blocks(void)
+{
+    enum {num_blocks = 4, block_size = 2048, alphabet_size = 64};
+    static uint32_t data[num_blocks][block_size];
+    uint32_t histogram[alphabet_size];
+    uint32_t frequency[num_blocks][alphabet_size];
+    uint32_t decoded_frequency[num_blocks][alphabet_size];
+    struct arithmetic_codec* codecs[num_blocks];
+    uint32_t sizes[num_blocks];
+
+    uint32_t seed = 3;
+    for(uint32_t b=0; b<num_blocks; ++b)
+    {
+        for(uint32_t i=0; i<block_size; ++i)
+        {
+            seed = seed * 1103515245 + 12345;
+            uint32_t r = (seed >> 16) & 63;
+            data[b][i] = ((r * r) >> 7) + b * 8;    // distribution drifts with the block
+        }
+    }
+
+    struct adaptive_model* table_model = adaptive_model_init(AC_FREQUENCY_MODEL_SYMBOLS);
+    struct static_model* model = static_model_init(alphabet_size, NULL);
+
+    for(uint32_t b=0; b<num_blocks; ++b)
+    {
+        codecs[b] = ac_init();
+        ac_set_buffer(codecs[b], block_size * 2, NULL);
+        ac_start_encoder(codecs[b]);
+
+        ac_histogram(data[b], block_size, alphabet_size, histogram);
+        ac_normalize_frequencies(alphabet_size, histogram, frequency[b]);
+
+        adaptive_model_reset(table_model);
+        ac_put_frequencies(codecs[b], table_model, alphabet_size, frequency[b], b ? frequency[b-1] : NULL);
+        static_model_set_frequencies(model, alphabet_size, frequency[b]);
+
+        for(uint32_t i=0; i<block_size; ++i)
+            ac_encode_static(codecs[b], data[b][i], model);
+
+        sizes[b] = ac_stop_encoder(codecs[b]);
+        ASSERT_LT(sizes[b], block_size * 6 / 8);
+    }
+
+    // sequential pass on the tables
+    for(uint32_t b=0; b<num_blocks; ++b)
+    {
+        ac_start_decoder(codecs[b]);
+        adaptive_model_reset(table_model);
+        ac_get_frequencies(codecs[b], table_model, alphabet_size, decoded_frequency[b], b ? decoded_frequency[b-1] : NULL);
+        ASSERT_MEM_EQ(frequency[b], decoded_frequency[b], sizeof(frequency[b]));
+    }
+
+    // blocks are independent, decode them in any order
+    for(uint32_t b=num_blocks; b-- > 0; )
+    {
+        static_model_set_frequencies(model, alphabet_size, decoded_frequency[b]);
+        for(uint32_t i=0; i<block_size; ++i)
+        {
+            uint32_t value = ac_decode_static(codecs[b], model);
+            ASSERT_EQ_FMT(data[b][i], value, "%d");
+        }
+        ac_stop_decoder(codecs[b]);
+        ac_terminate(codecs[b]);
+    }
+
+    adaptive_model_terminate(table_model);
+    static_model_terminate(model);
+
+    PASS();
+}
+
+TEST tree_model(void)
+{
+    enum {count = 4096};
+    static uint32_t data[count];
+
+    // 32 bits identifiers: few distinct upper bits, random lower bits
+    uint32_t seed = 11;
+    for(uint32_t i=0; i<count; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        data[i] = 0xC0DE0000U + ((seed >> 28) << 12) + ((seed >> 8) & 0xFF);
+    }
+
+    for(uint32_t pass=0; pass<2; ++pass)
+    {
+        // second pass with a small pool to use the shared levels
+        struct tree_model* model = tree_model_init(32, pass ? 64 : 1 << 20);
+        struct arithmetic_codec* codec = ac_init();
+        ac_set_buffer(codec, count * 4, NULL);
+
+        ac_start_encoder(codec);
+        for(uint32_t i=0; i<count; ++i)
+            ac_encode_tree(codec, data[i], model);
+        uint32_t compressed_size = ac_stop_encoder(codec);
+
+        // 4 random bits and 8 almost random bits per identifier
+        ASSERT_LT(compressed_size, count * 14 / 8);
+
+        tree_model_reset(model);
+        ac_start_decoder(codec);
+        for(uint32_t i=0; i<count; ++i)
+        {
+            uint32_t value = ac_decode_tree(codec, model);
+            ASSERT_EQ_FMT(data[i], value, "%x");
+        }
+
+        ac_stop_decoder(codec);
+        ac_terminate(codec);
+        tree_model_terminate(model);
+    }
+
+    PASS();
+}
+
+TEST model_precision(void)
+{
+    enum {count = 16384, alphabet_size = 64};
+    static uint32_t data[count];
+    float probability[alphabet_size];
+    uint32_t sizes[17] = {0};
+
+    // very skewed: symbol 0 most of the time
+    uint32_t seed = 5;
+    for(uint32_t i=0; i<count; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        data[i] = ((seed >> 16) & 1023) ? 0 : ((seed >> 8) & (alphabet_size - 1));
+    }
+
+    // every symbol must keep a non-empty interval at 12 bits
+    probability[0] = 0.97f;
+    for(uint32_t k=1; k<alphabet_size; ++k)
+        probability[k] = 0.03f / (alphabet_size - 1);
+
+    struct adaptive_model* model = adaptive_model_init(alphabet_size);
+    struct static_model* model_static = static_model_init(alphabet_size, probability);
+    struct arithmetic_codec* codec = ac_init();
+    ac_set_buffer(codec, count * 2, NULL);
+
+    for(uint32_t precision=12; precision<=16; ++precision)
+    {
+        adaptive_model_set_precision(model, precision);
+        static_model_set_precision(model_static, precision);
+        static_model_set_distribution(model_static, alphabet_size, probability);
+
+        ac_start_encoder(codec);
+        for(uint32_t i=0; i<count; ++i)
+        {
+            ac_encode_adaptive(codec, data[i], model);
+            ac_encode_static(codec, data[i], model_static);
+        }
+        sizes[precision] = ac_stop_encoder(codec);
+
+        adaptive_model_reset(model);
+        ac_start_decoder(codec);
+        for(uint32_t i=0; i<count; ++i)
+        {
+            ASSERT_EQ_FMT(data[i], ac_decode_adaptive(codec, model), "%d");
+            ASSERT_EQ_FMT(data[i], ac_decode_static(codec, model_static), "%d");
+        }
+        ac_stop_decoder(codec);
+    }
+
+    ASSERT_LT(sizes[16], sizes[12]);
+
+    // more than 1024 symbols at 16 bits: the truncated length lets the last symbol's values run past the decoder table
+    enum {large_alphabet = 2048};
+    for(uint32_t i=0; i<count; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        data[i] = ((seed >> 16) & 7) ? large_alphabet - 1 : (seed >> 8) & (large_alphabet - 1);
+    }
+    adaptive_model_set_alphabet(model, large_alphabet);
+    adaptive_model_set_precision(model, 16);
+    encode_adaptive_data(codec, model, data, count);
+
+    adaptive_model_reset(model);
+    ac_start_decoder(codec);
+    for(uint32_t i=0; i<count; ++i)
+        ASSERT_EQ_FMT(data[i], ac_decode_adaptive(codec, model), "%d");
+    ac_stop_decoder(codec);
+
+    ac_terminate(codec);
+    adaptive_model_terminate(model);
+    static_model_terminate(model_static);
+
+    PASS();
+}
+
+TEST static_lookup_table(void)
+{
+    enum {count = 8192, max_symbols = 300};
+    static const uint32_t alphabet_sizes[] = {3, 16, max_symbols};
+    static uint32_t data[count];
+    float probability[max_symbols];
+
+    struct arithmetic_codec* codec = ac_init();
+    ac_set_buffer(codec, count * 4, NULL);
+
+    for(uint32_t a=0; a<sizeof(alphabet_sizes)/sizeof(alphabet_sizes[0]); ++a)
+    {
+        uint32_t alphabet_size = alphabet_sizes[a];
+
+        // decreasing probabilities, the last symbol is the least likely one
+        float sum = 0.f;
+        for(uint32_t k=0; k<alphabet_size; ++k)
+            sum += probability[k] = 1.f / (float)(k + 1);
+        for(uint32_t k=0; k<alphabet_size; ++k)
+            probability[k] /= sum;
+
+        // plenty of last symbols to exercise the end of the table
+        uint32_t seed = 11;
+        for(uint32_t i=0; i<count; ++i)
+        {
+            seed = seed * 1103515245 + 12345;
+            data[i] = ((seed >> 16) & 3) ? (seed >> 8) % alphabet_size : alphabet_size - 1;
+        }
+
+        struct static_model* model = static_model_init(alphabet_size, probability);
+        static_model_set_lookup(model, 1);
+
+        for(uint32_t precision=12; precision<=16; precision+=4)
+        {
+            static_model_set_precision(model, precision);
+            static_model_set_distribution(model, alphabet_size, probability);
+
+            ac_start_encoder(codec);
+            for(uint32_t i=0; i<count; ++i)
+                ac_encode_static(codec, data[i], model);
+            ac_stop_encoder(codec);
+
+            ac_start_decoder(codec);
+            for(uint32_t i=0; i<count; ++i)
+                ASSERT_EQ_FMT(data[i], ac_decode_static(codec, model), "%d");
+            ac_stop_decoder(codec);
+
+            // same stream without the lookup table
+            static_model_set_lookup(model, 0);
+            ac_start_decoder(codec);
+            for(uint32_t i=0; i<count; ++i)
+                ASSERT_EQ_FMT(data[i], ac_decode_static(codec, model), "%d");
+            ac_stop_decoder(codec);
+            static_model_set_lookup(model, 1);
+        }
+
+        static_model_terminate(model);
+    }
+
+    ac_terminate(codec);
+    PASS();
+}
+
+TEST static_cutoff_table(void)
+{
+    enum {count = 16384, max_symbols = 2048};
+    static const uint32_t alphabet_sizes[] = {5, 100, max_symbols};
+    static uint32_t data[count], histogram[max_symbols], frequency[max_symbols];
+
+    struct arithmetic_codec* codec = ac_init();
+    ac_set_buffer(codec, count * 4, NULL);
+
+    for(uint32_t a=0; a<sizeof(alphabet_sizes)/sizeof(alphabet_sizes[0]); ++a)
+    {
+        uint32_t alphabet_size = alphabet_sizes[a];
+
+        // steep distribution: wide symbols at the start, many buckets with several boundaries in the tail
+        for(uint32_t k=0; k<alphabet_size; ++k)
+            histogram[k] = 1000000 / ((k + 1) * (k + 1));
+        ac_normalize_frequencies(alphabet_size, histogram, frequency);
+
+        uint32_t seed = 17;
+        for(uint32_t i=0; i<count; ++i)
+        {
+            seed = seed * 1103515245 + 12345;
+            data[i] = (seed >> 8) % alphabet_size;
+        }
+
+        struct static_model* model = static_model_init(alphabet_size, NULL);
+        static_model_set_cutoff(model, 1);
+
+        for(uint32_t precision=15; precision<=16; ++precision)
+        {
+            static_model_set_precision(model, precision);
+            static_model_set_frequencies(model, alphabet_size, frequency);
+
+            ac_start_encoder(codec);
+            for(uint32_t i=0; i<count; ++i)
+                ac_encode_static(codec, data[i], model);
+            ac_stop_encoder(codec);
+
+            ac_start_decoder(codec);
+            for(uint32_t i=0; i<count; ++i)
+                ASSERT_EQ_FMT(data[i], ac_decode_static(codec, model), "%d");
+            ac_stop_decoder(codec);
+        }
+
+        // the lookup table replaces the cutoff table
+        static_model_set_lookup(model, 1);
+        ac_start_decoder(codec);
+        for(uint32_t i=0; i<count; ++i)
+            ASSERT_EQ_FMT(data[i], ac_decode_static(codec, model), "%d");
+        ac_stop_decoder(codec);
+
+        static_model_terminate(model);
+    }
+
+    ac_terminate(codec);
+    PASS();
+}
+
+TEST sorted_adaptive_model(void)
+{
+    enum {count = 16384, block_size = 1024, max_symbols = 300};
+    static const uint32_t alphabet_sizes[] = {5, 40, max_symbols};
+    static uint32_t data[count];
+
+    struct arithmetic_codec* codec = ac_init();
+    ac_set_buffer(codec, count * 2, NULL);
+
+    for(uint32_t a=0; a<sizeof(alphabet_sizes)/sizeof(alphabet_sizes[0]); ++a)
+    {
+        uint32_t alphabet_size = alphabet_sizes[a];
+
+        // skewed towards the last symbols, which the remapping has to move to the front
+        uint32_t seed = 23;
+        for(uint32_t i=0; i<count; ++i)
+        {
+            seed = seed * 1103515245 + 12345;
+            uint32_t r = (seed >> 16) & 255;
+            data[i] = alphabet_size - 1 - ((r * r * r) >> 24) % alphabet_size;
+        }
+
+        struct adaptive_model* reference = adaptive_model_init(alphabet_size);
+        struct adaptive_model* model = adaptive_model_init(alphabet_size);
+        adaptive_model_set_decay(reference, 4);
+        adaptive_model_set_decay(model, 4);
+        adaptive_model_set_sorted(model, 1);
+
+        encode_adaptive_data(codec, reference, data, count);
+        encode_adaptive_data(codec, model, data, count);
+
+        // same statistics, only the order differs
+        for(uint32_t k=0; k<alphabet_size; ++k)
+            ASSERT_EQ(adaptive_model_get_symbol_count(reference, k), adaptive_model_get_symbol_count(model, k));
+
+        adaptive_model_reset(model);
+        ac_start_decoder(codec);
+        for(uint32_t i=0; i<count; ++i)
+            ASSERT_EQ_FMT(data[i], ac_decode_adaptive(codec, model), "%d");
+        ac_stop_decoder(codec);
+
+        // quasi-static mode sorts at the end of each block
+        adaptive_model_reset(model);
+        ac_start_encoder(codec);
+        for(uint32_t i=0; i<count; ++i)
+        {
+            ac_encode_quasi_static(codec, data[i], model);
+            if ((i % block_size) == block_size - 1)
+                adaptive_model_end_block(model);
+        }
+        ac_stop_encoder(codec);
+
+        adaptive_model_reset(model);
+        ac_start_decoder(codec);
+        for(uint32_t i=0; i<count; ++i)
+        {
+            ASSERT_EQ_FMT(data[i], ac_decode_quasi_static(codec, model), "%d");
+            if ((i % block_size) == block_size - 1)
+                adaptive_model_end_block(model);
+        }
+        ac_stop_decoder(codec);
+
+        adaptive_model_terminate(reference);
+        adaptive_model_terminate(model);
+    }
+
+    // more than 1024 symbols at 16 bits, the last rank is frequent but never beats the top ranks: its values can run
+    // past the decoder table
+    enum {large_alphabet = 2048};
+    uint32_t seed = 29;
+    for(uint32_t i=0; i<count; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        uint32_t r = (seed >> 16) & 15;
+        data[i] = (r < 10) ? r % 5 : (r < 15) ? (seed >> 4) % large_alphabet : large_alphabet - 1;
+    }
+
+    struct adaptive_model* model = adaptive_model_init(large_alphabet);
+    adaptive_model_set_precision(model, 16);
+    adaptive_model_set_sorted(model, 1);
+    encode_adaptive_data(codec, model, data, count);
+
+    adaptive_model_reset(model);
+    ac_start_decoder(codec);
+    for(uint32_t i=0; i<count; ++i)
+        ASSERT_EQ_FMT(data[i], ac_decode_adaptive(codec, model), "%d");
+    ac_stop_decoder(codec);
+    adaptive_model_terminate(model);
+
+    ac_terminate(codec);
+    PASS();
+}
+
+TEST binary_codec(void)
+{
+    enum {count = 65536, num_contexts = 8};
+    static uint32_t data[count];
+    static uint8_t buffer[count];
+
+    // bits of different skews, the context is the bit position, a few bypass bits mixed in
+    uint32_t seed = 29;
+    for(uint32_t i=0; i<count; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        uint32_t threshold = 1U << (i % num_contexts);
+        data[i] = ((seed >> 16) & 511) < threshold;
+    }
+
+    bc_context context[num_contexts];
+    for(uint32_t k=0; k<num_contexts; ++k)
+        context[k] = BC_CONTEXT_INIT;
+
+    struct binary_codec* codec = bc_init();
+    bc_start_encoder(codec, buffer, sizeof(buffer));
+    for(uint32_t i=0; i<count; ++i)
+    {
+        if ((i % 61) == 0)
+            bc_encode_bypass(codec, data[i]);
+        else
+            bc_encode_bit(codec, data[i], &context[i % num_contexts]);
+    }
+    uint32_t size = bc_stop_encoder(codec);
+
+    // same data with the multiply-based bit models
+    ac_bit_model model[num_contexts];
+    for(uint32_t k=0; k<num_contexts; ++k)
+        model[k] = AC_BIT_MODEL_INIT;
+
+    struct arithmetic_codec* reference = ac_init();
+    ac_set_buffer(reference, count, NULL);
+    ac_start_encoder(reference);
+    for(uint32_t i=0; i<count; ++i)
+        ac_encode_bit(reference, data[i], &model[i % num_contexts]);
+    uint32_t reference_size = ac_stop_encoder(reference);
+    ac_terminate(reference);
+
+    ASSERT_LT(size, reference_size + reference_size / 10);
+
+    // the codec can decode the stream again once stopped
+    for(uint32_t pass=0; pass<2; ++pass)
+    {
+        for(uint32_t k=0; k<num_contexts; ++k)
+            context[k] = BC_CONTEXT_INIT;
+
+        bc_start_decoder(codec, buffer, size);
+        for(uint32_t i=0; i<count; ++i)
+        {
+            uint32_t bit = ((i % 61) == 0) ? bc_decode_bypass(codec) : bc_decode_bit(codec, &context[i % num_contexts]);
+            ASSERT_EQ_FMT(data[i], bit, "%d");
+        }
+        bc_stop_decoder(codec);
+    }
+
+    bc_terminate(codec);
+    PASS();
+}
+
+TEST checkpoints(void)
+{
+    enum {count = 100000, interval = 1000, alphabet_size = 64};
+    enum {num_checkpoints = count / interval};
+    static uint32_t data[count];
+    struct ac_checkpoint checkpoint[num_checkpoints];
+    float probability[alphabet_size];
+
+    // skewed data with a few raw bits to exercise carries and long runs
+    uint32_t seed = 31;
+    for(uint32_t i=0; i<count; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        uint32_t r = (seed >> 16) & 255;
+        data[i] = (r * r) >> 10;
+    }
+
+    for(uint32_t k=0; k<alphabet_size; ++k)
+        probability[k] = (float)(alphabet_size - k) / (float)(alphabet_size * (alphabet_size + 1) / 2);
+
+    struct static_model* model = static_model_init(alphabet_size, probability);
+    struct arithmetic_codec* encoder = ac_init();
+    ac_set_buffer(encoder, count * 2, NULL);
+
+    ac_start_encoder(encoder);
+    for(uint32_t i=0; i<count; ++i)
+    {
+        if ((i % interval) == 0)
+            ac_get_checkpoint(encoder, i, &checkpoint[i / interval]);
+
+        if ((i % 97) == 0)
+            ac_put_bits(encoder, data[i], 6);
+        else
+            ac_encode_static(encoder, data[i], model);
+    }
+    uint32_t size = ac_stop_encoder(encoder);
+
+    // the split is chosen at decode time
+    static const uint32_t num_threads[] = {1, 3, 7, num_checkpoints};
+    struct arithmetic_codec* decoder = ac_init();
+    ac_set_buffer(decoder, size, ac_get_buffer(encoder));
+
+    for(uint32_t t=0; t<sizeof(num_threads)/sizeof(num_threads[0]); ++t)
+    {
+        for(uint32_t thread=0; thread<num_threads[t]; ++thread)
+        {
+            uint32_t first = checkpoint[thread * num_checkpoints / num_threads[t]].symbol_index;
+            uint32_t last = (thread + 1 < num_threads[t]) ?
+                            checkpoint[(thread + 1) * num_checkpoints / num_threads[t]].symbol_index : count;
+
+            ac_start_decoder_at(decoder, &checkpoint[thread * num_checkpoints / num_threads[t]]);
+            for(uint32_t i=first; i<last; ++i)
+            {
+                uint32_t value = ((i % 97) == 0) ? ac_get_bits(decoder, 6) : ac_decode_static(decoder, model);
+                ASSERT_EQ_FMT(data[i], value, "%d");
+            }
+            ac_stop_decoder(decoder);
+        }
+    }
+
+    ac_terminate(decoder);
+    ac_terminate(encoder);
+    static_model_terminate(model);
+    PASS();
+}
+
+TEST isa_dispatch(void)
+{
+    enum {count = 20000, alphabet_size = 300};
+    static uint32_t data[count], reference[alphabet_size], histogram[alphabet_size];
+    static uint8_t reference_stream[count * 2];
+
+    uint32_t seed = 37;
+    for(uint32_t i=0; i<count; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        uint32_t r = (seed >> 16) & 1023;
+        data[i] = (r * r) % alphabet_size;
+    }
+
+    enum ac_isa best = ac_get_isa();
+    struct adaptive_model* model = adaptive_model_init(alphabet_size);
+    struct arithmetic_codec* codec = ac_init();
+    ac_set_buffer(codec, count * 2, NULL);
+
+    // every variant supported by the CPU gives the same histogram and the same stream as the scalar one
+    uint32_t reference_size = 0;
+    for(int isa=AC_ISA_SCALAR; isa<=AC_ISA_AVX512; ++isa)
+    {
+        if (!ac_set_isa((enum ac_isa)isa))
+            continue;
+
+        ac_histogram(data, count, alphabet_size, histogram);
+        uint32_t size = encode_adaptive_data(codec, model, data, count);
+
+        if (isa == AC_ISA_SCALAR)
+        {
+            memcpy(reference, histogram, sizeof(reference));
+            memcpy(reference_stream, ac_get_buffer(codec), size);
+            reference_size = size;
+        }
+
+        ASSERT_MEM_EQ(reference, histogram, sizeof(reference));
+        ASSERT_EQ(reference_size, size);
+        ASSERT_MEM_EQ(reference_stream, ac_get_buffer(codec), size);
+
+        adaptive_model_reset(model);
+        ac_start_decoder(codec);
+        for(uint32_t i=0; i<count; ++i)
+            ASSERT_EQ_FMT(data[i], ac_decode_adaptive(codec, model), "%d");
+        ac_stop_decoder(codec);
+    }
+
+    ASSERT(ac_set_isa(best));
+    ac_terminate(codec);
+    adaptive_model_terminate(model);
+    PASS();
+}
+
+struct counting_allocator
+{
+    uint32_t num_allocations, live;
+};
+
+static void* counting_alloc(void* context, size_t size)
+{
+    struct counting_allocator* counter = (struct counting_allocator*) context;
+    counter->num_allocations++;
+    counter->live++;
+    return malloc(size);
+}
+
+static void counting_free(void* context, void* pointer)
+{
+    struct counting_allocator* counter = (struct counting_allocator*) context;
+    counter->live--;
+    free(pointer);
+}
+
+TEST allocator(void)
+{
+    enum {count = 5000, alphabet_size = 40};
+    static uint32_t data[count];
+    struct counting_allocator counter = {0, 0};
+    const struct ac_allocator allocator = {counting_alloc, counting_free, &counter};
+
+    uint32_t seed = 41;
+    for(uint32_t i=0; i<count; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        data[i] = ((seed >> 16) & 255) % alphabet_size;
+    }
+
+    struct arithmetic_codec* codec = ac_init_with_allocator(&allocator);
+    struct adaptive_model* model = adaptive_model_init_with_allocator(alphabet_size, &allocator);
+    struct static_model* uniform = static_model_init_with_allocator(alphabet_size, NULL, &allocator);
+    struct context_hash_model* hash = context_hash_model_init_with_allocator(4096, &allocator);
+    struct tree_model* tree = tree_model_init_with_allocator(16, 4096, &allocator);
+    ac_set_buffer(codec, count * 4, NULL);
+    adaptive_model_set_sorted(model, 1);
+    static_model_set_lookup(uniform, 1);
+
+    ac_start_encoder(codec);
+    for(uint32_t i=0; i<count; ++i)
+    {
+        ac_encode_adaptive(codec, data[i], model);
+        ac_encode_static(codec, data[i], uniform);
+        ac_encode_tree(codec, data[i] * 1000, tree);
+        ac_encode_context_hash(codec, data[i], i ? data[i-1] : 0, hash);
+    }
+    ac_stop_encoder(codec);
+
+    adaptive_model_reset(model);
+    tree_model_reset(tree);
+    context_hash_model_reset(hash);
+    ac_start_decoder(codec);
+    for(uint32_t i=0; i<count; ++i)
+    {
+        ASSERT_EQ_FMT(data[i], ac_decode_adaptive(codec, model), "%d");
+        ASSERT_EQ_FMT(data[i], ac_decode_static(codec, uniform), "%d");
+        ASSERT_EQ_FMT(data[i] * 1000, ac_decode_tree(codec, tree), "%d");
+        ASSERT_EQ_FMT(data[i], ac_decode_context_hash(codec, i ? data[i-1] : 0, hash), "%d");
+    }
+    ac_stop_decoder(codec);
+
+    // every allocation went through the allocator, and is released by terminate
+    ASSERT(counter.num_allocations >= 10);
+    tree_model_terminate(tree);
+    context_hash_model_terminate(hash);
+    static_model_terminate(uniform);
+    adaptive_model_terminate(model);
+    ac_terminate(codec);
+    ASSERT_EQ(0, counter.live);
+    PASS();
+}
+
+TEST codec_pool(void)
+{
+    enum {num_codecs = 4, buffer_size = 1024};
+    struct counting_allocator counter = {0, 0};
+    const struct ac_allocator allocator = {counting_alloc, counting_free, &counter};
+    struct ac_codec_pool* pool = ac_codec_pool_init(num_codecs, buffer_size, &allocator);
+    struct arithmetic_codec* codec[num_codecs];
+    struct ac_codec_pool_stats stats;
+    uint8_t buffer[local_buffer_size];
+
+    // no allocation once the pool is created
+    uint32_t num_allocations = counter.num_allocations;
+    for(uint32_t i=0; i<num_codecs; ++i)
+    {
+        codec[i] = ac_codec_pool_acquire(pool);
+        ASSERT(codec[i] != NULL);
+
+        ac_start_encoder(codec[i]);
+        for(uint32_t j=0; j<100; ++j)
+            ac_put_bits(codec[i], (i * 100 + j) & 255, 8);
+        ac_stop_encoder(codec[i]);
+
+        ac_start_decoder(codec[i]);
+        for(uint32_t j=0; j<100; ++j)
+            ASSERT_EQ_FMT((i * 100 + j) & 255, ac_get_bits(codec[i], 8), "%d");
+        ac_stop_decoder(codec[i]);
+    }
+    ASSERT_EQ(num_allocations, counter.num_allocations);
+    ASSERT_EQ(NULL, ac_codec_pool_acquire(pool));
+
+    // a codec comes back with its internal buffer after using a user buffer, a grown buffer is kept
+    ac_set_buffer(codec[0], local_buffer_size, buffer);
+    ac_set_buffer(codec[1], buffer_size * 4, NULL);
+    ac_codec_pool_release(pool, codec[0]);
+    ac_codec_pool_release(pool, codec[1]);
+    ac_codec_pool_release(pool, codec[2]);
+
+    ac_codec_pool_get_stats(pool, &stats);
+    ASSERT_EQ(num_codecs, stats.num_codecs);
+    ASSERT_EQ(1, stats.in_use);
+    ASSERT_EQ(num_codecs, stats.max_in_use);
+    ASSERT_EQ(buffer_size * 4, stats.max_buffer_size);
+    ASSERT_EQ(1, stats.num_failures);
+
+    struct arithmetic_codec* reused = ac_codec_pool_acquire(pool);
+    ASSERT(reused == codec[2]);
+    ASSERT(ac_get_buffer(codec[0]) != buffer);
+    ac_codec_pool_release(pool, reused);
+    ac_codec_pool_release(pool, codec[3]);
+
+    ac_codec_pool_terminate(pool);
+    ASSERT_EQ(0, counter.live);
+    PASS();
+}
+
+TEST small_messages(void)
+{
+    enum {num_messages = 2000, max_symbols = 120, alphabet_size = 12};
+    uint32_t data[max_symbols], bits[max_symbols];
+    uint8_t message[max_symbols * 2 + 16], reference[max_symbols * 2 + 16];
+    struct adaptive_model* model = adaptive_model_init(alphabet_size);
+    struct arithmetic_codec* codec = ac_init();
+    uint32_t seed = 43, message_bytes = 0, reference_bytes = 0, num_empty = 0;
+
+    for(uint32_t m=0; m<num_messages; ++m)
+    {
+        seed = seed * 1103515245 + 12345;
+        uint32_t count = (seed >> 16) % max_symbols;
+        for(uint32_t i=0; i<count; ++i)
+        {
+            seed = seed * 1103515245 + 12345;
+            uint32_t r = (seed >> 16) & 255;
+            data[i] = (r * r * alphabet_size) >> 16;
+            bits[i] = (r < 16);
+        }
+
+        // the message is checked against the regular flush
+        ac_bit_model bit_model = AC_BIT_MODEL_INIT;
+        adaptive_model_reset(model);
+        ac_set_buffer(codec, sizeof(reference), reference);
+        ac_start_encoder(codec);
+        for(uint32_t i=0; i<count; ++i)
+        {
+            ac_encode_adaptive(codec, data[i], model);
+            ac_encode_bit(codec, bits[i], &bit_model);
+        }
+        uint32_t reference_size = ac_stop_encoder(codec);
+        reference_bytes += reference_size;
+
+        bit_model = AC_BIT_MODEL_INIT;
+        adaptive_model_reset(model);
+        ac_start_message_encoder(codec, message, sizeof(message));
+        for(uint32_t i=0; i<count; ++i)
+        {
+            ac_encode_adaptive(codec, data[i], model);
+            ac_encode_bit(codec, bits[i], &bit_model);
+        }
+        uint32_t size = ac_stop_message_encoder(codec);
+        ASSERT(size == 0 || message[size-1] != 0);
+        ASSERT(size <= reference_size);
+        message_bytes += size;
+        num_empty += (size == 0);
+
+        // garbage after the message must not be read
+        memset(message + size, 0xA5, sizeof(message) - size);
+
+        bit_model = AC_BIT_MODEL_INIT;
+        adaptive_model_reset(model);
+        ac_start_message_decoder(codec, message, size);
+        for(uint32_t i=0; i<count; ++i)
+        {
+            ASSERT_EQ_FMT(data[i], ac_decode_adaptive(codec, model), "%d");
+            ASSERT_EQ_FMT(bits[i], ac_decode_bit(codec, &bit_model), "%d");
+        }
+        ac_stop_decoder(codec);
+    }
+
+    ASSERT(message_bytes + num_messages / 4 <= reference_bytes);
+    ASSERT(num_empty > 0);
+
+    ac_terminate(codec);
+    adaptive_model_terminate(model);
+    PASS();
+}
+
+TEST batch_messages(void)
+{
+    enum {max_symbols = 200, alphabet_size = 16, buffer_size = max_symbols + 16};
+    static uint32_t data[AC_BATCH_LANES][max_symbols], output[AC_BATCH_LANES][max_symbols];
+    static uint8_t buffer[AC_BATCH_LANES][buffer_size], reference[buffer_size];
+    uint8_t* buffers[AC_BATCH_LANES];
+    const uint8_t* messages[AC_BATCH_LANES];
+    const uint32_t* symbols[AC_BATCH_LANES];
+    uint32_t* decoded[AC_BATCH_LANES];
+    uint32_t count[AC_BATCH_LANES], sizes[AC_BATCH_LANES];
+    float probability[alphabet_size];
+
+    for(uint32_t k=0; k<alphabet_size; ++k)
+        probability[k] = (float)(k + 1) / (float)(alphabet_size * (alphabet_size + 1) / 2);
+
+    // messages of different lengths, one is empty
+    uint32_t seed = 47;
+    for(uint32_t lane=0; lane<AC_BATCH_LANES; ++lane)
+    {
+        seed = seed * 1103515245 + 12345;
+        count[lane] = (lane == 1) ? 0 : (seed >> 16) % max_symbols;
+        for(uint32_t i=0; i<count[lane]; ++i)
+        {
+            seed = seed * 1103515245 + 12345;
+            data[lane][i] = (seed >> 16) % alphabet_size;
+        }
+        buffers[lane] = buffer[lane];
+        messages[lane] = buffer[lane];
+        symbols[lane] = data[lane];
+        decoded[lane] = output[lane];
+    }
+
+    struct static_model* model = static_model_init(alphabet_size, probability);
+    struct arithmetic_codec* codec = ac_init();
+
+    for(uint32_t variant=0; variant<3; ++variant)
+    {
+        // all the decoder searches of the static model
+        static_model_set_lookup(model, variant == 1);
+        static_model_set_cutoff(model, variant == 2);
+
+        ac_encode_static_batch(buffers, buffer_size, symbols, count, model, sizes);
+
+        // each lane is the same message as the one encoded alone
+        for(uint32_t lane=0; lane<AC_BATCH_LANES; ++lane)
+        {
+            ac_start_message_encoder(codec, reference, buffer_size);
+            for(uint32_t i=0; i<count[lane]; ++i)
+                ac_encode_static(codec, data[lane][i], model);
+            ASSERT_EQ(ac_stop_message_encoder(codec), sizes[lane]);
+            ASSERT_MEM_EQ(reference, buffer[lane], sizes[lane]);
+        }
+
+        memset(output, 0, sizeof(output));
+        ac_decode_static_batch(messages, sizes, decoded, count, model);
+        ASSERT_MEM_EQ(data, output, sizeof(data));
+    }
+
+    ac_terminate(codec);
+    static_model_terminate(model);
+    PASS();
+}
+
+struct resume_models
+{
+    struct adaptive_model* adaptive;
+    struct context_hash_model* hash;
+    struct tree_model* tree;
+    ac_bit_model bit;
+};
+
+static void resume_models_init(struct resume_models* models)
+{
+    models->adaptive = adaptive_model_init(24);
+    adaptive_model_set_sorted(models->adaptive, 1);
+    models->hash = context_hash_model_init(1 << 12);
+    models->tree = tree_model_init(12, 256);
+    models->bit = AC_BIT_MODEL_INIT;
+}
+
+static void resume_models_terminate(struct resume_models* models)
+{
+    adaptive_model_terminate(models->adaptive);
+    context_hash_model_terminate(models->hash);
+    tree_model_terminate(models->tree);
+}
+
+// Fills the memory it returns with the byte of its context
+static void* pattern_alloc(void* context, size_t size)
+{
+    void* pointer = malloc(size);
+    memset(pointer, *(const uint8_t*) context, size);
+    return pointer;
+}
+
+static void pattern_free(void* context, void* pointer)
+{
+    (void) context;
+    free(pointer);
+}
+
+static void resume_encode(struct arithmetic_codec* codec, struct resume_models* models, uint32_t value)
+{
+    ac_encode_adaptive(codec, value % 24, models->adaptive);
+    ac_encode_context_hash(codec, value & 255, value % 3, models->hash);
+    ac_encode_tree(codec, value & 4095, models->tree);
+    ac_encode_bit(codec, value & 1, &models->bit);
+}
+
+TEST encoder_resume(void)
+{
+    enum {count = 4000, interval = 7, buffer_size = count * 8};
+    static uint32_t data[count];
+    static uint8_t reference[buffer_size], log[buffer_size], session[buffer_size], state[1 << 16];
+    uint32_t state_size[3];
+
+    uint32_t seed = 53;
+    for(uint32_t i=0; i<count; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        uint32_t r = (seed >> 16) & 1023;
+        data[i] = (r * r) >> 8;
+    }
+
+    struct arithmetic_codec* codec = ac_init();
+    struct resume_models models;
+    resume_models_init(&models);
+    ac_set_buffer(codec, buffer_size, reference);
+    ac_start_encoder(codec);
+    for(uint32_t i=0; i<count; ++i)
+        resume_encode(codec, &models, data[i]);
+    uint32_t reference_size = ac_stop_encoder(codec);
+    resume_models_terminate(&models);
+
+    // suspend often, the models are rebuilt from their saved state each time like in a new process
+    uint32_t log_size = 0, num_pending = 0;
+    struct ac_encoder_state encoder_state;
+    resume_models_init(&models);
+    ac_set_buffer(codec, buffer_size, session);
+    ac_start_encoder(codec);
+    for(uint32_t i=0; i<count; ++i)
+    {
+        resume_encode(codec, &models, data[i]);
+        if ((i % interval) != interval - 1)
+            continue;
+
+        uint32_t settled = ac_suspend_encoder(codec, &encoder_state);
+        memcpy(log + log_size, session, settled);
+        log_size += settled;
+        num_pending += (encoder_state.num_pending != 0);
+
+        state_size[0] = adaptive_model_save_state(models.adaptive, state);
+        ASSERT_EQ(adaptive_model_get_state_size(models.adaptive), state_size[0]);
+        state_size[1] = context_hash_model_save_state(models.hash, state + state_size[0]);
+        ASSERT_EQ(context_hash_model_get_state_size(models.hash), state_size[1]);
+        state_size[2] = tree_model_save_state(models.tree, state + state_size[0] + state_size[1]);
+        ASSERT_EQ(tree_model_get_state_size(models.tree), state_size[2]);
+        ac_bit_model bit = models.bit;
+
+        resume_models_terminate(&models);
+        resume_models_init(&models);
+        ASSERT(adaptive_model_load_state(models.adaptive, state, state_size[0]));
+        ASSERT(context_hash_model_load_state(models.hash, state + state_size[0], state_size[1]));
+        ASSERT(tree_model_load_state(models.tree, state + state_size[0] + state_size[1], state_size[2]));
+        ASSERT_FALSE(tree_model_load_state(models.tree, state, state_size[0]));
+        models.bit = bit;
+
+        memset(session, 0xA5, sizeof(session));
+        ac_resume_encoder(codec, &encoder_state);
+    }
+    uint32_t size = ac_stop_encoder(codec);
+    memcpy(log + log_size, session, size);
+    log_size += size;
+
+    // same stream as without interruption
+    ASSERT(num_pending > 0);
+    ASSERT_EQ(reference_size, log_size);
+    ASSERT_MEM_EQ(reference, log, log_size);
+
+    // corrupted states are rejected: child out of the pool, rank out of the alphabet or twice, broken distribution
+    uint32_t tree_size = tree_model_save_state(models.tree, state), word, saved;
+    uint8_t* root_child = state + 3 * sizeof(uint32_t) + 33 * sizeof(ac_bit_model);
+    memcpy(&saved, root_child, sizeof(uint32_t));
+    word = 1000000;
+    memcpy(root_child, &word, sizeof(uint32_t));
+    ASSERT_FALSE(tree_model_load_state(models.tree, state, tree_size));
+    memcpy(root_child, &saved, sizeof(uint32_t));
+    ASSERT(tree_model_load_state(models.tree, state, tree_size));
+
+    uint32_t adaptive_size = adaptive_model_save_state(models.adaptive, state);
+    uint8_t* rank = state + adaptive_size - 4 * 24;
+    const uint16_t bad_ranks[2] = {24, 1};
+    for (uint32_t i = 0; i < 2; ++i)
+    {
+        uint16_t first;
+        memcpy(&first, rank, sizeof(uint16_t));
+        memcpy(rank, &bad_ranks[i], sizeof(uint16_t));
+        ASSERT_FALSE(adaptive_model_load_state(models.adaptive, state, adaptive_size));
+        memcpy(rank, &first, sizeof(uint16_t));
+    }
+    uint8_t* distribution = state + 8 * sizeof(uint32_t) + sizeof(uint32_t);
+    memcpy(&saved, distribution, sizeof(uint32_t));
+    word = 0xFFFFFFFF;
+    memcpy(distribution, &word, sizeof(uint32_t));
+    ASSERT_FALSE(adaptive_model_load_state(models.adaptive, state, adaptive_size));
+    memcpy(distribution, &saved, sizeof(uint32_t));
+    ASSERT(adaptive_model_load_state(models.adaptive, state, adaptive_size));
+
+    // the state does not depend on the content of the memory given to the model
+    uint8_t patterns[2] = {0x00, 0xFF};
+    struct tree_model* trees[2];
+    for (uint32_t i = 0; i < 2; ++i)
+    {
+        const struct ac_allocator allocator = {pattern_alloc, pattern_free, &patterns[i]};
+        trees[i] = tree_model_init_with_allocator(12, 256, &allocator);
+        ac_set_buffer(codec, buffer_size, session);
+        ac_start_encoder(codec);
+        for (uint32_t j = 0; j < 100; ++j)
+            ac_encode_tree(codec, data[j] & 4095, trees[i]);
+        ac_stop_encoder(codec);
+    }
+    ASSERT_EQ(tree_model_get_state_size(trees[0]), tree_model_get_state_size(trees[1]));
+    tree_size = tree_model_save_state(trees[0], state);
+    tree_model_save_state(trees[1], log);
+    ASSERT_MEM_EQ(state, log, tree_size);
+    tree_model_terminate(trees[0]);
+    tree_model_terminate(trees[1]);
+
+    resume_models_terminate(&models);
+    ac_terminate(codec);
+    PASS();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+TEST chunked_output(void)
+{
+    enum {num_symbols = 20000, alphabet_size = 40, chunk_size = 16};
+    uint32_t* data = (uint32_t*) malloc(num_symbols * sizeof(uint32_t));
+    uint8_t* reference = (uint8_t*) malloc(num_symbols * 2);
+    uint8_t* gathered = (uint8_t*) malloc(num_symbols * 2);
+    struct adaptive_model* model = adaptive_model_init(alphabet_size);
+    struct counting_allocator counter = {0, 0};
+    struct ac_allocator allocator = {counting_alloc, counting_free, &counter};
+    struct ac_chunk_pool* pool = ac_chunk_pool_init(chunk_size, &allocator);
+    struct arithmetic_codec* codec = ac_init();
+    uint32_t seed = 7;
+
+    for(uint32_t run=0; run<4; ++run)
+    {
+        uint32_t count = num_symbols >> run;
+        for(uint32_t i=0; i<count; ++i)
+        {
+            seed = seed * 1103515245 + 12345;
+            uint32_t r = (seed >> 16) & 255;
+            data[i] = (r * r * alphabet_size) >> 16;
+        }
+
+        adaptive_model_reset(model);
+        ac_set_buffer(codec, num_symbols * 2, reference);
+        ac_start_encoder(codec);
+        for(uint32_t i=0; i<count; ++i)
+            ac_encode_adaptive(codec, data[i], model);
+        uint32_t reference_size = ac_stop_encoder(codec);
+
+        // the chunks must hold the same bytes as the contiguous output
+        const struct ac_chunk* chunks;
+        adaptive_model_reset(model);
+        ac_start_chunk_encoder(codec, pool);
+        for(uint32_t i=0; i<count; ++i)
+            ac_encode_adaptive(codec, data[i], model);
+        uint32_t num_chunks = ac_stop_chunk_encoder(codec, &chunks);
+
+        uint32_t size = 0;
+        for(uint32_t i=0; i<num_chunks; ++i)
+        {
+            ASSERT(i == num_chunks-1 || chunks[i].size == chunk_size);
+            memcpy(gathered + size, chunks[i].data, chunks[i].size);
+            size += (uint32_t) chunks[i].size;
+        }
+        ac_release_chunks(codec);
+        ASSERT_EQ_FMT(reference_size, size, "%u");
+        ASSERT_MEM_EQ(reference, gathered, size);
+
+        adaptive_model_reset(model);
+        ac_set_buffer(codec, size, gathered);
+        ac_start_decoder(codec);
+        for(uint32_t i=0; i<count; ++i)
+            ASSERT_EQ_FMT(data[i], ac_decode_adaptive(codec, model), "%d");
+        ac_stop_decoder(codec);
+    }
+
+    // released chunks are reused by the next encodings
+    ASSERT(counter.num_allocations <= (num_symbols * 2) / chunk_size + 2);
+
+    ac_terminate(codec);
+    ac_chunk_pool_terminate(pool);
+    ASSERT_EQ(0, counter.live);
+    adaptive_model_terminate(model);
+    free(gathered);
+    free(reference);
+    free(data);
+    PASS();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+TEST segmented_input(void)
+{
+    enum {num_symbols = 5000, alphabet_size = 40, max_segments = 1024};
+    uint32_t* data = (uint32_t*) malloc(num_symbols * sizeof(uint32_t));
+    uint8_t* buffer = (uint8_t*) malloc(num_symbols * 2);
+    struct ac_chunk segments[max_segments];
+    struct adaptive_model* model = adaptive_model_init(alphabet_size);
+    struct arithmetic_codec* codec = ac_init();
+    uint32_t seed = 11;
+
+    for(uint32_t run=0; run<8; ++run)
+    {
+        uint32_t count = num_symbols >> run;
+        for(uint32_t i=0; i<count; ++i)
+        {
+            seed = seed * 1103515245 + 12345;
+            uint32_t r = (seed >> 16) & 255;
+            data[i] = (r * r * alphabet_size) >> 16;
+        }
+
+        // odd runs have no trailing zeros, the decoder reads them past the last segment
+        adaptive_model_reset(model);
+        uint32_t size;
+        if (run & 1)
+        {
+            ac_start_message_encoder(codec, buffer, num_symbols * 2);
+            for(uint32_t i=0; i<count; ++i)
+                ac_encode_adaptive(codec, data[i], model);
+            size = ac_stop_message_encoder(codec);
+        }
+        else
+        {
+            ac_set_buffer(codec, num_symbols * 2, buffer);
+            ac_start_encoder(codec);
+            for(uint32_t i=0; i<count; ++i)
+                ac_encode_adaptive(codec, data[i], model);
+            size = ac_stop_encoder(codec);
+        }
+
+        // random split, with empty segments and segments smaller than the 4 bytes read at start
+        uint32_t num_segments = 0, offset = 0;
+        while (offset < size && num_segments < max_segments - 1)
+        {
+            seed = seed * 1103515245 + 12345;
+            uint32_t length = (seed >> 16) % (run * 4 + 3);
+            if (length > size - offset)
+                length = size - offset;
+            segments[num_segments].data = buffer + offset;
+            segments[num_segments++].size = length;
+            offset += length;
+        }
+        segments[num_segments].data = buffer + offset;
+        segments[num_segments++].size = size - offset;
+
+        adaptive_model_reset(model);
+        ac_start_segment_decoder(codec, segments, num_segments);
+        for(uint32_t i=0; i<count; ++i)
+            ASSERT_EQ_FMT(data[i], ac_decode_adaptive(codec, model), "%d");
+        ac_stop_decoder(codec);
+    }
+
+    // no input after a decode of other data: only zeros are read
+    memset(buffer, 0xFF, 64);
+    ac_set_buffer(codec, 64, buffer);
+    ac_start_decoder(codec);
+    ac_get_bits(codec, 16);
+    ac_stop_decoder(codec);
+
+    ac_start_segment_decoder(codec, NULL, 0);
+    ASSERT_EQ(0, ac_get_segment_bytes_left(codec));
+    for(uint32_t i=0; i<8; ++i)
+        ASSERT_EQ(0, ac_get_bits(codec, 16));
+    ac_stop_decoder(codec);
+
+    for(uint32_t i=0; i<4; ++i)
+    {
+        segments[i].data = buffer + i;
+        segments[i].size = 0;
+    }
+    ac_start_segment_decoder(codec, segments, 4);
+    for(uint32_t i=0; i<8; ++i)
+        ASSERT_EQ(0, ac_get_bits(codec, 16));
+    ac_stop_decoder(codec);
+
+    ac_terminate(codec);
+    adaptive_model_terminate(model);
+    free(buffer);
+    free(data);
+    PASS();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Text-like data: words of a small vocabulary with random separators
+static void generate_text(uint8_t* data, uint32_t size, uint32_t seed)
+{
+    static const char* words[] = {"arithmetic", "coding", "model", "symbol", "the", "range", "of", "a", "decoder",
+                                  "probability", "interval", "bits", "and", "adaptive", "static", "buffer"};
+    uint32_t pos = 0;
+    while (pos < size)
+    {
+        seed = seed * 1103515245 + 12345;
+        const char* word = words[(seed >> 16) & 15];
+        for (; *word != 0 && pos < size; word++)
+            data[pos++] = (uint8_t) *word;
+        if (pos < size)
+            data[pos++] = ((seed >> 24) & 7) ? ' ' : (uint8_t)('0' + ((seed >> 8) % 10));
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+TEST lz_codec(void)
+{
+    enum {size = 300000, block_size = 65536};
+    uint8_t* data = (uint8_t*) malloc(size);
+    uint8_t* output = (uint8_t*) malloc(size);
+    uint32_t capacity = lz_blocks_bound(size, block_size);
+    uint8_t* compressed = (uint8_t*) malloc(capacity);
+    struct lz_codec* lz = lz_init(16, 6);
+
+    generate_text(data, size, 1);
+    uint32_t compressed_size = lz_compress(lz, data, size, compressed, lz_compress_bound(size));
+    ASSERT(compressed_size != 0 && compressed_size < size / 4);
+    ASSERT_EQ_FMT(size, lz_decompressed_size(compressed, compressed_size), "%u");
+    ASSERT_EQ_FMT(size, lz_decompress(lz, compressed, compressed_size, output, size), "%u");
+    ASSERT_MEM_EQ(data, output, size);
+
+    // output too small
+    ASSERT_EQ(0, lz_compress(lz, data, size, compressed, lz_compress_bound(size) - 1));
+    ASSERT_EQ(0, lz_decompress(lz, compressed, compressed_size, output, size - 1));
+
+    // a truncated stream must not decode out of bounds
+    lz_decompress(lz, compressed, compressed_size / 2, output, size);
+
+    // incompressible data is stored, small inputs are handled
+    uint32_t seed = 3;
+    for (uint32_t i = 0; i < 1000; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (uint8_t)(seed >> 24);
+    }
+    for (uint32_t n = 0; n <= 1000; n += (n < 16) ? 1 : 197)
+    {
+        compressed_size = lz_compress(lz, data, n, compressed, lz_compress_bound(n));
+        ASSERT(compressed_size != 0 && compressed_size <= lz_compress_bound(n));
+        ASSERT_EQ_FMT(n, lz_decompress(lz, compressed, compressed_size, output, size), "%u");
+        ASSERT_MEM_EQ(data, output, n);
+    }
+
+    // blocks give the same output whatever the number of threads
+    generate_text(data, size, 2);
+    uint32_t single_size = lz_compress_blocks(data, size, compressed, capacity, block_size, 16, 6, 1);
+    ASSERT(single_size != 0);
+    uint8_t* single = (uint8_t*) malloc(single_size);
+    memcpy(single, compressed, single_size);
+
+    for (uint32_t num_threads = 1; num_threads <= 8; num_threads *= 2)
+    {
+        ASSERT_EQ_FMT(single_size, lz_compress_blocks(data, size, compressed, capacity, block_size, 16, 6, num_threads), "%u");
+        ASSERT_MEM_EQ(single, compressed, single_size);
+        ASSERT_EQ_FMT(size, lz_blocks_decompressed_size(compressed, single_size), "%u");
+        memset(output, 0, size);
+        ASSERT_EQ_FMT(size, lz_decompress_blocks(compressed, single_size, output, size, num_threads), "%u");
+        ASSERT_MEM_EQ(data, output, size);
+    }
+    ASSERT_EQ(0, lz_decompress_blocks(compressed, single_size - 1, output, size, 4));
+
+    lz_terminate(lz);
+    free(single);
+    free(compressed);
+    free(output);
+    free(data);
+    PASS();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Returns the compressed size, 0 if the block does not decode to the input
+static uint32_t bwt_roundtrip(struct bwt_codec* bwt, const uint8_t* data, uint32_t size, uint8_t* compressed,
+                              uint8_t* output)
+{
+    uint32_t compressed_size = bwt_compress(bwt, data, size, compressed, bwt_compress_bound(size));
+    memset(output, 0, size);
+    if (compressed_size == 0 || bwt_decompress(bwt, compressed, compressed_size, output, size) != size ||
+        memcmp(data, output, size) != 0)
+        return 0;
+    return compressed_size;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+TEST bwt_codec(void)
+{
+    enum {size = 1 << 24, text_size = 300000, block_size = 65536};
+    uint8_t* data = (uint8_t*) malloc(size);
+    uint8_t* output = (uint8_t*) malloc(size);
+    uint8_t* compressed = (uint8_t*) malloc(bwt_compress_bound(size));
+    struct bwt_codec* bwt = bwt_init();
+
+    generate_text(data, text_size, 3);
+    uint32_t compressed_size = bwt_roundtrip(bwt, data, text_size, compressed, output);
+    ASSERT(compressed_size != 0 && compressed_size < text_size / 4);
+
+    // blocks of a single symbol: a rank, then a run for the rest of the block
+    for (uint32_t c = 0; c < 256; c += 255)
+    {
+        data[0] = (uint8_t) c;
+        ASSERT(bwt_roundtrip(bwt, data, 1, compressed, output) != 0);
+        memset(data, (int) c, 1000);
+        ASSERT(bwt_roundtrip(bwt, data, 1000, compressed, output) != 0);
+    }
+
+    // runs are bijective base-2 numbers of RUNA/RUNB digits: k digits code the lengths 2^k - 1 to 2^(k+1) - 2
+    for (uint32_t k = 1; k <= 16; ++k)
+    {
+        for (uint32_t length = (1U << k) - 2; length <= (1U << k) + 1; ++length)
+        {
+            if (length == 0)
+                continue;
+
+            memset(data, 'z', length);
+            ASSERT(bwt_roundtrip(bwt, data, length, compressed, output) != 0);
+
+            memset(data, 'a', length);
+            memset(data + length, 'b', length);
+            ASSERT(bwt_roundtrip(bwt, data, length * 2, compressed, output) != 0);
+        }
+    }
+
+    // from 16 MB the inverse transform does not pack the character with the next row
+    for (uint32_t i = 0, seed = 5; i < size; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (i & 4095) ? (uint8_t)(i >> 21) : (uint8_t)(seed >> 24);
+    }
+    compressed_size = bwt_roundtrip(bwt, data, size, compressed, output);
+    ASSERT(compressed_size != 0 && compressed_size < size / 256);
+
+    // blocks give the same output whatever the number of threads
+    uint32_t capacity = bwt_blocks_bound(text_size, block_size);
+    uint8_t* single = (uint8_t*) malloc(capacity);
+    generate_text(data, text_size, 4);
+    uint32_t single_size = bwt_compress_blocks(data, text_size, single, capacity, block_size, 1);
+    ASSERT(single_size != 0);
+    for (uint32_t num_threads = 2; num_threads <= 8; num_threads *= 2)
+    {
+        uint32_t blocks_size = bwt_compress_blocks(data, text_size, compressed, capacity, block_size, num_threads);
+        ASSERT_EQ_FMT(single_size, blocks_size, "%u");
+        ASSERT_MEM_EQ(single, compressed, single_size);
+        memset(output, 0, text_size);
+        uint32_t output_size = bwt_decompress_blocks(compressed, single_size, output, text_size, num_threads);
+        ASSERT_EQ_FMT((uint32_t) text_size, output_size, "%u");
+        ASSERT_MEM_EQ(data, output, text_size);
+    }
+
+    bwt_terminate(bwt);
+    free(single);
+    free(compressed);
+    free(output);
+    free(data);
+    PASS();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Returns the compressed size, 0 if the column does not decode to the input with every prefix sum variant
+static uint32_t column_roundtrip(struct column_codec* column, const uint64_t* values, uint32_t count,
+                                 uint8_t* compressed, uint64_t* output)
+{
+    uint32_t compressed_size = column_compress(column, values, count, compressed, column_compress_bound(count));
+    if (compressed_size == 0 || column_decompressed_count(compressed, compressed_size) != count)
+        return 0;
+
+    enum ac_isa best = ac_get_isa();
+    for (int isa = AC_ISA_SCALAR; isa <= AC_ISA_AVX512 && compressed_size != 0; ++isa)
+    {
+        if (!ac_set_isa((enum ac_isa) isa))
+            continue;
+        memset(output, 0, count * sizeof(uint64_t));
+        if (column_decompress(column, compressed, compressed_size, output, count) != count ||
+            memcmp(values, output, count * sizeof(uint64_t)) != 0)
+            compressed_size = 0;
+    }
+    ac_set_isa(best);
+    return compressed_size;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+TEST column_codec(void)
+{
+    enum {block = 128, count = block * 8 - 37};
+    uint64_t* values = (uint64_t*) malloc(count * sizeof(uint64_t));
+    uint64_t* output = (uint64_t*) malloc(count * sizeof(uint64_t));
+    uint8_t* compressed = (uint8_t*) malloc(column_compress_bound(count));
+    struct column_codec* column = column_init();
+    uint32_t seed = 1;
+
+    // one block per prediction, the size bound is only met by the expected one
+    // delta-of-delta: timestamps every second with a single jitter, a delta costs 10 bits under its leading one
+    for (uint32_t i = 0; i < block; ++i)
+        values[i] = 1700000000000ULL + i * 1000 + (i == 64);
+    uint32_t compressed_size = column_roundtrip(column, values, block, compressed, output);
+    ASSERT(compressed_size != 0 && compressed_size < 100);
+
+    // delta: ids allocated in pairs, a delta-of-delta costs 21 bits under its leading one
+    for (uint32_t i = 0; i < block; ++i)
+        values[block + i] = (i == 0) ? (1ULL << 40) : values[block + i - 1] + ((i & 1) ? 1 : (1U << 20));
+    compressed_size = column_roundtrip(column, values + block, block, compressed, output);
+    ASSERT(compressed_size != 0 && compressed_size < 300);
+
+    // frame-of-reference: values alternating between the ends of a range, a delta costs 21 bits under its leading one
+    for (uint32_t i = 0; i < block; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        values[block * 2 + i] = 5000000000ULL + ((i & 1) << 20) + (seed >> 28);
+    }
+    compressed_size = column_roundtrip(column, values + block * 2, block, compressed, output);
+    ASSERT(compressed_size != 0 && compressed_size < 300);
+
+    // the three blocks in a column: the predictions continue from the previous block
+    ASSERT(column_roundtrip(column, values, block * 3, compressed, output) != 0);
+
+    // frame-of-reference across blocks: the base is coded from the last value of the previous block, the range moves
+    // up and down, the difference wraps around, and the last block is partial
+    static const uint64_t bases[] = {0, 5000000000ULL, 1000, UINT64_MAX - (1 << 21), 1ULL << 40, 7, 1ULL << 63, 3};
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        values[i] = bases[i / block] + ((i & 1) << 20) + (seed >> 28);
+    }
+    compressed_size = column_roundtrip(column, values, count, compressed, output);
+    ASSERT(compressed_size != 0 && compressed_size < count * 2);
+
+    // residuals of 64 bits: a difference of 2^63 in any prediction
+    for (uint32_t i = 0; i < block; ++i)
+        values[i] = (uint64_t)(i & 1) << 63;
+    compressed_size = column_roundtrip(column, values, block, compressed, output);
+    ASSERT(compressed_size != 0 && compressed_size < column_compress_bound(block));
+
+    column_terminate(column);
+    free(compressed);
+    free(output);
+    free(values);
+    PASS();
+}
+
+#ifdef AC_TRACE
+
+struct trace_log
+{
+    uint8_t data[1 << 16];
+    uint32_t size;
+};
+
+static void trace_write(void* user_data, const void* data, uint32_t size)
+{
+    struct trace_log* log = (struct trace_log*) user_data;
+    if (log->size + size <= sizeof(log->data))
+        memcpy(log->data + log->size, data, size);
+    log->size += size;
+}
+
+static uint8_t* trace_varint(uint8_t* p, uint32_t value)
+{
+    for (; value >= 0x80; value >>= 7)
+        *p++ = (uint8_t)(value | 0x80);
+    *p++ = (uint8_t) value;
+    return p;
+}
+
+TEST trace(void)
+{
+    static struct trace_log log;
+    float probability[3] = {0.25f, 0.25f, 0.5f};
+    struct adaptive_model* model = adaptive_model_init(5);
+    struct static_model* model_static = static_model_init(3, probability);
+    struct arithmetic_codec* codec = ac_init();
+    uint8_t buffer[local_buffer_size];
+
+    log.size = 0;
+    ac_set_trace(codec, trace_write, &log);
+    ac_set_buffer(codec, local_buffer_size, buffer);
+    ac_start_encoder(codec);
+    ac_encode_adaptive(codec, 4, model);
+    ac_put_bits(codec, 200, 9);
+    ac_encode_static(codec, 2, model_static);
+    ac_encode_adaptive(codec, 1, model);
+    ac_stop_encoder(codec);
+
+    // ids are given at init, in the order of creation
+    struct replay_reader reader = {log.data + 6, log.data + log.size};
+    uint32_t id;
+    ASSERT(log.size > 6 && replay_read_varint(&reader, &id));
+
+    uint8_t expected[64] = {'A', 'C', 'T', '2', AC_TRACE_START_ENCODER, AC_TRACE_ADAPTIVE_MODEL};
+    uint8_t* p = trace_varint(expected + 6, id);
+    const uint8_t adaptive[] = {5, 15, 0, 0, 0, AC_TRACE_ENCODE_ADAPTIVE};     // just reset: no state
+    memcpy(p, adaptive, sizeof(adaptive));
+    p = trace_varint(p + sizeof(adaptive), id);
+    const uint8_t bits[] = {4, AC_TRACE_PUT_BITS, 9, 0xc8, 0x01, AC_TRACE_STATIC_MODEL};
+    memcpy(p, bits, sizeof(bits));
+    p = trace_varint(p + sizeof(bits), id + 1);
+    const uint8_t distribution[] = {3, 15, 0, 0, 0, 0x80, 0x40, 0x80, 0x80, 0x01, AC_TRACE_ENCODE_STATIC};
+    memcpy(p, distribution, sizeof(distribution));
+    p = trace_varint(p + sizeof(distribution), id + 1);
+    *p++ = 2;
+    *p++ = AC_TRACE_ENCODE_ADAPTIVE;    // only changed by this codec: no new record
+    p = trace_varint(p, id);
+    *p++ = 1;
+    *p++ = AC_TRACE_STOP_ENCODER;
+
+    ASSERT_EQ((uint32_t)(p - expected), log.size);
+    ASSERT_MEM_EQ(expected, log.data, log.size);
+
+    ac_set_trace(codec, NULL, NULL);
+    ac_terminate(codec);
+    adaptive_model_terminate(model);
+    static_model_terminate(model_static);
+
+    PASS();
+}
+
+struct trace_models
+{
+    struct adaptive_model *adaptive, *quasi_static;
+    struct static_model* model;
+    struct context_hash_model* context_hash;
+    struct tree_model* tree;
+    ac_bit_model bit;
+};
+
+static void trace_models_init(struct trace_models* m)
+{
+    const float probability[4] = {0.5f, 0.25f, 0.125f, 0.125f};
+    m->adaptive = adaptive_model_init(16);
+    adaptive_model_set_precision(m->adaptive, 13);
+    adaptive_model_set_decay(m->adaptive, 2);
+    adaptive_model_set_sorted(m->adaptive, 1);
+    m->quasi_static = adaptive_model_init(8);
+    m->model = static_model_init(4, probability);
+    static_model_set_lookup(m->model, 1);
+    m->context_hash = context_hash_model_init(4096);
+    m->tree = tree_model_init(12, 64);      // the pool fills up
+    m->bit = AC_BIT_MODEL_INIT;
+}
+
+static void trace_models_terminate(struct trace_models* m)
+{
+    adaptive_model_terminate(m->adaptive);
+    adaptive_model_terminate(m->quasi_static);
+    static_model_terminate(m->model);
+    context_hash_model_terminate(m->context_hash);
+    tree_model_terminate(m->tree);
+}
+
+// Code a stream using every kind of model, returns the number of decoding errors
+static uint32_t trace_stream(struct arithmetic_codec* codec, struct trace_models* m, uint32_t count, int encode)
+{
+    uint32_t errors = 0;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        const uint32_t data[7] = {(i * 7) % 3 == 0, (i % 5 == 0) ? i % 16 : 3, i % 8, i % 4, (i * 37) & 255,
+                                  (i * 97) % 4096, i & 511};
+        if (i % 64 == 63)
+            adaptive_model_end_block(m->quasi_static);
+
+        if (encode)
+        {
+            ac_encode_bit(codec, data[0], &m->bit);
+            ac_encode_adaptive(codec, data[1], m->adaptive);
+            ac_encode_quasi_static(codec, data[2], m->quasi_static);
+            ac_encode_static(codec, data[3], m->model);
+            ac_encode_context_hash(codec, data[4], i % 7, m->context_hash);
+            ac_encode_tree(codec, data[5], m->tree);
+            ac_put_bits(codec, data[6], 9);
+        }
+        else
+        {
+            errors += ac_decode_bit(codec, &m->bit) != data[0];
+            errors += ac_decode_adaptive(codec, m->adaptive) != data[1];
+            errors += ac_decode_quasi_static(codec, m->quasi_static) != data[2];
+            errors += ac_decode_static(codec, m->model) != data[3];
+            errors += ac_decode_context_hash(codec, i % 7, m->context_hash) != data[4];
+            errors += ac_decode_tree(codec, m->tree) != data[5];
+            errors += ac_get_bits(codec, 9) != data[6];
+        }
+    }
+    return errors;
+}
+
+// Replay the log and compare with the bytes of the traced sessions
+static int trace_replays_to(const struct trace_log* log, const uint8_t* bytes, uint32_t size)
+{
+    struct replay replay;
+    struct arithmetic_codec* codec = ac_init();
+    int same = replay_parse(&replay, log->data, log->size) == NULL;
+
+    uint8_t* buffer = (uint8_t*) malloc(replay.buffer_size + 16);
+    uint32_t* sizes = (uint32_t*) malloc((replay.num_sessions + 1) * sizeof(uint32_t));
+    if (same)
+    {
+        same = replay_encode(&replay, codec, buffer, sizes) == size && memcmp(buffer, bytes, size) == 0;
+        same = same && replay_decode(&replay, codec, buffer, sizes) == 0;
+    }
+
+    free(sizes);
+    free(buffer);
+    replay_terminate(&replay);
+    ac_terminate(codec);
+    return same;
+}
+
+TEST trace_replay(void)
+{
+    static struct trace_log log;
+    static uint8_t buffer[1 << 16], other[1 << 12];
+    struct arithmetic_codec* codec = ac_init();
+    struct arithmetic_codec* other_codec = ac_init();
+    struct trace_models m;
+    trace_models_init(&m);
+
+    log.size = 0;
+    ac_set_trace(codec, trace_write, &log);
+    ac_set_buffer(codec, sizeof(buffer), buffer);
+    ac_start_encoder(codec);
+    trace_stream(codec, &m, 100, 1);
+
+    // another codec changes the models in the middle of the session
+    ac_start_message_encoder(other_codec, other, sizeof(other));
+    for (uint32_t i = 0; i < 50; ++i)
+    {
+        ac_encode_adaptive(other_codec, i & 15, m.adaptive);
+        ac_encode_context_hash(other_codec, i, 3, m.context_hash);
+    }
+    ac_stop_message_encoder(other_codec);
+
+    trace_stream(codec, &m, 100, 1);
+    uint32_t size = ac_stop_encoder(codec);
+
+    // settings, loaded state and a message session
+    adaptive_model_set_decay(m.adaptive, 4);
+    static_model_set_precision(m.model, 12);
+    uint8_t state[1024];
+    ASSERT(tree_model_get_state_size(m.tree) <= sizeof(state));
+    tree_model_save_state(m.tree, state);
+    ASSERT(tree_model_load_state(m.tree, state, tree_model_get_state_size(m.tree)));
+
+    ac_start_message_encoder(codec, buffer + size, sizeof(buffer) - size);
+    trace_stream(codec, &m, 150, 1);
+    size += ac_stop_message_encoder(codec);
+
+    ASSERT(log.size <= sizeof(log.data));
+    ASSERT(trace_replays_to(&log, buffer, size));
+    trace_models_terminate(&m);
+
+    // decoder sessions replay as the encoder which wrote them
+    struct trace_models encoder_models, decoder_models;
+    trace_models_init(&encoder_models);
+    trace_models_init(&decoder_models);
+    ac_set_buffer(other_codec, sizeof(buffer), buffer);
+    ac_start_encoder(other_codec);
+    trace_stream(other_codec, &encoder_models, 200, 1);
+    size = ac_stop_encoder(other_codec);
+
+    log.size = 0;
+    ac_set_trace(codec, trace_write, &log);
+    ac_set_buffer(codec, size, buffer);
+    ac_start_decoder(codec);
+    ASSERT_EQ(0, trace_stream(codec, &decoder_models, 200, 0));
+    ac_stop_decoder(codec);
+    ASSERT(log.size <= sizeof(log.data));
+    ASSERT(trace_replays_to(&log, buffer, size));
+    trace_models_terminate(&encoder_models);
+    trace_models_terminate(&decoder_models);
+
+    // the state of a suspended encoder is not in the log
+    struct ac_encoder_state encoder_state;
+    log.size = 0;
+    ac_set_trace(codec, trace_write, &log);
+    ac_set_buffer(codec, sizeof(buffer), buffer);
+    ac_start_encoder(codec);
+    ac_put_bits(codec, 5, 3);
+    ac_suspend_encoder(codec, &encoder_state);
+    ASSERT_FALSE(trace_replays_to(&log, buffer, 0));
+
+    ac_set_trace(codec, NULL, NULL);
+    ac_terminate(codec);
+    ac_terminate(other_codec);
+    PASS();
+}
+
+#endif
+
+GREATEST_MAIN_DEFS();
+
+int main(int argc, char **argv)
+{
+    GREATEST_MAIN_BEGIN();
+
+    RUN_TEST(adaptive_model);
+    RUN_TEST(put_get_bits);
+    RUN_TEST(context_hash_model);
+    RUN_TEST(adaptive_model_decay);
+    RUN_TEST(quasi_static_model);
+    RUN_TEST(semi_static_blocks);
+    RUN_TEST(tree_model);
+    RUN_TEST(model_precision);
+    RUN_TEST(static_lookup_table);
+    RUN_TEST(static_cutoff_table);
+    RUN_TEST(sorted_adaptive_model);
+    RUN_TEST(binary_codec);
+    RUN_TEST(checkpoints);
+    RUN_TEST(isa_dispatch);
+    RUN_TEST(allocator);
+    RUN_TEST(codec_pool);
+    RUN_TEST(small_messages);
+    RUN_TEST(batch_messages);
+    RUN_TEST(encoder_resume);
+    RUN_TEST(chunked_output);
+    RUN_TEST(segmented_input);
+    RUN_TEST(lz_codec);
+    RUN_TEST(bwt_codec);
+    RUN_TEST(column_codec);
+#ifdef AC_TRACE
+    RUN_TEST(trace);
+    RUN_TEST(trace_replay);
+#endif
 
     GREATEST_MAIN_END();
 }
@@ -0,0 +1,227 @@
+#include <stdint.h>
+#include <vector>
+#include "greatest.h"
+#include "../arithmetic_codec.hpp"
+
+enum {num_symbols = 4000, alphabet_size = 24};
+
+//----------------------------------------------------------------------------------------------------------------------
+static std::vector<uint32_t> make_data(uint32_t seed)
+{
+    std::vector<uint32_t> data(num_symbols);
+    for (uint32_t& symbol : data)
+    {
+        seed = seed * 1103515245 + 12345;
+        uint32_t r = (seed >> 16) & 255;
+        symbol = (r * r * alphabet_size) >> 16;
+    }
+    return data;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Adaptive symbols at even positions, static at odd ones
+static std::vector<uint8_t> encode(const std::vector<uint32_t>& data, adaptive_model* adaptive, static_model* model)
+{
+    std::vector<uint8_t> buffer(num_symbols * 2);
+    arithmetic_codec* codec = ac_init();
+    adaptive_model_reset(adaptive);
+    ac_set_buffer(codec, (uint32_t) buffer.size(), buffer.data());
+    ac_start_encoder(codec);
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        if (i & 1)
+            ac_encode_static(codec, data[i], model);
+        else
+            ac_encode_adaptive(codec, data[i], adaptive);
+    }
+    buffer.resize(ac_stop_encoder(codec));
+    ac_terminate(codec);
+    return buffer;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+TEST generator(void)
+{
+    std::vector<uint32_t> data = make_data(5);
+    adaptive_model* model = adaptive_model_init(alphabet_size);
+    arithmetic_codec* codec = ac_init();
+    std::vector<uint8_t> buffer(num_symbols * 2);
+
+    ac_set_buffer(codec, (uint32_t) buffer.size(), buffer.data());
+    ac_start_encoder(codec);
+    for (uint32_t symbol : data)
+        ac_encode_adaptive(codec, symbol, model);
+    uint32_t size = ac_stop_encoder(codec);
+
+    adaptive_model_reset(model);
+    ac_set_buffer(codec, size, buffer.data());
+    ac_start_decoder(codec);
+    size_t count = 0;
+    for (uint32_t symbol : ac::decode_adaptive(codec, model, data.size()))
+        ASSERT_EQ_FMT(data[count++], symbol, "%u");
+    ASSERT_EQ(data.size(), count);
+    ac_stop_decoder(codec);
+
+    // symbols are decoded lazily: stopping early leaves the decoder right after the last symbol
+    adaptive_model_reset(model);
+    ac_start_decoder(codec);
+    count = 0;
+    for (uint32_t symbol : ac::decode_adaptive(codec, model, data.size()))
+    {
+        ASSERT_EQ_FMT(data[count++], symbol, "%u");
+        if (count == 100)
+            break;
+    }
+    for (uint32_t symbol : ac::decode_adaptive(codec, model, data.size() - count))
+        ASSERT_EQ_FMT(data[count++], symbol, "%u");
+    ASSERT_EQ(data.size(), count);
+    ac_stop_decoder(codec);
+
+    ac_terminate(codec);
+    adaptive_model_terminate(model);
+    PASS();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static ac::task parse(ac::async_decoder& decoder, adaptive_model* adaptive, static_model* model,
+                      std::vector<uint32_t>& output)
+{
+    for (size_t i = 0; i < num_symbols; ++i)
+    {
+        if (i & 1)
+            output.push_back(co_await decoder.decode_static(model));
+        else
+            output.push_back(co_await decoder.decode_adaptive(adaptive));
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+TEST async_decoder(void)
+{
+    std::vector<uint32_t> data = make_data(9);
+    float probability[alphabet_size];
+    for (uint32_t i = 0; i < alphabet_size; ++i)
+        probability[i] = 1.f / (float) alphabet_size;
+
+    adaptive_model* adaptive = adaptive_model_init(alphabet_size);
+    static_model* model = static_model_init(alphabet_size, probability);
+    arithmetic_codec* codec = ac_init();
+    std::vector<uint8_t> buffer = encode(data, adaptive, model);
+
+    for (uint32_t max_piece = 1; max_piece < 64; max_piece *= 3)
+    {
+        std::vector<uint32_t> output;
+        adaptive_model_reset(adaptive);
+        {
+            ac::async_decoder decoder(codec);
+            ac::task consumer = parse(decoder, adaptive, model, output);
+
+            // the input arrives in small pieces, the consumer runs as soon as it has enough of them
+            uint32_t seed = max_piece;
+            size_t offset = 0;
+            while (offset < buffer.size())
+            {
+                ASSERT(!consumer.done());
+                seed = seed * 1103515245 + 12345;
+                size_t piece = 1 + (seed >> 16) % max_piece;
+                if (piece > buffer.size() - offset)
+                    piece = buffer.size() - offset;
+
+                decoder.feed(buffer.data() + offset, piece);
+                offset += piece;
+            }
+
+            // only the last symbols wait for the end of the input
+            ASSERT(output.size() + 32 > data.size());
+            decoder.finish();
+            ASSERT(consumer.done());
+        }
+
+        ASSERT_EQ(data.size(), output.size());
+        for (size_t i = 0; i < data.size(); ++i)
+            ASSERT_EQ_FMT(data[i], output[i], "%u");
+    }
+
+    ac_terminate(codec);
+    static_model_terminate(model);
+    adaptive_model_terminate(adaptive);
+    PASS();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static ac::task parse_bits(ac::async_decoder& decoder, size_t count, std::vector<uint32_t>& output)
+{
+    ac_bit_model model = AC_BIT_MODEL_INIT;
+    for (size_t i = 0; i < count; ++i)
+        output.push_back(co_await decoder.decode_bit(&model));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+TEST async_decoder_short_input(void)
+{
+    arithmetic_codec* codec = ac_init();
+    std::vector<uint8_t> message(64), previous(64, 0xFF);
+    uint32_t covered[2] = {0, 0};
+    const size_t overrun = 4096;        // a likely bit costs 1/100 bit, enough to read a few bytes
+
+    // messages of 0 to 3 bytes: the decoder starts on finish() and reads the missing bytes as zeros, like a message
+    // decoder does past the end. Symbols are decoded past the message to renormalize
+    for (size_t count = 1; count < 64; ++count)
+    {
+        ac_bit_model model = AC_BIT_MODEL_INIT;
+        ac_start_message_encoder(codec, message.data(), (uint32_t) message.size());
+        for (size_t i = 0; i < count; ++i)
+            ac_encode_bit(codec, (i % 9) == 8, &model);
+        uint32_t size = ac_stop_message_encoder(codec);
+        if (size >= 4)
+            continue;
+        covered[size != 0]++;
+
+        std::vector<uint32_t> expected;
+        model = AC_BIT_MODEL_INIT;
+        ac_start_message_decoder(codec, message.data(), size);
+        for (size_t i = 0; i < count + overrun; ++i)
+            expected.push_back(ac_decode_bit(codec, &model));
+        ac_stop_decoder(codec);
+
+        // an earlier decode leaves the codec on other data
+        ac_set_buffer(codec, (uint32_t) previous.size(), previous.data());
+        ac_start_decoder(codec);
+        ac_get_bits(codec, 16);
+        ac_stop_decoder(codec);
+
+        std::vector<uint32_t> output;
+        {
+            ac::async_decoder decoder(codec);
+            ac::task consumer = parse_bits(decoder, count + overrun, output);
+            if (size != 0)
+                decoder.feed(message.data(), size);
+            ASSERT(!consumer.done());
+            decoder.finish();
+            ASSERT(consumer.done());
+        }
+
+        ASSERT_EQ(count + overrun, output.size());
+        for (size_t i = 0; i < count + overrun; ++i)
+            ASSERT_EQ_FMT(expected[i], output[i], "%u");
+        for (size_t i = 0; i < count; ++i)
+            ASSERT_EQ_FMT((uint32_t)((i % 9) == 8), output[i], "%u");
+    }
+    ASSERT(covered[0] > 0 && covered[1] > 0);
+
+    ac_terminate(codec);
+    PASS();
+}
+
+GREATEST_MAIN_DEFS();
+
+int main(int argc, char **argv)
+{
+    GREATEST_MAIN_BEGIN();
+
+    RUN_TEST(generator);
+    RUN_TEST(async_decoder);
+    RUN_TEST(async_decoder_short_input);
+
+    GREATEST_MAIN_END();
+}